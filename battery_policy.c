@@ -0,0 +1,256 @@
+/******************************************************************************
+ *  FILE
+ *      battery_policy.c
+ *
+ *  DESCRIPTION
+ *      This file implements the battery degradation policy. Each rung of the
+ *      ladder caps the TX power mode, stretches the beacon period and may
+ *      turn off the LED and buzzer. The last rung is the last gasp, which
+ *      sends a short burst of beacons every LAST_GASP_PERIOD, so that the
+ *      battery level keeps being reported until the battery is critical.
+ *      The device steps down a rung as soon as the battery level falls to
+ *      its threshold, but only steps back up once the level has risen
+ *      BATTERY_POLICY_HYSTERESIS above it.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "battery_policy.h" /* Interface to this file */
+#include "esurl_beacon_service.h" /* Beacon service interface */
+#include "user_config.h"    /* User configuration */
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Rise in battery level, in percent, above the threshold of the current
+ * rung needed to step back up, so that a level which wanders around a
+ * threshold does not change the rung on every check
+ */
+#define BATTERY_POLICY_HYSTERESIS           (5)
+
+/* Longest advertising interval allowed by the Core spec. A stretched period
+ * is limited to it, unless the configured period is longer already.
+ */
+#define BATTERY_POLICY_INTERVAL_MAX         (10240 * MILLISECOND)
+
+/*============================================================================*
+ *  Private Data Types
+ *============================================================================*/
+
+/* Rung of the degradation ladder */
+typedef struct _BATTERY_POLICY_RUNG_T
+{
+    /* Battery level, in percent, at or below which the rung applies */
+    uint8 level;
+
+    /* Highest TX power mode allowed */
+    uint8 tx_power_mode;
+
+    /* Factor by which the beacon period is stretched */
+    uint8 period_scale;
+
+    /* TRUE if the LED and buzzer may be used */
+    bool indications;
+
+    /* TRUE if only bursts of beacons are sent */
+    bool last_gasp;
+
+} BATTERY_POLICY_RUNG_T;
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Degradation ladder, from a full battery down to the last gasp. The device
+ * goes dormant below the last rung, at BATTERY_LEVEL_CRITICAL.
+ */
+static const BATTERY_POLICY_RUNG_T g_battery_policy_rungs[] =
+{
+    {100,   TX_POWER_MODE_HIGH,     1, TRUE,  FALSE},
+#ifdef ENABLE_BATTERY_POLICY
+    {BATTERY_POLICY_LEVEL_REDUCED,
+            TX_POWER_MODE_LOW,      2, FALSE, FALSE},
+    {BATTERY_POLICY_LEVEL_LOW,
+            TX_POWER_MODE_LOWEST,   4, FALSE, FALSE},
+    {BATTERY_POLICY_LEVEL_LAST_GASP,
+            TX_POWER_MODE_LOWEST,   1, FALSE, TRUE}
+#endif /* ENABLE_BATTERY_POLICY */
+};
+
+/* Number of rungs on the ladder */
+#define BATTERY_POLICY_RUNGS \
+    (sizeof(g_battery_policy_rungs) / sizeof(g_battery_policy_rungs[0]))
+
+/* Current rung, as an index into g_battery_policy_rungs */
+static uint16 g_battery_policy_rung;
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      BatteryPolicyInit
+ *
+ *  DESCRIPTION
+ *      This function initialises the battery policy at chip reset. The
+ *      ladder is entered at the top, and the first check moves it to the
+ *      rung for the battery level.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void BatteryPolicyInit(void)
+{
+    g_battery_policy_rung = 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      BatteryPolicyUpdate
+ *
+ *  DESCRIPTION
+ *      This function moves to the rung for the battery level. The lowest
+ *      rung whose threshold the level has fallen to is taken at once,
+ *      whereas rungs are left upwards one at a time, each once the level is
+ *      BATTERY_POLICY_HYSTERESIS above its threshold.
+ *
+ *  PARAMETERS
+ *      level [in]              Battery level, in percent
+ *
+ *  RETURNS
+ *      TRUE if the rung changed
+ *----------------------------------------------------------------------------*/
+extern bool BatteryPolicyUpdate(uint8 level)
+{
+    uint16 rung = g_battery_policy_rung;
+    uint16 i;
+
+    for(i = rung + 1; i < BATTERY_POLICY_RUNGS; i++)
+    {
+        if(level <= g_battery_policy_rungs[i].level)
+        {
+            rung = i;
+        }
+    }
+
+    while(rung > 0 &&
+          level > g_battery_policy_rungs[rung].level +
+                  BATTERY_POLICY_HYSTERESIS)
+    {
+        rung--;
+    }
+
+    if(rung == g_battery_policy_rung)
+    {
+        return FALSE;
+    }
+
+    g_battery_policy_rung = rung;
+
+    return TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      BatteryPolicyTxPowerMode
+ *
+ *  DESCRIPTION
+ *      This function limits the configured TX power mode to the highest
+ *      mode allowed by the current rung.
+ *
+ *  PARAMETERS
+ *      tx_power_mode [in]      Configured TX power mode
+ *
+ *  RETURNS
+ *      TX power mode to use
+ *----------------------------------------------------------------------------*/
+extern uint8 BatteryPolicyTxPowerMode(uint8 tx_power_mode)
+{
+    uint8 max_mode = g_battery_policy_rungs[g_battery_policy_rung].
+                                                            tx_power_mode;
+
+    return (tx_power_mode > max_mode) ? max_mode : tx_power_mode;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      BatteryPolicyBeaconInterval
+ *
+ *  DESCRIPTION
+ *      This function stretches the configured beacon period by the factor of
+ *      the current rung. In the last gasp rung it returns the interval used
+ *      within each burst.
+ *
+ *  PARAMETERS
+ *      period [in]             Configured beacon period, microseconds
+ *
+ *  RETURNS
+ *      Beacon interval to use, microseconds
+ *----------------------------------------------------------------------------*/
+extern uint32 BatteryPolicyBeaconInterval(uint32 period)
+{
+    const BATTERY_POLICY_RUNG_T *p_rung =
+                                &g_battery_policy_rungs[g_battery_policy_rung];
+    uint32 interval;
+
+    if(p_rung->last_gasp)
+    {
+        return LAST_GASP_ADVERT_INTERVAL;
+    }
+
+    interval = period * p_rung->period_scale;
+
+    if(interval > BATTERY_POLICY_INTERVAL_MAX)
+    {
+        interval = (period > BATTERY_POLICY_INTERVAL_MAX) ?
+                                        period : BATTERY_POLICY_INTERVAL_MAX;
+    }
+
+    return interval;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      BatteryPolicyIndicationsEnabled
+ *
+ *  DESCRIPTION
+ *      This function returns whether the current rung allows the LED and
+ *      buzzer to be used.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if the LED and buzzer may be used
+ *----------------------------------------------------------------------------*/
+extern bool BatteryPolicyIndicationsEnabled(void)
+{
+    return g_battery_policy_rungs[g_battery_policy_rung].indications;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      BatteryPolicyIsLastGasp
+ *
+ *  DESCRIPTION
+ *      This function returns whether the device is in the last gasp rung, in
+ *      which it sends a burst of beacons every LAST_GASP_PERIOD.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if in the last gasp rung
+ *----------------------------------------------------------------------------*/
+extern bool BatteryPolicyIsLastGasp(void)
+{
+    return g_battery_policy_rungs[g_battery_policy_rung].last_gasp;
+}
@@ -0,0 +1,60 @@
+/******************************************************************************
+ *  FILE
+ *      battery_policy.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the battery degradation policy. As the battery
+ *      runs down, a beaconing device steps down a ladder of rungs, each of
+ *      which saves more current than the last, so that a tag near the end of
+ *      its life keeps reporting for as long as possible.
+ *
+ *****************************************************************************/
+
+#ifndef __BATTERY_POLICY_H__
+#define __BATTERY_POLICY_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <time.h>           /* Chip time functions */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* How often the battery level is checked while beaconing. The check is also
+ * made whenever the battery low system event is received.
+ */
+#define BATTERY_POLICY_CHECK_PERIOD         (1 * MINUTE)
+
+/* Length of each burst of beacons sent in the last gasp rung, and the
+ * advertising interval used within it
+ */
+#define LAST_GASP_BURST_LENGTH              (1 * SECOND)
+#define LAST_GASP_ADVERT_INTERVAL           (100 * MILLISECOND)
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Initialise the battery policy at chip reset */
+extern void BatteryPolicyInit(void);
+
+/* Move to the rung for the battery level, returning TRUE if it changed */
+extern bool BatteryPolicyUpdate(uint8 level);
+
+/* Return the TX power mode to use in place of the configured mode */
+extern uint8 BatteryPolicyTxPowerMode(uint8 tx_power_mode);
+
+/* Return the beacon interval to use in place of the configured period */
+extern uint32 BatteryPolicyBeaconInterval(uint32 period);
+
+/* Return TRUE if the LED and buzzer may be used */
+extern bool BatteryPolicyIndicationsEnabled(void);
+
+/* Return TRUE if only bursts of beacons are sent, every LAST_GASP_PERIOD */
+extern bool BatteryPolicyIsLastGasp(void);
+
+#endif /* __BATTERY_POLICY_H__ */
@@ -65,8 +65,13 @@ typedef struct _BATT_DATA_T
     /* Client configuration descriptor for Battery Level characteristic */
     gatt_client_config level_client_config;
 
-    /* NVM Offset at which Battery data is stored */
-    uint16 nvm_offset;
+    /* Client configuration of each bonded host, indexed like the bonding
+     * table, so that a host does not see the configuration of another
+     */
+    gatt_client_config bonded_client_config[MAX_BONDED_HOSTS];
+
+    /* NVM record holding the client configurations of the bonded hosts */
+    NVM_RECORD_T nvm_record;
 
 } BATT_DATA_T;
 
@@ -91,16 +96,6 @@ static BATT_DATA_T g_batt_data;
 #define BATTERY_FULL_BATTERY_VOLTAGE                  (3000)          /* 3.0V */
 #define BATTERY_FLAT_BATTERY_VOLTAGE                  (1800)          /* 1.8V */
 
-/* Number of words of NVM memory used by Battery Service */
-#define BATTERY_SERVICE_NVM_MEMORY_WORDS              (1)
-
-/* The offset of data being stored in NVM for the Battery Service. This offset
- * is added to the Battery Service offset in the NVM region (see
- * g_batt_data.nvm_offset) to get the absolute offset at which this data is
- * stored in NVM.
- */
-#define BATTERY_NVM_LEVEL_CLIENT_CONFIG_OFFSET        (0)
-
 /*============================================================================*
  *  Private Function Prototypes
  *===========================================================================*/
@@ -171,14 +166,20 @@ uint8 readBatteryLevel(void)
  *----------------------------------------------------------------------------*/
 extern void BatteryDataInit(void)
 {
-    if(!IsDeviceBonded())
+    uint8 index = GetBondIndex();
+
+    /* Use the client configuration stored for the connected host if it is
+     * bonded, otherwise start with notifications disabled
+     */
+    if(index != APP_BOND_INDEX_INVALID)
+    {
+        g_batt_data.level_client_config =
+                            g_batt_data.bonded_client_config[index];
+    }
+    else
     {
-        /* Initialise battery level client configuration characterisitic
-         * descriptor value only if device is not bonded
-         */
         g_batt_data.level_client_config = gatt_client_config_none;
     }
-
 }
 
 /*----------------------------------------------------------------------------*
@@ -283,6 +284,7 @@ extern void BatteryHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
 {
     uint8 *p_value = p_ind->value;      /* New attribute value */
     uint16 client_config;               /* Client configuration descriptor */
+    uint8 index;                        /* Bonding table index of the host */
     sys_status rc = sys_status_success; /* Function status */
 
     switch(p_ind->handle)
@@ -302,15 +304,14 @@ extern void BatteryHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
             {
                 g_batt_data.level_client_config = client_config;
 
-                /* Write battery level client configuration to NVM if the 
-                 * device is bonded.
+                /* Queue battery level client configuration to be written to
+                 * NVM if the connected host is bonded.
                  */
-                if(IsDeviceBonded())
+                index = GetBondIndex();
+                if(index != APP_BOND_INDEX_INVALID)
                 {
-                     Nvm_Write(&client_config,
-                              sizeof(client_config),
-                              g_batt_data.nvm_offset + 
-                              BATTERY_NVM_LEVEL_CLIENT_CONFIG_OFFSET);
+                    g_batt_data.bonded_client_config[index] = client_config;
+                    Nvm_WriteRecordDeferred(&g_batt_data.nvm_record);
                 }
             }
             else
@@ -402,31 +403,31 @@ extern void BatteryUpdateLevel(uint16 ucid)
  *      NVM.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to Battery Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void BatteryReadDataFromNVM(uint16 *p_offset)
+extern void BatteryReadDataFromNVM(void)
 {
+    uint8 i;
 
-    g_batt_data.nvm_offset = *p_offset;
+    Nvm_InitRecord(&g_batt_data.nvm_record, nvm_partition_battery,
+                   (uint16*)g_batt_data.bonded_client_config,
+                   sizeof(g_batt_data.bonded_client_config));
 
-    /* Read NVM only if devices are bonded */
-    if(IsDeviceBonded())
+    /* Read the client configurations of the bonded hosts. If neither copy
+     * is valid, fall back to no notifications and rewrite the record.
+     */
+    if(!Nvm_ReadRecord(&g_batt_data.nvm_record))
     {
-        /* Read battery level client configuration descriptor */
-        Nvm_Read((uint16*)&g_batt_data.level_client_config,
-                sizeof(g_batt_data.level_client_config),
-                *p_offset + 
-                BATTERY_NVM_LEVEL_CLIENT_CONFIG_OFFSET);
-    }
+        for(i = 0; i < MAX_BONDED_HOSTS; i++)
+        {
+            g_batt_data.bonded_client_config[i] = gatt_client_config_none;
+        }
 
-    /* Increment the offset by the number of words of NVM memory required 
-     * by the Battery Service 
-     */
-    *p_offset += BATTERY_SERVICE_NVM_MEMORY_WORDS;
+        Nvm_WriteRecord(&g_batt_data.nvm_record);
+    }
 
 }
 /*----------------------------------------------------------------------------*
@@ -438,45 +439,29 @@ extern void BatteryReadDataFromNVM(uint16 *p_offset)
  *      NVM.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to Beacon Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void BatteryWriteDataToNVM(uint16 *p_offset)
+extern void BatteryWriteDataToNVM(void)
 {
+    uint8 i;
 
-    g_batt_data.nvm_offset = *p_offset;
-    
-    /* Increment the offset by the number of words of NVM memory required 
-     * by the Beacon Service 
-     */
-    *p_offset += BATTERY_SERVICE_NVM_MEMORY_WORDS;
-}
+    Nvm_InitRecord(&g_batt_data.nvm_record, nvm_partition_battery,
+                   (uint16*)g_batt_data.bonded_client_config,
+                   sizeof(g_batt_data.bonded_client_config));
 
+    for(i = 0; i < MAX_BONDED_HOSTS; i++)
+    {
+        g_batt_data.bonded_client_config[i] = gatt_client_config_none;
+    }
 
-/*----------------------------------------------------------------------------*
- *  NAME
- *      BatteryCheckHandleRange
- *
- *  DESCRIPTION
- *      This function is used to check if the handle belongs to the Battery 
- *      Service.
- *
- *  PARAMETERS
- *      handle [in]             Handle to check
- *
- *  RETURNS
- *      TRUE if handle belongs to the Battery Service, FALSE otherwise
- *----------------------------------------------------------------------------*/
-extern bool BatteryCheckHandleRange(uint16 handle)
-{
-    return ((handle >= HANDLE_BATTERY_SERVICE) &&
-            (handle <= HANDLE_BATTERY_SERVICE_END))
-            ? TRUE : FALSE;
+    /* Write the client configurations to NVM for the first time */
+    Nvm_WriteRecord(&g_batt_data.nvm_record);
 }
 
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      BatteryBondingNotify
@@ -493,17 +478,18 @@ extern bool BatteryCheckHandleRange(uint16 handle)
  *----------------------------------------------------------------------------*/
 extern void BatteryBondingNotify(void)
 {
+    uint8 index = GetBondIndex();
 
     /* Write data to NVM if bond is established */
-    if(IsDeviceBonded())
+    if(index != APP_BOND_INDEX_INVALID)
     {
-        /* Write to NVM the client configuration value of battery level 
-         * that was configured prior to bonding 
+        /* Write to NVM the client configuration value of battery level
+         * that was configured prior to bonding, in place of that of any host
+         * the entry was taken from
          */
-        Nvm_Write((uint16*)&g_batt_data.level_client_config, 
-                  sizeof(g_batt_data.level_client_config), 
-                  g_batt_data.nvm_offset + 
-                  BATTERY_NVM_LEVEL_CLIENT_CONFIG_OFFSET);
+        g_batt_data.bonded_client_config[index] =
+                            g_batt_data.level_client_config;
+        Nvm_WriteRecord(&g_batt_data.nvm_record);
     }
 
 }
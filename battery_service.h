@@ -46,6 +46,16 @@
 #include <types.h>          /* Commonly used type definitions */
 #include <gatt.h>           /* GATT application interface */
 
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Battery level, in percent, at or below which the device stops beaconing
+ * and goes dormant, and the level above which it starts beaconing again
+ */
+#define BATTERY_LEVEL_CRITICAL              (5)
+#define BATTERY_LEVEL_RECOVERED             (15)
+
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -75,13 +85,10 @@ extern void BatteryHandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
 extern void BatteryUpdateLevel(uint16 ucid);
 
 /* Read the Battery Service specific data stored in NVM */
-extern void BatteryReadDataFromNVM(uint16 *p_offset);
+extern void BatteryReadDataFromNVM(void);
 
 /* Write the Battery Service specific data to NVM */
-extern void BatteryWriteDataToNVM(uint16 *p_offset);
-
-/* Check if the handle belongs to the Battery Service */
-extern bool BatteryCheckHandleRange(uint16 handle);
+extern void BatteryWriteDataToNVM(void);
 
 /* Notify bonding status to the Battery Service */
 extern void BatteryBondingNotify(void);
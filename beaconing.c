@@ -42,7 +42,7 @@
 #include <gatt.h>           /* GATT application interface */
 #include <buf_utils.h>      /* Buffer functions */
 #include <mem.h>            /* Memory routines */
-#include <timer.h>
+#include <time.h>           /* Chip time functions */
 #include <gatt_prim.h>
 #include <gatt_uuid.h>
 #include <ls_app_if.h>
@@ -55,6 +55,11 @@
 #include "esurl_beacon.h" /* Interface to this file */
 #include "esurl_beacon_service.h" /* Interface to this file */
 #include "beaconing.h"      /* Beaconing routines */
+#include "user_config.h"    /* User configuration */
+#include "vtimer.h"         /* Virtual timers */
+#include "battery_policy.h" /* Battery degradation policy */
+#include "pattern.h"        /* Feedback patterns */
+#include "schedule_service.h" /* Beaconing schedule */
 
 /*=============================================================================*
  *  Private Definitions
@@ -67,21 +72,58 @@
  */
 #define ADVERT_SIZE                     (28)
 
+/* Fraction of the beacon interval by which the beacon data may be updated
+ * late, to share a wake with other work
+ */
+#define BEACON_SLACK_DIVISOR            (8)
+
 /*============================================================================*
  *  Private data
  *============================================================================*/
 
 /* Timer for the beaconing instance */
-static timer_id     beacon_tid;
+static vtimer_id    beacon_tid;
+
+/* System time at which the running beacon timer was started. The time
+ * between start and expiry is measured, as the timer may expire up to its
+ * slack late.
+ */
+static uint32       beacon_timer_start;
+
+/* TRUE while a last gasp burst of beacons is being sent */
+static bool         beacon_burst;
+
+/* Time beaconed since the battery level was last checked, in microseconds */
+static uint32       battery_check_elapsed;
+
+#ifdef LED_HEARTBEAT_PERIOD
+/* Time beaconed since the last heartbeat flash, in microseconds */
+static uint32       heartbeat_elapsed;
+#endif /* LED_HEARTBEAT_PERIOD */
+
+#ifdef CONFIG_WINDOW_PERIOD
+/* Time beaconed since the last configuration window, in microseconds */
+static uint32       config_window_elapsed;
+#endif /* CONFIG_WINDOW_PERIOD */
 
 /*============================================================================*
  *  Private Function Prototypes
  *===========================================================================*/
 
 /* Control beacon at timer expiry */
-static void appBeaconTimerHandler(timer_id tid);
+static void appBeaconTimerHandler(vtimer_id tid);
+/* Start the beacon timer */
+static void beaconStartTimer(uint32 timeout);
+/* Start or end a last gasp burst of beacons */
+static void beaconBurst(bool start);
+/* Return the beacon interval to use */
+static uint32 beaconInterval(void);
+#ifdef LED_HEARTBEAT_PERIOD
+/* Flash the LED if a heartbeat is due */
+static void beaconHeartbeat(bool force);
+#endif /* LED_HEARTBEAT_PERIOD */
 /* Beacon update data to LS adv storage */
-static uint32 BeaconUpdateData(void);
+static void BeaconUpdateData(uint32 beacon_interval);
 
 /*============================================================================*
  *  Private Function Implementations
@@ -100,17 +142,193 @@ static uint32 BeaconUpdateData(void);
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void appBeaconTimerHandler(timer_id tid)
+static void appBeaconTimerHandler(vtimer_id tid)
 {
     if(tid == beacon_tid)
     {
-        uint32 beacon_interval = BeaconUpdateData();
+        uint32 beacon_interval;
+        uint32 elapsed = TimeGet32() - beacon_timer_start;
+
+        beacon_tid = VTIMER_INVALID;
+
+        battery_check_elapsed += elapsed;
+
+#ifdef LED_HEARTBEAT_PERIOD
+        heartbeat_elapsed += elapsed;
+#endif /* LED_HEARTBEAT_PERIOD */
+
+#ifdef CONFIG_WINDOW_PERIOD
+        /* Open a connectable configuration window once its period has
+         * elapsed. Leaving the beaconing state stops the beacon.
+         */
+        config_window_elapsed += elapsed;
+        if(config_window_elapsed >= CONFIG_WINDOW_PERIOD)
+        {
+            config_window_elapsed = 0;
+
+            HandleConfigWindow();
+            return;
+        }
+#endif /* CONFIG_WINDOW_PERIOD */
+
+        /* Check the battery level once its period has elapsed. A change of
+         * rung restarts or stops the beacon.
+         */
+        if(battery_check_elapsed >= BATTERY_POLICY_CHECK_PERIOD)
+        {
+            battery_check_elapsed = 0;
+
+            if(HandleBatteryCheck())
+            {
+                return;
+            }
+        }
+
+        /* Follow the schedule. Entering or leaving a window restarts the
+         * beacon, and outside every window the beacon stays off until the
+         * next one opens.
+         */
+        if(ScheduleUpdate())
+        {
+            BeaconStart(TRUE);
+            return;
+        }
+
+        if(!ScheduleIsBeaconOn())
+        {
+            beaconStartTimer(ScheduleTimeToNextWindow());
+            return;
+        }
+
+        if(BatteryPolicyIsLastGasp())
+        {
+            /* Alternate between bursts and silence */
+            beaconBurst(!beacon_burst);
+            return;
+        }
+
+#ifdef LED_HEARTBEAT_PERIOD
+        beaconHeartbeat(FALSE);
+#endif /* LED_HEARTBEAT_PERIOD */
+
+        beacon_interval = beaconInterval();
+        BeaconUpdateData(beacon_interval);
     
         /* Loop the beacon timer */
-        beacon_tid = TimerCreate(beacon_interval, TRUE, appBeaconTimerHandler);
+        beaconStartTimer(beacon_interval);
     }   
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      beaconStartTimer
+ *
+ *  DESCRIPTION
+ *      This function starts the beacon timer, which may expire up to an
+ *      eighth of its timeout late.
+ *
+ *  PARAMETERS
+ *      timeout [in]            Timeout, microseconds
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void beaconStartTimer(uint32 timeout)
+{
+    beacon_timer_start = TimeGet32();
+    beacon_tid = VTimerCreate(timeout, timeout / BEACON_SLACK_DIVISOR,
+                              appBeaconTimerHandler);
+
+    if(beacon_tid == VTIMER_INVALID)
+    {
+        ReportPanic(app_panic_timer_create);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      beaconBurst
+ *
+ *  DESCRIPTION
+ *      This function starts or ends a last gasp burst of beacons. A burst
+ *      lasts LAST_GASP_BURST_LENGTH and is followed by silence for the rest
+ *      of LAST_GASP_PERIOD.
+ *
+ *  PARAMETERS
+ *      start [in]              TRUE to start a burst, FALSE to end it
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void beaconBurst(bool start)
+{
+    beacon_burst = start;
+
+    if(start)
+    {
+        BeaconUpdateData(LAST_GASP_ADVERT_INTERVAL);
+
+        LsStartStopAdvertise(TRUE, whitelist_disabled, ls_addr_type_random);
+
+        beaconStartTimer(LAST_GASP_BURST_LENGTH);
+    }
+    else
+    {
+        LsStartStopAdvertise(FALSE, whitelist_disabled, ls_addr_type_random);
+
+        beaconStartTimer(LAST_GASP_PERIOD - LAST_GASP_BURST_LENGTH);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      beaconInterval
+ *
+ *  DESCRIPTION
+ *      This function returns the beacon interval, which is the period set by
+ *      the current window of the schedule, or else the configured period,
+ *      stretched by the battery policy.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Beacon interval, microseconds
+ *----------------------------------------------------------------------------*/
+static uint32 beaconInterval(void)
+{
+    return BatteryPolicyBeaconInterval(
+                    ScheduleBeaconPeriod(EsurlBeaconGetPeriodMillis()));
+}
+
+#ifdef LED_HEARTBEAT_PERIOD
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      beaconHeartbeat
+ *
+ *  DESCRIPTION
+ *      This function flashes the LED on a beacon wake once LED_HEARTBEAT_PERIOD
+ *      has elapsed since the last flash, unless the battery policy has turned
+ *      the LED off.
+ *
+ *  PARAMETERS
+ *      force [in]              TRUE to flash whether or not a flash is due
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void beaconHeartbeat(bool force)
+{
+    if((force || heartbeat_elapsed >= LED_HEARTBEAT_PERIOD) &&
+       BatteryPolicyIndicationsEnabled() && !PatternIsPlaying())
+    {
+        heartbeat_elapsed = 0;
+
+        PatternPlay(pattern_heartbeat);
+    }
+}
+#endif /* LED_HEARTBEAT_PERIOD */
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      BeaconUpdateData
@@ -119,12 +337,12 @@ static void appBeaconTimerHandler(timer_id tid)
  *      This function is used to stop update the data to LS adv storage
  *
  *  PARAMETERS
- *      Nothing
+ *      beacon_interval [in]    Advertising interval, microseconds
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static uint32 BeaconUpdateData(void)
+static void BeaconUpdateData(uint32 beacon_interval)
 {
     uint8 advData[ADVERT_SIZE];
     uint16 offset = 0;
@@ -136,8 +354,6 @@ static uint32 BeaconUpdateData(void)
     uint8 len_i = 0;
     uint8 adv_parameter_len = 0;
     
-    uint32 beacon_interval = EsurlBeaconGetPeriodMillis();
-    
     /* clear the existing advertisement and scan response data */
     LsStoreAdvScanData(0, NULL, ad_src_advertise);
     LsStoreAdvScanData(0, NULL, ad_src_scan_rsp);
@@ -176,8 +392,8 @@ static uint32 BeaconUpdateData(void)
         LsStoreAdvScanData(offset, advData, ad_src_advertise);
     }
     
-    /* update the beaconing data */
-    EsurlBeaconUpdateData();
+    /* update the beaconing data, flagging the bursts of the last gasp */
+    EsurlBeaconUpdateData(BatteryPolicyIsLastGasp());
     
     /* get the beaconing data USING SERVICE */
     EsurlBeaconGetData(&beacon_data, &beacon_data_size);
@@ -210,8 +426,6 @@ static uint32 BeaconUpdateData(void)
         /* store the advertisement data */
         LsStoreAdvScanData(offset, advData, ad_src_advertise);
     }
-    
-    return beacon_interval;
 }
 
 /*============================================================================*
@@ -234,7 +448,18 @@ static uint32 BeaconUpdateData(void)
 extern void BeaconDataInit(void)
 {
     /* Initialise beacon timer */
-    beacon_tid = TIMER_INVALID;
+    beacon_tid = VTIMER_INVALID;
+    beacon_timer_start = 0;
+    beacon_burst = FALSE;
+    battery_check_elapsed = 0;
+
+#ifdef LED_HEARTBEAT_PERIOD
+    heartbeat_elapsed = 0;
+#endif /* LED_HEARTBEAT_PERIOD */
+
+#ifdef CONFIG_WINDOW_PERIOD
+    config_window_elapsed = 0;
+#endif /* CONFIG_WINDOW_PERIOD */
 }
 
 /*----------------------------------------------------------------------------*
@@ -254,17 +479,20 @@ extern void BeaconStart(bool start)
 {    
     /* Stop broadcasting */
     LsStartStopAdvertise(FALSE, whitelist_disabled, ls_addr_type_random);
+    beacon_burst = FALSE;
     
     /* Delete buzzer timer if running */
-    if (beacon_tid != TIMER_INVALID)
+    if (beacon_tid != VTIMER_INVALID)
     {
-        TimerDelete(beacon_tid);
-        beacon_tid = TIMER_INVALID;
+        VTimerDelete(beacon_tid);
+        beacon_tid = VTIMER_INVALID;
     }
     
     /* beacon_interval of zero overrides and stops beaconning */
-    if (start) 
+    if (start && EsurlBeaconGetPeriodMillis() != 0) 
     {
+        uint32 beacon_interval;
+
         /* prepare the advertisement packet */
    
         /* set the GAP Broadcaster role */
@@ -273,13 +501,37 @@ extern void BeaconStart(bool start)
                    gap_mode_connect_no,
                    gap_mode_bond_no,
                    gap_mode_security_none);
-        
-        uint32 beacon_interval = BeaconUpdateData();
+
+        /* Outside every window of the schedule, wait for the next one */
+        ScheduleUpdate();
+        if(!ScheduleIsBeaconOn())
+        {
+            beaconStartTimer(ScheduleTimeToNextWindow());
+            return;
+        }
+
+        /* Use the TX power of the window, as allowed by the battery */
+        EsurlBeaconUpdateTxPowerFromMode(BatteryPolicyTxPowerMode(
+                    ScheduleTxPowerMode(EsurlBeaconGetTxPowerMode())));
+
+        if(BatteryPolicyIsLastGasp())
+        {
+            beaconBurst(TRUE);
+            return;
+        }
+
+        beacon_interval = beaconInterval();
+        BeaconUpdateData(beacon_interval);
         
         /* Start broadcasting */
         LsStartStopAdvertise(TRUE, whitelist_disabled, ls_addr_type_random);
+
+#ifdef LED_HEARTBEAT_PERIOD
+        /* Show at once that beaconing has started */
+        beaconHeartbeat(TRUE);
+#endif /* LED_HEARTBEAT_PERIOD */
         
          /* Start the beacon timer */
-        beacon_tid = TimerCreate(beacon_interval/2, TRUE, appBeaconTimerHandler);
+        beaconStartTimer(beacon_interval / 2);
     }
 }
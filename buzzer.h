@@ -48,30 +48,6 @@
 /* Only compile this file if the buzzer code has been requested */
 #ifdef ENABLE_BUZZER
 
-/*============================================================================*
- *  Public data type
- *============================================================================*/
-
-/* Data type for different type of buzzer beeps */
-typedef enum
-{
-    /* No beeps */
-    buzzer_beep_off = 0,
-
-    /* Short beep */
-    buzzer_beep_short,
-
-    /* Long beep */
-    buzzer_beep_long,
-
-    /* Two short beeps */
-    buzzer_beep_twice,
-
-    /* Three short beeps */
-    buzzer_beep_thrice
-
-} buzzer_beep_type;
-
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -79,14 +55,8 @@ typedef enum
 /* Initialise the buzzer hardware */
 extern void BuzzerInitHardware(void);
 
-/* Initialise the buzzer data to a known state */
-extern void BuzzerInitData(void);
-
-/* Reset the buzzer data to a clean state */
-extern void BuzzerResetData(void);
-
-/* Trigger beeps of different types, enumerated by 'buzzer_beep_type' */
-extern void SoundBuzzer(buzzer_beep_type beep_type);
+/* Turn the buzzer on or off */
+extern void BuzzerSet(bool on);
 
 #else /* ENABLE_BUZZER */
 
@@ -95,9 +65,7 @@ extern void SoundBuzzer(buzzer_beep_type beep_type);
  */
 
 #define BuzzerInitHardware()
-#define BuzzerInitData()
-#define BuzzerResetData()
-#define SoundBuzzer(beep_type)
+#define BuzzerSet(on)
 
 #endif /* ENABLE_BUZZER */
 
@@ -0,0 +1,626 @@
+/******************************************************************************
+ *  FILE
+ *      conn_param_policy.c
+ *
+ *  DESCRIPTION
+ *      This file implements the connection parameter policy. A configuration
+ *      session does many reads and writes, which are slow at the preferred
+ *      500 ms interval, whereas an idle link wants the slowest interval and
+ *      highest latency the client will accept. The policy therefore has two
+ *      phases: fast while the client is accessing attributes, and slow once
+ *      the link has been quiet for CONN_PARAM_QUIET_PERIOD. Each phase makes
+ *      at most CONN_PARAM_MAX_ATTEMPTS requests. Activity only records its
+ *      time; the quiet timer checks it when it expires, so that frequent
+ *      accesses do not each restart the timer.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <mem.h>            /* Memory library */
+#include <ls_app_if.h>      /* Link Supervisor application interface */
+#include <panic.h>          /* Support for applications to panic */
+#include <time.h>           /* Chip time functions */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "conn_param_policy.h" /* Interface to this file */
+#include "gap_conn_params.h"/* Connection parameters */
+#include "esurl_beacon.h"   /* Definitions used throughout the GATT server */
+#include "gatt_access.h"    /* GATT-related routines */
+#include "vtimer.h"         /* Virtual timers */
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Time to wait before repeating a request which the client rejected or did
+ * not act on. Refer to section 9.3.9.2, Vol 3, Part C of the Core 4.0 BT
+ * spec: TGAP(conn_param_timeout) is 30 seconds.
+ */
+#define CONN_PARAM_RETRY_TIMEOUT            (30 * SECOND)
+
+/* Time by which the quiet and retry timers may expire late, to share a wake
+ * with other work
+ */
+#define CONN_PARAM_QUIET_SLACK              (1 * SECOND)
+#define CONN_PARAM_RETRY_SLACK              (5 * SECOND)
+
+/*============================================================================*
+ *  Private Data Types
+ *============================================================================*/
+
+/* Connection parameter policy phases */
+typedef enum
+{
+    /* Not connected */
+    conn_param_phase_idle = 0,
+
+    /* Client is accessing attributes, use the fast parameters */
+    conn_param_phase_fast,
+
+    /* Link is quiet, use the slow preferred parameters */
+    conn_param_phase_slow
+
+} conn_param_phase;
+
+/* Connection parameter policy data */
+typedef struct _CONN_PARAM_DATA_T
+{
+    /* Current phase */
+    conn_param_phase phase;
+
+    /* Address of the connected host */
+    TYPED_BD_ADDR_T bd_addr;
+
+    /* Current connection interval and slave latency */
+    uint16 conn_interval;
+    uint16 conn_latency;
+
+    /* Number of requests made in the current phase */
+    uint16 attempts;
+
+    /* TRUE while a request is waiting for its confirmation */
+    bool request_pending;
+
+    /* System time of the last attribute access by the client */
+    uint32 last_activity;
+
+    /* Timer which ends the fast phase once the link is quiet */
+    vtimer_id quiet_tid;
+
+    /* Timer for repeating a request */
+    vtimer_id retry_tid;
+
+} CONN_PARAM_DATA_T;
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Connection parameter policy data instance */
+static CONN_PARAM_DATA_T g_conn_param_data;
+
+/* Parameters requested in each phase */
+static ble_con_params g_conn_param_fast =
+{
+    FAST_MIN_CON_INTERVAL,
+    FAST_MAX_CON_INTERVAL,
+    FAST_SLAVE_LATENCY,
+    FAST_SUPERVISION_TIMEOUT
+};
+
+static ble_con_params g_conn_param_slow =
+{
+    PREFERRED_MIN_CON_INTERVAL,
+    PREFERRED_MAX_CON_INTERVAL,
+    PREFERRED_SLAVE_LATENCY,
+    PREFERRED_SUPERVISION_TIMEOUT
+};
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+/* Check whether the current parameters suit the current phase */
+static bool connParamCompliant(void);
+
+/* Request the parameters for the current phase if necessary */
+static void connParamRequest(void);
+
+/* Move to a new phase */
+static void connParamSetPhase(conn_param_phase phase);
+
+/* Start the timer for repeating a request */
+static void connParamStartRetryTimer(void);
+
+/* Repeat a request which the client rejected or did not act on */
+static void connParamRetry(void);
+
+/* Start the quiet timer */
+static void connParamStartQuietTimer(uint32 timeout);
+
+/* Handle the expiry of the retry timer */
+static void connParamRetryTimerHandler(vtimer_id tid);
+
+/* Handle the expiry of the quiet timer */
+static void connParamQuietTimerHandler(vtimer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamCompliant
+ *
+ *  DESCRIPTION
+ *      This function checks whether the current connection parameters suit
+ *      the current phase.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if no request is needed
+ *----------------------------------------------------------------------------*/
+static bool connParamCompliant(void)
+{
+    switch(g_conn_param_data.phase)
+    {
+        case conn_param_phase_fast:
+            return (g_conn_param_data.conn_interval <= FAST_MAX_CON_INTERVAL);
+
+        case conn_param_phase_slow:
+            return (g_conn_param_data.conn_interval >=
+                        PREFERRED_MIN_CON_INTERVAL &&
+                    g_conn_param_data.conn_interval <=
+                        PREFERRED_MAX_CON_INTERVAL &&
+                    g_conn_param_data.conn_latency >=
+                        PREFERRED_SLAVE_LATENCY);
+
+        default:
+            return TRUE;
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamRequest
+ *
+ *  DESCRIPTION
+ *      This function sends a connection parameter update request for the
+ *      current phase, unless the current parameters already suit it, a
+ *      request is already in progress or the phase has used all its
+ *      attempts.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamRequest(void)
+{
+    ble_con_params *p_params;
+
+    if(connParamCompliant() ||
+       g_conn_param_data.request_pending ||
+       g_conn_param_data.retry_tid != VTIMER_INVALID ||
+       g_conn_param_data.attempts >= CONN_PARAM_MAX_ATTEMPTS)
+    {
+        return;
+    }
+
+    p_params = (g_conn_param_data.phase == conn_param_phase_fast) ?
+               &g_conn_param_fast : &g_conn_param_slow;
+
+    if(LsConnectionParamUpdateReq(&g_conn_param_data.bd_addr,
+                                  p_params) != ls_err_none)
+    {
+        ReportPanic(app_panic_con_param_update);
+    }
+
+    g_conn_param_data.request_pending = TRUE;
+    ++ g_conn_param_data.attempts;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamSetPhase
+ *
+ *  DESCRIPTION
+ *      This function moves to a new phase, which has a fresh set of attempts,
+ *      and requests its parameters.
+ *
+ *  PARAMETERS
+ *      phase [in]              New phase
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamSetPhase(conn_param_phase phase)
+{
+    g_conn_param_data.phase = phase;
+    g_conn_param_data.attempts = 0;
+
+    /* A request for the old phase is no longer worth waiting for */
+    if(g_conn_param_data.retry_tid != VTIMER_INVALID)
+    {
+        VTimerDelete(g_conn_param_data.retry_tid);
+        g_conn_param_data.retry_tid = VTIMER_INVALID;
+    }
+
+    /* If a request is in progress, the parameters are checked against the
+     * new phase when it completes, and a request made straight away if they
+     * do not suit it
+     */
+    connParamRequest();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamStartRetryTimer
+ *
+ *  DESCRIPTION
+ *      This function starts the timer for repeating a request, if the phase
+ *      has attempts left.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamStartRetryTimer(void)
+{
+    if(g_conn_param_data.retry_tid == VTIMER_INVALID &&
+       g_conn_param_data.attempts < CONN_PARAM_MAX_ATTEMPTS &&
+       !connParamCompliant())
+    {
+        g_conn_param_data.retry_tid = VTimerCreate(CONN_PARAM_RETRY_TIMEOUT,
+                                                   CONN_PARAM_RETRY_SLACK,
+                                                   connParamRetryTimerHandler);
+
+        if(g_conn_param_data.retry_tid == VTIMER_INVALID)
+        {
+            ReportPanic(app_panic_timer_create);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamRetry
+ *
+ *  DESCRIPTION
+ *      This function repeats a request which the client rejected or did not
+ *      act on. If the phase changed while the request was in progress, the
+ *      new phase has made no request of its own yet, so one is made straight
+ *      away. Otherwise it is repeated after TGAP(conn_param_timeout), if the
+ *      phase has attempts left.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamRetry(void)
+{
+    if(g_conn_param_data.attempts == 0)
+    {
+        connParamRequest();
+    }
+    else
+    {
+        connParamStartRetryTimer();
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamStartQuietTimer
+ *
+ *  DESCRIPTION
+ *      This function starts the quiet timer, at whose expiry the policy
+ *      moves to the slow phase if there has been no activity for
+ *      CONN_PARAM_QUIET_PERIOD.
+ *
+ *  PARAMETERS
+ *      timeout [in]            Time to the expiry, microseconds
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamStartQuietTimer(uint32 timeout)
+{
+    g_conn_param_data.quiet_tid = VTimerCreate(timeout,
+                                               CONN_PARAM_QUIET_SLACK,
+                                               connParamQuietTimerHandler);
+
+    if(g_conn_param_data.quiet_tid == VTIMER_INVALID)
+    {
+        ReportPanic(app_panic_timer_create);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamRetryTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function handles the expiry of the retry timer.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of timer that has expired
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamRetryTimerHandler(vtimer_id tid)
+{
+    if(tid == g_conn_param_data.retry_tid)
+    {
+        /* The timer has just expired, so mark it as invalid */
+        g_conn_param_data.retry_tid = VTIMER_INVALID;
+
+        connParamRequest();
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      connParamQuietTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function handles the expiry of the quiet timer. If the client has
+ *      been quiet for CONN_PARAM_QUIET_PERIOD the policy moves to the slow
+ *      phase, otherwise the timer is started again for the rest of the
+ *      quiet period from the last activity.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of timer that has expired
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void connParamQuietTimerHandler(vtimer_id tid)
+{
+    uint32 quiet;
+
+    if(tid == g_conn_param_data.quiet_tid)
+    {
+        /* The timer has just expired, so mark it as invalid */
+        g_conn_param_data.quiet_tid = VTIMER_INVALID;
+
+        quiet = TimeGet32() - g_conn_param_data.last_activity;
+
+        if(quiet < CONN_PARAM_QUIET_PERIOD)
+        {
+            connParamStartQuietTimer(CONN_PARAM_QUIET_PERIOD - quiet);
+        }
+        else
+        {
+            connParamSetPhase(conn_param_phase_slow);
+        }
+    }
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamInit
+ *
+ *  DESCRIPTION
+ *      This function initialises the connection parameter policy at chip
+ *      reset.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamInit(void)
+{
+    g_conn_param_data.quiet_tid = VTIMER_INVALID;
+    g_conn_param_data.retry_tid = VTIMER_INVALID;
+
+    ConnParamReset();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamReset
+ *
+ *  DESCRIPTION
+ *      This function stops the connection parameter policy and resets its
+ *      data. It is called whenever the application data is reset.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamReset(void)
+{
+    if(g_conn_param_data.quiet_tid != VTIMER_INVALID)
+    {
+        VTimerDelete(g_conn_param_data.quiet_tid);
+        g_conn_param_data.quiet_tid = VTIMER_INVALID;
+    }
+
+    if(g_conn_param_data.retry_tid != VTIMER_INVALID)
+    {
+        VTimerDelete(g_conn_param_data.retry_tid);
+        g_conn_param_data.retry_tid = VTIMER_INVALID;
+    }
+
+    g_conn_param_data.phase = conn_param_phase_idle;
+    g_conn_param_data.conn_interval = 0;
+    g_conn_param_data.conn_latency = 0;
+    g_conn_param_data.attempts = 0;
+    g_conn_param_data.request_pending = FALSE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamConnected
+ *
+ *  DESCRIPTION
+ *      This function records the parameters the connection was established
+ *      with.
+ *
+ *  PARAMETERS
+ *      conn_interval [in]      Connection interval
+ *      conn_latency [in]       Slave latency
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamConnected(uint16 conn_interval, uint16 conn_latency)
+{
+    g_conn_param_data.conn_interval = conn_interval;
+    g_conn_param_data.conn_latency = conn_latency;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamStart
+ *
+ *  DESCRIPTION
+ *      This function starts applying the policy to the connection. A client
+ *      connects to configure the tag, so the policy starts in the fast phase.
+ *      It does nothing if the policy is already running.
+ *
+ *  PARAMETERS
+ *      p_addr [in]             Address of the connected host
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamStart(TYPED_BD_ADDR_T *p_addr)
+{
+    if(g_conn_param_data.phase != conn_param_phase_idle)
+    {
+        return;
+    }
+
+    MemCopy(&g_conn_param_data.bd_addr, p_addr, sizeof(TYPED_BD_ADDR_T));
+
+    g_conn_param_data.last_activity = TimeGet32();
+    connParamStartQuietTimer(CONN_PARAM_QUIET_PERIOD);
+    connParamSetPhase(conn_param_phase_fast);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamActivity
+ *
+ *  DESCRIPTION
+ *      This function notes attribute access by the client. It records the
+ *      time of the access, which the quiet timer checks when it expires, and
+ *      moves back to the fast phase if necessary. It does nothing until the
+ *      policy has been started.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamActivity(void)
+{
+    if(g_conn_param_data.phase == conn_param_phase_idle)
+    {
+        return;
+    }
+
+    g_conn_param_data.last_activity = TimeGet32();
+
+    /* The quiet timer only runs in the fast phase */
+    if(g_conn_param_data.phase != conn_param_phase_fast)
+    {
+        connParamStartQuietTimer(CONN_PARAM_QUIET_PERIOD);
+        connParamSetPhase(conn_param_phase_fast);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamHandleUpdateCfm
+ *
+ *  DESCRIPTION
+ *      This function handles the outcome of a connection parameter update
+ *      request. If the client rejected it, or the phase changed while it was
+ *      in progress, a further request is made.
+ *
+ *  PARAMETERS
+ *      success [in]            TRUE if the client accepted the request
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamHandleUpdateCfm(bool success)
+{
+    g_conn_param_data.request_pending = FALSE;
+
+    /* A request accepted for a phase which has since ended does not count
+     * as a request for the new phase
+     */
+    if(!success || g_conn_param_data.attempts == 0)
+    {
+        connParamRetry();
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamHandleUpdateInd
+ *
+ *  DESCRIPTION
+ *      This function handles a change of connection parameters. If the new
+ *      parameters do not suit the current phase, a new request is made.
+ *
+ *  PARAMETERS
+ *      conn_interval [in]      New connection interval
+ *      conn_latency [in]       New slave latency
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ConnParamHandleUpdateInd(uint16 conn_interval,
+                                     uint16 conn_latency)
+{
+    g_conn_param_data.conn_interval = conn_interval;
+    g_conn_param_data.conn_latency = conn_latency;
+
+    connParamRetry();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ConnParamGetInterval
+ *
+ *  DESCRIPTION
+ *      This function returns the current connection interval.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Connection interval in units of 1.25 ms, or 0 if not connected
+ *----------------------------------------------------------------------------*/
+extern uint16 ConnParamGetInterval(void)
+{
+    return g_conn_param_data.conn_interval;
+}
@@ -0,0 +1,52 @@
+/******************************************************************************
+ *  FILE
+ *      conn_param_policy.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the connection parameter policy. A fast
+ *      connection interval is requested while the client is accessing
+ *      attributes, and the slow, high latency preferred parameters once the
+ *      link has been quiet for CONN_PARAM_QUIET_PERIOD.
+ *
+ *****************************************************************************/
+
+#ifndef __CONN_PARAM_POLICY_H__
+#define __CONN_PARAM_POLICY_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <bluetooth.h>      /* Bluetooth specific type definitions */
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Initialise the connection parameter policy at chip reset */
+extern void ConnParamInit(void);
+
+/* Stop the connection parameter policy and reset its data */
+extern void ConnParamReset(void);
+
+/* Record the parameters the connection was established with */
+extern void ConnParamConnected(uint16 conn_interval, uint16 conn_latency);
+
+/* Start applying the policy to the connection, in the fast phase */
+extern void ConnParamStart(TYPED_BD_ADDR_T *p_addr);
+
+/* Note attribute access by the client */
+extern void ConnParamActivity(void);
+
+/* Handle the outcome of a connection parameter update request */
+extern void ConnParamHandleUpdateCfm(bool success);
+
+/* Handle a change of connection parameters */
+extern void ConnParamHandleUpdateInd(uint16 conn_interval,
+                                     uint16 conn_latency);
+
+/* Return the current connection interval */
+extern uint16 ConnParamGetInterval(void);
+
+#endif /* __CONN_PARAM_POLICY_H__ */
@@ -194,25 +194,3 @@ extern void DeviceInfoHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
     /* Send response indication */
     GattAccessRsp(p_ind->cid, p_ind->handle, rc, length, p_value);
 }
-
-/*----------------------------------------------------------------------------*
- *  NAME
- *      DeviceInfoCheckHandleRange
- *
- *  DESCRIPTION
- *      This function is used to check if the handle belongs to the Device 
- *      Information Service.
- *
- *  PARAMETERS
- *      handle [in]             Handle to check
- *
- *  RETURNS
- *      TRUE if handle belongs to the Device Information Service, FALSE
- *      otherwise
- *----------------------------------------------------------------------------*/
-extern bool DeviceInfoCheckHandleRange(uint16 handle)
-{
-    return ((handle >= HANDLE_DEVICE_INFO_SERVICE) &&
-            (handle <= HANDLE_DEVICE_INFO_SERVICE_END))
-            ? TRUE : FALSE;
-}
@@ -48,7 +48,4 @@
  */
 extern void DeviceInfoHandleAccessRead(GATT_ACCESS_IND_T *p_ind);
 
-/* Check if the handle belongs to the Device Information Service */
-extern bool DeviceInfoCheckHandleRange(uint16 handle);
-
 #endif /*__DEVICE_INFO_SERVICE_H__*/
@@ -44,6 +44,7 @@
 #include <main.h>           /* Functions relating to powering up the device */
 #include <types.h>          /* Commonly used type definitions */
 #include <timer.h>          /* Chip timer functions */
+#include <time.h>           /* Chip time functions */
 #include <mem.h>            /* Memory library */
 #include <config_store.h>   /* Interface to the Configuration Store */
 
@@ -63,77 +64,96 @@
                                 
 #include "gatt_access.h"    /* GATT-related routines */
 #include "app_gatt_db.h"    /* GATT database definitions */
-#include "buzzer.h"         /* Buzzer functions */
+#include "pattern.h"        /* Feedback patterns */
 #include "led.h"            /* LED functions */
 #include "nvm_access.h"     /* Non-volatile memory access */
 #include "esurl_beacon.h"    /* Definitions used throughout the GATT server */
 #include "hw_access.h"      /* Hardware access */
+#include "vtimer.h"         /* Virtual timers */
 #include "debug_interface.h"/* Application debug routines */
 #include "gap_service.h"    /* GAP service interface */
 #include "battery_service.h"/* Battery service interface */
 #include "temperature_service.h"/* Battery service interface */
 #include "esurl_beacon_service.h" /* Beacon service interface */
 #include "beaconing.h"      /* Beacon routines */
+#include "conn_param_policy.h" /* Connection parameter policy */
+#include "telemetry_service.h" /* Telemetry service interface */
+#include "battery_policy.h" /* Battery degradation policy */
+#include "schedule_service.h" /* Schedule service interface */
 
 /*============================================================================*
  *  Private Definitions
  *============================================================================*/
 
-/* Maximum number of timers. Up to five timers are required by this application:
+/* Maximum number of timers. Up to five timers are required by this
+ * application:
  *  
- *  buzzer.c:       buzzer_tid
- *  This file:      con_param_update_tid
+ *  vtimer.c:       g_vtimer_tid, which runs the virtual timers of
+ *                  nvm_access.c, conn_param_policy.c, telemetry_service.c,
+ *                  beaconing.c and this file, and keeps the uptime clock
+ *  pattern.c:      g_pattern_data.tid, which drives the buzzer and LED
+ *                  (if ENABLE_PATTERNS defined)
  *  This file:      app_tid
  *  This file:      bonding_reattempt_tid (if PAIRING_SUPPORT defined)
  *  hw_access.c:    button_press_tid
- *  This file:      connectable_advert_tid
+ *
+ * Timers which can tolerate some lateness should be virtual timers, see
+ * vtimer.h, rather than take another slot here. Slots are only reserved for
+ * the timers compiled in, as each one costs RAM.
  */
-#define MAX_APP_TIMERS                 (6)
+#if defined(ENABLE_PATTERNS) && defined(PAIRING_SUPPORT)
+#define MAX_APP_TIMERS                 (5)
+#elif defined(ENABLE_PATTERNS) || defined(PAIRING_SUPPORT)
+#define MAX_APP_TIMERS                 (4)
+#else
+#define MAX_APP_TIMERS                 (3)
+#endif
 
 /* Number of Identity Resolving Keys (IRKs) that application can store */
-#define MAX_NUMBER_IRK_STORED          (1)
+#define MAX_NUMBER_IRK_STORED          (MAX_BONDED_HOSTS)
 
-/* Magic value to check the sanity of Non-Volatile Memory (NVM) region used by
- * the application. This value is unique for each application.
+/* How often the battery is checked for recovery while dormant, and by how
+ * much the check may be delayed
  */
-#define NVM_SANITY_MAGIC               (0x6006)
-
-/* NVM offset for NVM sanity word */
-#define NVM_OFFSET_SANITY_WORD         (0)
-
-/* NVM offset for bonded flag */
-#define NVM_OFFSET_BONDED_FLAG         (NVM_OFFSET_SANITY_WORD + 1)
-
-/* NVM offset for bonded device Bluetooth address */
-#define NVM_OFFSET_BONDED_ADDR         (NVM_OFFSET_BONDED_FLAG + \
-                                        sizeof(g_app_data.bonded))
-
-/* NVM offset for diversifier */
-#define NVM_OFFSET_SM_DIV              (NVM_OFFSET_BONDED_ADDR + \
-                                        sizeof(g_app_data.bonded_bd_addr))
-
-/* NVM offset for IRK */
-#define NVM_OFFSET_SM_IRK              (NVM_OFFSET_SM_DIV + \
-                                        sizeof(g_app_data.diversifier))
-
-/* Number of words of NVM used by application. Memory used by supported 
- * services is not taken into consideration here.
+#define DORMANT_BATTERY_CHECK_PERIOD   (10 * MINUTE)
+#define DORMANT_BATTERY_CHECK_SLACK    (1 * MINUTE)
+
+/* Number of resolved private addresses remembered, and how long each is
+ * trusted for, in seconds. Hosts typically change their resolvable private
+ * address every 15 minutes. The age is taken from the uptime clock, as the
+ * 32-bit system time wraps every 71 minutes, after which an old entry would
+ * look recent again.
  */
-#define NVM_MAX_APP_MEMORY_WORDS       (NVM_OFFSET_SM_IRK + \
-                                        MAX_WORDS_IRK)
-
-/* Slave device is not allowed to transmit another Connection Parameter 
- * Update request till time TGAP(conn_param_timeout). Refer to section 9.3.9.2,
- * Vol 3, Part C of the Core 4.0 BT spec. The application should retry the 
- * 'Connection Parameter Update' procedure after time TGAP(conn_param_timeout)
- * which is 30 seconds.
+#define APP_RPA_CACHE_SIZE             (MAX_BONDED_HOSTS)
+#define APP_RPA_CACHE_LIFETIME         (15 * 60UL)
+
+/* Magic value to check the sanity of Non-Volatile Memory (NVM) region used by
+ * the application. This value is unique for each application. It is bumped
+ * once for each released NVM layout, not for each change made to the layout
+ * during development: a device holding an older layout starts fresh.
  */
-#define GAP_CONN_PARAM_TIMEOUT          (30 * SECOND)
+#define NVM_SANITY_MAGIC               (0x6007)
 
 /*============================================================================*
  *  Private Data types
  *============================================================================*/
 
+/* Resolvable private address which has been matched to a bonded host */
+typedef struct _APP_RPA_CACHE_T
+{
+    /* Resolvable private address of the host */
+    BD_ADDR_T                  addr;
+
+    /* Index into bond.host[], or APP_BOND_INDEX_INVALID if the entry is
+     * unused
+     */
+    uint8                      index;
+
+    /* Uptime, in seconds, at which the address was resolved */
+    uint32                     resolved_time;
+
+} APP_RPA_CACHE_T;
+
 /* Application data structure */
 typedef struct _APP_DATA_T
 {
@@ -148,36 +168,50 @@ typedef struct _APP_DATA_T
      */
     uint16                     st_ucid;
 
-    /* Boolean flag to indicate whether the device is bonded */
-    bool                       bonded;
+    /* Bonding information */
+    APP_BOND_DATA_T            bond;
 
-    /* TYPED_BD_ADDR_T of the host to which device is bonded */
-    TYPED_BD_ADDR_T            bonded_bd_addr;
+    /* NVM record holding the bonding information */
+    NVM_RECORD_T               bond_record;
 
-    /* Diversifier associated with the Long Term Key (LTK) of the bonded
-     * device
+    /* Index into bond.host[] of the connected host, or
+     * APP_BOND_INDEX_INVALID if it is not bonded
      */
-    uint16                     diversifier;
+    uint8                      bond_index;
 
-    /* Timer ID for Connection Parameter Update timer in Connected state */
-    timer_id                   con_param_update_tid;
-    
-    /* Central Private Address Resolution IRK. Will only be used when
-     * central device used resolvable random address.
+    /* Recently resolved private addresses of bonded hosts. These save
+     * resolving the address of a host which reconnects before it changes
+     * its address.
      */
-    uint16                     irk[MAX_WORDS_IRK];
+    APP_RPA_CACHE_T            rpa_cache[APP_RPA_CACHE_SIZE];
+
+    /* Index of the rpa_cache[] entry to be replaced next */
+    uint8                      rpa_cache_next;
 
-    /* Number of connection parameter update requests made */
-    uint8                      num_conn_update_req;
+    /* Keys distributed by a host which is pairing. They are held here until
+     * pairing completes successfully, so that a failed pairing does not
+     * replace an entry of the bonding table.
+     */
+    bool                       keys_pending;
+    uint16                     pending_diversifier;
+    uint16                     pending_irk[MAX_WORDS_IRK];
 
     /* Boolean flag to indicate pairing button press */
     bool                       pairing_button_pressed;
 
+    /* Boolean flag to indicate that advertising is for a scheduled
+     * configuration window rather than a button press
+     */
+    bool                       config_window;
+
     /* Timer ID for 'UNDIRECTED ADVERTS' and activity on the sensor device like
      * measurements or user intervention in CONNECTED state.
      */
     timer_id                   app_tid;
 
+    /* Timer for checking whether the battery has recovered while dormant */
+    vtimer_id                  dormant_tid;
+
     /* Boolean flag to indicate whether to set white list with the bonded
      * device. This flag is used in an interim basis while configuring 
      * advertisements.
@@ -230,6 +264,24 @@ static void appDataInit(void);
 /* Initialise and read NVM data */
 static void readPersistentStore(void);
 
+/* Initialise the bonding information */
+static void appBondDataInit(void);
+
+/* Forget the resolved private addresses of a bonding table entry */
+static void appRpaCacheFlush(uint8 index);
+
+/* Find the bonding table entry of a host */
+static uint8 appBondFind(TYPED_BD_ADDR_T *p_addr);
+
+/* Record that a bonded host has connected */
+static void appBondTouch(uint8 index);
+
+/* Find the bonding table entry to use for the host which is pairing */
+static uint8 appBondAllocate(void);
+
+/* Return the address of the most recently connected bonded host */
+static TYPED_BD_ADDR_T *appBondLastHost(void);
+
 /* Enable whitelist based advertising */
 static void enableWhiteList(void);
 
@@ -241,20 +293,23 @@ static void enableWhiteList(void);
     static void resetIdleTimer(void);
 #endif /* CONNECTED_IDLE_TIMEOUT_VALUE */
 
-/* Start the Connection update timer */
-static void appStartConnUpdateTimer(void);
-
 #ifdef PAIRING_SUPPORT
     /* Handle the expiry of the bonding chance timer */
     static void handleBondingChanceTimerExpiry(timer_id tid);
 #endif /* PAIRING_SUPPORT */
 
-/* Send L2CAP_CONNECTION_PARAMETER_UPDATE_REQUEST to the remote device */
-static void requestConnParamUpdate(timer_id tid);
-
 /* Exit the advertising states */
 static void appExitAdvertising(void);
 
+/* Start beaconing, or go dormant if beaconing is not possible */
+static void appStartBeaconing(void);
+
+/* Enter the dormant state */
+static void appEnterDormant(void);
+
+/* Check the battery while dormant */
+static void appDormantTimerHandler(vtimer_id tid);
+
 /* Exit the initialisation state */
 static void appInitExit(void);
 
@@ -338,12 +393,11 @@ static void appDataInit(void)
     /* Reset the pairing button press flag */
     g_app_data.pairing_button_pressed = FALSE;
 
-    /* Initialise the connection parameter update timer */
-    if (g_app_data.con_param_update_tid != TIMER_INVALID)
-    {
-        TimerDelete(g_app_data.con_param_update_tid);
-        g_app_data.con_param_update_tid = TIMER_INVALID;
-    }
+    /* Reset the configuration window flag */
+    g_app_data.config_window = FALSE;
+
+    /* Stop the connection parameter policy */
+    ConnParamReset();
 
     /* Initialise the connected client ID */
     g_app_data.st_ucid = GATT_INVALID_UCID;
@@ -351,6 +405,12 @@ static void appDataInit(void)
     /* Initialise white list flag */
     g_app_data.enable_white_list = FALSE;
 
+    /* The connected host, if any, is no longer known */
+    g_app_data.bond_index = APP_BOND_INDEX_INVALID;
+
+    /* Discard the keys of an unfinished pairing */
+    g_app_data.keys_pending = FALSE;
+
 #ifdef PAIRING_SUPPORT
     /* Initialise link encryption flag */
     g_app_data.encrypt_enabled = FALSE;
@@ -383,6 +443,9 @@ static void appDataInit(void)
     /* Battery Service data initialisation */
     BatteryDataInit();
 
+    /* Telemetry Service data initialisation */
+    TelemetryDataInit();
+
     /* Beacon data initialisation */
     BeaconDataInit();
     
@@ -407,10 +470,12 @@ static void appDataInit(void)
  *----------------------------------------------------------------------------*/
 static void readPersistentStore(void)
 {
-    /* NVM offset for supported services */
-    uint16 nvm_offset = NVM_MAX_APP_MEMORY_WORDS;
     uint16 nvm_sanity = 0xffff;
-    bool nvm_start_fresh = FALSE;
+
+    Nvm_InitRecord(&g_app_data.bond_record,
+                   nvm_partition_app_bond,
+                   (uint16*)&g_app_data.bond,
+                   sizeof(g_app_data.bond));
 
     /* Read persistent storage to find if the device was last bonded to another
      * device. If the device was bonded, trigger fast undirected advertisements
@@ -418,118 +483,340 @@ static void readPersistentStore(void)
      * trigger undirected advertisements for any host to connect.
      */
     
-    Nvm_Read(&nvm_sanity, 
-             sizeof(nvm_sanity), 
-             NVM_OFFSET_SANITY_WORD);
+    Nvm_ReadPartition(nvm_partition_sanity,
+                      &nvm_sanity,
+                      sizeof(nvm_sanity),
+                      0);
 
     if(nvm_sanity == NVM_SANITY_MAGIC)
     {
+        /* Load the newest valid copy of the bonding information. If neither
+         * copy is valid only the bonding is lost; the service records below
+         * are checked individually.
+         */
+        if(!Nvm_ReadRecord(&g_app_data.bond_record))
+        {
+            appBondDataInit();
+            Nvm_WriteRecord(&g_app_data.bond_record);
+        }
+
+        /* Read the service data from NVM. Each service reads its own
+         * partition, and a service whose record is corrupt restores and
+         * rewrites its own defaults.
+         */
+        GapReadDataFromNVM();
+        BatteryReadDataFromNVM();
+        TemperatureReadDataFromNVM();
+        EsurlBeaconReadDataFromNVM();
+        ScheduleReadDataFromNVM();
+
+        /* Add the 'read Service data from NVM' API call here, to initialise
+         * the service data, if the device is already bonded. A new service
+         * must be given its own partition in nvm_layout.h.
+         */
+    }
+    else /* NVM Sanity check failed means either the device is being brought up 
+          * for the first time or memory has got corrupted in which case 
+          * discard the data and start fresh.
+          */
+    {
+        /* The device will not be bonded as it is coming up for the first 
+         * time 
+         */
+        appBondDataInit();
+        Nvm_WriteRecord(&g_app_data.bond_record);
+
+        /* If fresh NVM, write the service data to NVM for the first time */
+        GapInitWriteDataToNVM();
+        BatteryWriteDataToNVM();
+        TemperatureWriteDataToNVM();
+        EsurlBeaconWriteDataToNVM();
+        ScheduleWriteDataToNVM();
+
+        /* Write NVM Sanity word to the NVM last, so that an interrupted
+         * first-time initialisation is repeated on the next power up
+         */
+        nvm_sanity = NVM_SANITY_MAGIC;
+        Nvm_WritePartition(nvm_partition_sanity,
+                           &nvm_sanity,
+                           sizeof(nvm_sanity),
+                           0);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appBondDataInit
+ *
+ *  DESCRIPTION
+ *      This function initialises the bonding information to the not bonded
+ *      state.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void appBondDataInit(void)
+{
+    /* The device is not bonded to any host, so no LTK is associated with it.
+     * Hence, every diversifier is 0.
+     */
+    MemSet(&g_app_data.bond, 0, sizeof(g_app_data.bond));
+
+    appRpaCacheFlush(APP_BOND_INDEX_INVALID);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appRpaCacheFlush
+ *
+ *  DESCRIPTION
+ *      This function forgets the resolved private addresses of a bonding table
+ *      entry, which must be done whenever the entry is replaced or unbonded.
+ *
+ *  PARAMETERS
+ *      index [in]              Index into bond.host[], or
+ *                              APP_BOND_INDEX_INVALID for every entry
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void appRpaCacheFlush(uint8 index)
+{
+    uint8 i;
+
+    for(i = 0; i < APP_RPA_CACHE_SIZE; i++)
+    {
+        if(index == APP_BOND_INDEX_INVALID ||
+           g_app_data.rpa_cache[i].index == index)
+        {
+            g_app_data.rpa_cache[i].index = APP_BOND_INDEX_INVALID;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appBondFind
+ *
+ *  DESCRIPTION
+ *      This function finds the bonding table entry of a host. A resolvable
+ *      random address is matched against the stored IRKs, any other address
+ *      against the stored addresses.
+ *
+ *  PARAMETERS
+ *      p_addr [in]             Address of the host
+ *
+ *  RETURNS
+ *      Index into bond.host[], or APP_BOND_INDEX_INVALID if the host is not
+ *      bonded
+ *----------------------------------------------------------------------------*/
+static uint8 appBondFind(TYPED_BD_ADDR_T *p_addr)
+{
+    APP_BOND_HOST_T *p_host;
+    APP_RPA_CACHE_T *p_cache;
+    uint32 now = VTimerGetUptime();
+    int16 match;
+    uint8 i;
+
+    if(GattIsAddressResolvableRandom(p_addr))
+    {
+        /* An address resolved recently is still the same host, and
+         * recognising it saves an AES operation per stored IRK
+         */
+        for(i = 0; i < APP_RPA_CACHE_SIZE; i++)
+        {
+            p_cache = &g_app_data.rpa_cache[i];
+
+            if(p_cache->index != APP_BOND_INDEX_INVALID &&
+               (now - p_cache->resolved_time) < APP_RPA_CACHE_LIFETIME &&
+               MemCmp(&p_cache->addr, &p_addr->addr,
+                      sizeof(BD_ADDR_T)) == 0)
+            {
+                return p_cache->index;
+            }
+        }
 
-        /* Read Bonded Flag from NVM */
-        Nvm_Read((uint16*)&g_app_data.bonded,
-                  sizeof(g_app_data.bonded),
-                  NVM_OFFSET_BONDED_FLAG);
+        match = SMPrivacyMatchAddress(p_addr,
+                                      g_app_data.bond.irk[0],
+                                      MAX_NUMBER_IRK_STORED,
+                                      MAX_WORDS_IRK);
 
-        if(g_app_data.bonded)
+        /* Only an entry for a bonded host using resolvable random addresses
+         * holds an IRK
+         */
+        if(match >= 0 && match < MAX_BONDED_HOSTS &&
+           g_app_data.bond.host[match].bonded &&
+           GattIsAddressResolvableRandom(
+                            &g_app_data.bond.host[match].bonded_bd_addr))
         {
-            /* Bonded Host Typed BD Address will only be stored if bonded flag
-             * is set to TRUE. Read last bonded device address.
-             */
-            Nvm_Read((uint16*)&g_app_data.bonded_bd_addr, 
-                       sizeof(TYPED_BD_ADDR_T),
-                       NVM_OFFSET_BONDED_ADDR);
+            /* Remember the address in place of the oldest one */
+            p_cache = &g_app_data.rpa_cache[g_app_data.rpa_cache_next];
+            p_cache->addr = p_addr->addr;
+            p_cache->index = (uint8)match;
+            p_cache->resolved_time = now;
 
-            /* If device is bonded and bonded address is resolvable then read 
-             * the bonded device's IRK
-             */
-            if(GattIsAddressResolvableRandom(&g_app_data.bonded_bd_addr))
+            if(++ g_app_data.rpa_cache_next == APP_RPA_CACHE_SIZE)
             {
-                Nvm_Read(g_app_data.irk, 
-                         MAX_WORDS_IRK,
-                         NVM_OFFSET_SM_IRK);
+                g_app_data.rpa_cache_next = 0;
             }
 
+            return (uint8)match;
         }
-        else /* Case when we have only written NVM_SANITY_MAGIC to NVM but 
-              * didn't get bonded to any host in the last powered session
-              */
+    }
+    else
+    {
+        for(i = 0; i < MAX_BONDED_HOSTS; i++)
         {
-            /* Any initialisation can be done here for non-bonded devices */
-            
+            p_host = &g_app_data.bond.host[i];
+
+            if(p_host->bonded &&
+               MemCmp(&p_host->bonded_bd_addr, p_addr,
+                      sizeof(TYPED_BD_ADDR_T)) == 0)
+            {
+                return i;
+            }
         }
+    }
 
-        /* Read the diversifier associated with the presently bonded/last 
-         * bonded device.
-         */
-        Nvm_Read(&g_app_data.diversifier, 
-                 sizeof(g_app_data.diversifier),
-                 NVM_OFFSET_SM_DIV);
+    return APP_BOND_INDEX_INVALID;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appBondTouch
+ *
+ *  DESCRIPTION
+ *      This function records that a bonded host has connected, making it the
+ *      most recently used entry of the bonding table. If it already is, as
+ *      when the same host connects for each configuration window, the table
+ *      is left as it is and not rewritten to NVM.
+ *
+ *  PARAMETERS
+ *      index [in]              Index into bond.host[]
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void appBondTouch(uint8 index)
+{
+    if(g_app_data.bond.host[index].last_used == g_app_data.bond.use_count)
+    {
+        return;
+    }
 
-        /* If NVM in use, read device name and length from NVM */
-        GapReadDataFromNVM(&nvm_offset);
+    g_app_data.bond.host[index].last_used = ++ g_app_data.bond.use_count;
 
+    /* Queue the bonding table to be written to NVM */
+    Nvm_WriteRecordDeferred(&g_app_data.bond_record);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appBondAllocate
+ *
+ *  DESCRIPTION
+ *      This function finds the bonding table entry to use for the connected
+ *      host, which has just paired. A host which is already bonded keeps its
+ *      entry. Otherwise a free entry is used, or failing that the least
+ *      recently used entry is replaced.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Index into bond.host[]
+ *----------------------------------------------------------------------------*/
+static uint8 appBondAllocate(void)
+{
+    APP_BOND_HOST_T *p_host;
+    uint16 age;
+    uint16 oldest_age = 0;
+    uint8 index = 0;
+    uint8 i;
+
+    if(g_app_data.bond_index != APP_BOND_INDEX_INVALID)
+    {
+        return g_app_data.bond_index;
     }
-    else /* NVM Sanity check failed means either the device is being brought up 
-          * for the first time or memory has got corrupted in which case 
-          * discard the data and start fresh.
-          */
+
+    for(i = 0; i < MAX_BONDED_HOSTS; i++)
     {
+        p_host = &g_app_data.bond.host[i];
 
-        nvm_start_fresh = TRUE;
+        if(!p_host->bonded)
+        {
+            appRpaCacheFlush(i);
+            return i;
+        }
 
-        nvm_sanity = NVM_SANITY_MAGIC;
+        /* Counting modulo 2^16 keeps the order right when use_count wraps */
+        age = g_app_data.bond.use_count - p_host->last_used;
+        if(age >= oldest_age)
+        {
+            oldest_age = age;
+            index = i;
+        }
+    }
 
-        /* Write NVM Sanity word to the NVM */
-        Nvm_Write(&nvm_sanity, 
-                  sizeof(nvm_sanity), 
-                  NVM_OFFSET_SANITY_WORD);
+    /* Forget the least recently used host */
+    p_host = &g_app_data.bond.host[index];
 
-        /* The device will not be bonded as it is coming up for the first 
-         * time 
-         */
-        g_app_data.bonded = FALSE;
+    if(!GattIsAddressResolvableRandom(&p_host->bonded_bd_addr))
+    {
+        if(LsDeleteWhiteListDevice(&p_host->bonded_bd_addr) != ls_err_none)
+        {
+            ReportPanic(app_panic_delete_whitelist);
+        }
+    }
 
-        /* Write bonded status to NVM */
-        Nvm_Write((uint16*)&g_app_data.bonded, 
-                   sizeof(g_app_data.bonded), 
-                  NVM_OFFSET_BONDED_FLAG);
+    MemSet(p_host, 0, sizeof(APP_BOND_HOST_T));
+    MemSet(g_app_data.bond.irk[index], 0, MAX_WORDS_IRK);
+    appRpaCacheFlush(index);
 
-        /* When the application is coming up for the first time after flashing 
-         * the image to it, it will not have bonded to any device. So, no LTK 
-         * will be associated with it. Hence, set the diversifier to 0.
-         */
-        g_app_data.diversifier = 0;
+    return index;
+}
 
-        /* Write the same to NVM. */
-        Nvm_Write(&g_app_data.diversifier, 
-                  sizeof(g_app_data.diversifier),
-                  NVM_OFFSET_SM_DIV);
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appBondLastHost
+ *
+ *  DESCRIPTION
+ *      This function returns the address of the most recently connected
+ *      bonded host, which advertising is aimed at.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Address of the host, or of an empty entry if the device is not bonded
+ *----------------------------------------------------------------------------*/
+static TYPED_BD_ADDR_T *appBondLastHost(void)
+{
+    APP_BOND_HOST_T *p_host;
+    uint16 age;
+    uint16 newest_age = 0xFFFF;
+    uint8 index = 0;
+    uint8 i;
 
-        /* If fresh NVM, write device name and length to NVM for the 
-         * first time.
-         */
-        GapInitWriteDataToNVM(&nvm_offset);
-        BatteryWriteDataToNVM(&nvm_offset);       
-        TemperatureWriteDataToNVM(&nvm_offset);       
-        EsurlBeaconWriteDataToNVM(&nvm_offset);
-    }
+    for(i = 0; i < MAX_BONDED_HOSTS; i++)
+    {
+        p_host = &g_app_data.bond.host[i];
 
-    /* Read Battery service data from NVM if the devices are bonded and  
-     * update the offset with the number of words of NVM required by 
-     * this service
-     */
-    nvm_offset = NVM_MAX_APP_MEMORY_WORDS;    
-    GapReadDataFromNVM(&nvm_offset);   
-    BatteryReadDataFromNVM(&nvm_offset);
-    TemperatureReadDataFromNVM(&nvm_offset);
-    EsurlBeaconReadDataFromNVM(&nvm_offset);
-    
-    
-    /* Add the 'read Service data from NVM' API call here, to initialise the
-     * service data, if the device is already bonded. One must take care of the
-     * offset being used for storing the data.
-     */
+        if(p_host->bonded)
+        {
+            age = g_app_data.bond.use_count - p_host->last_used;
+            if(age <= newest_age)
+            {
+                newest_age = age;
+                index = i;
+            }
+        }
+    }
 
+    return &g_app_data.bond.host[index].bonded_bd_addr;
 }
 
 /*----------------------------------------------------------------------------*
@@ -547,15 +834,24 @@ static void readPersistentStore(void)
  *----------------------------------------------------------------------------*/
 static void enableWhiteList(void)
 {
+    uint8 i;
+
     if(IsDeviceBonded())
     {
-        if(!GattIsAddressResolvableRandom(&g_app_data.bonded_bd_addr))
+        /* A resolvable random address cannot be put in the white list, so
+         * only enable it if no bonded host is using one
+         */
+        for(i = 0; i < MAX_BONDED_HOSTS; i++)
         {
-            /* Enable white list if the device is bonded and the bonded host 
-             * is not using resolvable random address.
-             */
-            g_app_data.enable_white_list = TRUE;
+            if(g_app_data.bond.host[i].bonded &&
+               GattIsAddressResolvableRandom(
+                                &g_app_data.bond.host[i].bonded_bd_addr))
+            {
+                return;
+            }
         }
+
+        g_app_data.enable_white_list = TRUE;
     }
 }
 
@@ -603,48 +899,66 @@ static void appIdleTimerHandler(timer_id tid)
 }
 #endif /* CONNECTED_IDLE_TIMEOUT_VALUE */
 
+#ifdef PAIRING_SUPPORT
 /*----------------------------------------------------------------------------*
  *  NAME
- *      appStartConnUpdateTimer
+ *      handleBondingChanceTimerExpiry
  *
  *  DESCRIPTION
- *      This function starts the connection parameter update timer.
- *      g_app_data.con_param_update_tid must be TIMER_INVALID on entry to this
- *      function.
+ *      This function is handle the expiry of bonding chance timer.
  *
  *  PARAMETERS
- *      None
+ *      tid [in]                ID of timer that has expired
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void appStartConnUpdateTimer(void)
+static void handleBondingChanceTimerExpiry(timer_id tid)
 {
-    if(g_app_data.conn_interval < PREFERRED_MIN_CON_INTERVAL ||
-       g_app_data.conn_interval > PREFERRED_MAX_CON_INTERVAL
-#if PREFERRED_SLAVE_LATENCY
-       || g_app_data.conn_latency < PREFERRED_SLAVE_LATENCY
-#endif
-      )
+    if(g_app_data.bonding_reattempt_tid == tid)
     {
-        /* Set the number of connection parameter update attempts to zero */
-        g_app_data.num_conn_update_req = 0;
-
-        /* Start timer to trigger connection parameter update procedure */
-        g_app_data.con_param_update_tid = TimerCreate(
-                            GAP_CONN_PARAM_TIMEOUT,
-                            TRUE, requestConnParamUpdate);
+        /* The timer has just expired, so mark it as invalid */
+        g_app_data.bonding_reattempt_tid = TIMER_INVALID;
+        /* The bonding chance timer has expired. This means the remote has not
+         * encrypted the link using old keys. Disconnect the link.
+         */
+        SetState(app_state_disconnecting);
+    }/* Else it may be due to some race condition. Ignore it. */
+}
+#endif /* PAIRING_SUPPORT */
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      appExitAdvertising
+ *
+ *  DESCRIPTION
+ *      This function is called while exiting app_state_fast_advertising and
+ *      app_state_slow_advertising states.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void appExitAdvertising(void)
+{
+    /* Cancel advertisement timer. It is not running during a directed
+     * advertisement burst.
+     */
+    if(g_app_data.app_tid != TIMER_INVALID)
+    {
+        TimerDelete(g_app_data.app_tid);
+        g_app_data.app_tid = TIMER_INVALID;
     }
 }
 
-#ifdef PAIRING_SUPPORT
 /*----------------------------------------------------------------------------*
  *  NAME
- *      handleBondingChanceTimerExpiry
+ *      appAdvertTimerHandler
  *
  *  DESCRIPTION
- *      This function is handle the expiry of bonding chance timer.
+ *      This function is used to handle Advertisement timer expiry.
  *
  *  PARAMETERS
  *      tid [in]                ID of timer that has expired
@@ -652,90 +966,60 @@ static void appStartConnUpdateTimer(void)
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void handleBondingChanceTimerExpiry(timer_id tid)
+static void appAdvertTimerHandler(timer_id tid)
 {
-    if(g_app_data.bonding_reattempt_tid == tid)
+    /* Based upon the timer id, stop on-going advertisements */
+    if(g_app_data.app_tid == tid)
     {
-        /* The timer has just expired, so mark it as invalid */
-        g_app_data.bonding_reattempt_tid = TIMER_INVALID;
-        /* The bonding chance timer has expired. This means the remote has not
-         * encrypted the link using old keys. Disconnect the link.
-         */
-        SetState(app_state_disconnecting);
-    }/* Else it may be due to some race condition. Ignore it. */
+        /* Timer has just expired so mark it as invalid */
+        g_app_data.app_tid = TIMER_INVALID;
+
+        GattStopAdverts();
+    }/* Else ignore timer expiry, could be because of 
+      * some race condition */
 }
-#endif /* PAIRING_SUPPORT */
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      requestConnParamUpdate
+ *      appStartBeaconing
  *
  *  DESCRIPTION
- *      This function is used to send L2CAP_CONNECTION_PARAMETER_UPDATE_REQUEST 
- *      to the remote device.
+ *      This function starts beaconing, unless beaconing is turned off by a
+ *      period of zero or the battery is critical, in which case the
+ *      application goes dormant.
  *
  *  PARAMETERS
- *      tid [in]                ID of timer that has expired
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void requestConnParamUpdate(timer_id tid)
+static void appStartBeaconing(void)
 {
-    /* Application specific preferred parameters */
-     ble_con_params app_pref_conn_param = 
-                {
-                    PREFERRED_MIN_CON_INTERVAL,
-                    PREFERRED_MAX_CON_INTERVAL,
-                    PREFERRED_SLAVE_LATENCY,
-                    PREFERRED_SUPERVISION_TIMEOUT
-                };
+    uint8 level = readBatteryLevel();
 
-    if(g_app_data.con_param_update_tid == tid)
+    if(EsurlBeaconGetPeriodMillis() == 0 || level <= BATTERY_LEVEL_CRITICAL)
     {
-        /* Timer has just expired, so mark it as being invalid */
-        g_app_data.con_param_update_tid = TIMER_INVALID;
-
-        /* Handle signal as per current state */
-        switch(g_app_data.state)
-        {
-
-            case app_state_connected:
-            {
-                /* Send Connection Parameter Update request using application 
-                 * specific preferred connection parameters
-                 */
-
-                if(LsConnectionParamUpdateReq(&g_app_data.con_bd_addr, 
-                                &app_pref_conn_param) != ls_err_none)
-                {
-                    ReportPanic(app_panic_con_param_update);
-                }
-
-                /* Increment the count for connection parameter update 
-                 * requests 
-                 */
-                ++ g_app_data.num_conn_update_req;
-
-            }
-            break;
-
-            default:
-                /* Ignore in other states */
-            break;
-        }
-
-    } /* Else ignore the timer */
+        SetState(app_state_dormant);
+    }
+    else
+    {
+        /* Beacon as the battery level allows */
+        BatteryPolicyUpdate(level);
 
+        SetState(app_state_beaconing);
+    }
 }
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      appExitAdvertising
+ *      appEnterDormant
  *
  *  DESCRIPTION
- *      This function is called while exiting app_state_fast_advertising and
- *      app_state_slow_advertising states.
+ *      This function is called upon entering the dormant state. When
+ *      beaconing is turned off, the chip itself goes dormant until the button
+ *      is pressed. When the battery is critical, the application stays in deep
+ *      sleep and checks the battery every DORMANT_BATTERY_CHECK_PERIOD.
  *
  *  PARAMETERS
  *      None
@@ -743,21 +1027,42 @@ static void requestConnParamUpdate(timer_id tid)
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void appExitAdvertising(void)
+static void appEnterDormant(void)
 {
-    /* Cancel advertisement timer. Must be valid because timer is active
-     * during app_state_fast_advertising and app_state_slow_advertising states.
+    /* Queued NVM writes must be committed before sleeping */
+    Nvm_CommitPending();
+
+    if(EsurlBeaconGetPeriodMillis() == 0)
+    {
+        /* Does not return. Pressing the button restarts the chip, which
+         * then advertises so that beaconing can be turned back on.
+         */
+        HwEnterDormant();
+    }
+
+    /* Stop any feedback pattern and the button press timer, and park every
+     * PIO except the button
      */
-    TimerDelete(g_app_data.app_tid);
-    g_app_data.app_tid = TIMER_INVALID;
+    HwDataReset();
+    HwParkPios();
+
+    g_app_data.dormant_tid = VTimerCreate(DORMANT_BATTERY_CHECK_PERIOD,
+                                          DORMANT_BATTERY_CHECK_SLACK,
+                                          appDormantTimerHandler);
+
+    if(g_app_data.dormant_tid == VTIMER_INVALID)
+    {
+        ReportPanic(app_panic_timer_create);
+    }
 }
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      appAdvertTimerHandler
+ *      appDormantTimerHandler
  *
  *  DESCRIPTION
- *      This function is used to handle Advertisement timer expiry.
+ *      This function checks whether the battery has recovered while the
+ *      application is dormant.
  *
  *  PARAMETERS
  *      tid [in]                ID of timer that has expired
@@ -765,17 +1070,28 @@ static void appExitAdvertising(void)
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void appAdvertTimerHandler(timer_id tid)
+static void appDormantTimerHandler(vtimer_id tid)
 {
-    /* Based upon the timer id, stop on-going advertisements */
-    if(g_app_data.app_tid == tid)
+    if(tid == g_app_data.dormant_tid)
     {
-        /* Timer has just expired so mark it as invalid */
-        g_app_data.app_tid = TIMER_INVALID;
+        g_app_data.dormant_tid = VTIMER_INVALID;
 
-        GattStopAdverts();
-    }/* Else ignore timer expiry, could be because of 
-      * some race condition */
+        if(readBatteryLevel() > BATTERY_LEVEL_RECOVERED)
+        {
+            appStartBeaconing();
+        }
+        else
+        {
+            g_app_data.dormant_tid = VTimerCreate(DORMANT_BATTERY_CHECK_PERIOD,
+                                                  DORMANT_BATTERY_CHECK_SLACK,
+                                                  appDormantTimerHandler);
+
+            if(g_app_data.dormant_tid == VTIMER_INVALID)
+            {
+                ReportPanic(app_panic_timer_create);
+            }
+        }
+    }
 }
 
 /*----------------------------------------------------------------------------*
@@ -794,18 +1110,10 @@ static void appAdvertTimerHandler(timer_id tid)
  *----------------------------------------------------------------------------*/
 static void appInitExit(void)
 {
-    if(g_app_data.bonded && 
-       !GattIsAddressResolvableRandom(&g_app_data.bonded_bd_addr))
-    {
-        /* If the device is bonded and the bonded device address is not
-         * resolvable random, configure the white list with the bonded 
-         * host address.
-         */
-        if(LsAddWhiteListDevice(&g_app_data.bonded_bd_addr) != ls_err_none)
-        {
-            ReportPanic(app_panic_add_whitelist);
-        }
-    }
+    /* Configure the white list with the addresses of the bonded hosts which
+     * are not using resolvable random addresses
+     */
+    AddBondedHostsToWhiteList();
 }
 
 #if defined(CONNECTED_IDLE_TIMEOUT_VALUE)
@@ -859,8 +1167,19 @@ static void handleSignalGattAddDbCfm(GATT_ADD_DB_CFM_T *p_event_data)
         {
             if(p_event_data->result == sys_status_success)
             {
-                /* Start beaconing */
-                SetState(app_state_beaconing);
+                if(EsurlBeaconGetPeriodMillis() == 0)
+                {
+                    /* Beaconing is turned off, so the chip has been woken
+                     * from dormant by the button. Advertise so that it can
+                     * be configured.
+                     */
+                    SetState(app_state_fast_advertising);
+                }
+                else
+                {
+                    /* Start beaconing */
+                    appStartBeaconing();
+                }
             }
             else
             {
@@ -898,6 +1217,8 @@ static void handleSignalLmEvConnectionComplete(
     g_app_data.conn_interval = p_event_data->data.conn_interval;
     g_app_data.conn_latency = p_event_data->data.conn_latency;
     g_app_data.conn_timeout = p_event_data->data.supervision_timeout;
+
+    ConnParamConnected(g_app_data.conn_interval, g_app_data.conn_latency);
 }
 
 /*----------------------------------------------------------------------------*
@@ -929,7 +1250,7 @@ static void handleSignalGattCancelConnectCfm(void)
         /* Trigger fast advertisements */
         if(g_app_data.state == app_state_fast_advertising)
         {
-            GattTriggerFastAdverts(&g_app_data.bonded_bd_addr);
+            GattTriggerFastAdverts(appBondLastHost());
         }
         else
         {
@@ -942,13 +1263,12 @@ static void handleSignalGattCancelConnectCfm(void)
          *
          * The application follows this sequence in advertising state:
          *
-         *    Fast advertising for FAST_CONNECTION_ADVERT_TIMEOUT_VALUE seconds:
-         *    If the application is bonded to a remote device then during this
-         *    period it will use the white list for the first
-         *    BONDED_DEVICE_ADVERT_TIMEOUT_VALUE seconds, and for the remaining
-         *    time (FAST_CONNECTION_ADVERT_TIMEOUT_VALUE - 
-         *    BONDED_DEVICE_ADVERT_TIMEOUT_VALUE seconds), it will do fast
-         *    advertising without any white list.
+         *    If the application is bonded to a remote device then it first
+         *    advertises using the white list for
+         *    BONDED_DEVICE_ADVERT_TIMEOUT_VALUE seconds. It then steps through
+         *    the tiers of the advertising schedule without any white list,
+         *    each slower than the last, and returns to beaconing at the end
+         *    of the last tier. A configuration window has a single phase.
          */
         switch(g_app_data.state)
         {
@@ -956,16 +1276,13 @@ static void handleSignalGattCancelConnectCfm(void)
             {
                 bool fastConns = FALSE;
 
-                if(g_app_data.enable_white_list)
+                /* A configuration window has a single phase */
+                if(g_app_data.enable_white_list && !g_app_data.config_window)
                 {
                     /* Bonded device advertisements stopped. Reset the white
                      * list
                      */
-                    if(LsDeleteWhiteListDevice(&g_app_data.bonded_bd_addr)
-                        != ls_err_none)
-                    {
-                        ReportPanic(app_panic_delete_whitelist);
-                    }
+                    LsResetWhiteList();
 
                     /* Case of stopping advertisements for the bonded device 
                      * at the expiry of BONDED_DEVICE_ADVERT_TIMEOUT_VALUE timer
@@ -975,15 +1292,25 @@ static void handleSignalGattCancelConnectCfm(void)
                     fastConns = TRUE;
                 }
 
+                else if(!g_app_data.config_window)
+                {
+                    /* Back off to the next tier of the schedule, if any */
+                    fastConns = GattNextAdvertTier();
+                }
+
                 if(fastConns)
                 {
-                    GattStartAdverts(&g_app_data.bonded_bd_addr, TRUE);
+                    GattStartAdverts(appBondLastHost());
 
                     /* Remain in same state */
                 }
                 else
                 {
-                    SetState(app_state_beaconing);
+                    /* Disable white list */
+                    g_app_data.enable_white_list = FALSE;
+                    g_app_data.config_window = FALSE;
+
+                    appStartBeaconing();
                 }
             }
             break;
@@ -1031,61 +1358,40 @@ static void handleSignalGattConnectCfm(GATT_CONNECT_CFM_T *p_event_data)
                 /* Store connected BD Address */
                 g_app_data.con_bd_addr = p_event_data->bd_addr;
 
-                if(g_app_data.bonded && 
-                   GattIsAddressResolvableRandom(&g_app_data.bonded_bd_addr) &&
-                   (SMPrivacyMatchAddress(&p_event_data->bd_addr,
-                                          g_app_data.irk,
-                                          MAX_NUMBER_IRK_STORED, 
-                                          MAX_WORDS_IRK) < 0))
-                {
-                    /* Application was bonded to a remote device using 
-                     * resolvable random address and application has failed 
-                     * to resolve the remote device address to which we just 
-                     * connected, so disconnect and start advertising again
-                     */
-                    SetState(app_state_disconnecting);
-                }
-                else
+                /* Look the host up in the bonding table. A host which is
+                 * not bonded may pair, taking a free entry or replacing the
+                 * least recently used one.
+                 */
+                g_app_data.bond_index = appBondFind(&p_event_data->bd_addr);
+                if(g_app_data.bond_index != APP_BOND_INDEX_INVALID)
                 {
-                    /* Enter connected state 
-                     * - If the device is not bonded OR
-                     * - If the device is bonded and the connected host doesn't 
-                     *   support Resolvable Random address OR
-                     * - If the device is bonded and connected host supports 
-                     *   Resolvable Random address and the address gets resolved
-                     *   using the stored IRK key
-                     */
-                    SetState(app_state_connected);
+                    appBondTouch(g_app_data.bond_index);
 
-#ifndef PAIRING_SUPPORT
-                    /* if the application does not mandate encryption
-                     * requirement on its characteristics, the remote master may
-                     * or may not encrypt the link. Start a timer here to give
-                     * remote master some time to encrypt the link and on expiry
-                     * of that timer, send a connection parameter update request
-                     * to remote device.
-                     */
+                    /* Restore the client configurations of this host */
+                    BatteryDataInit();
+                    TemperatureDataInit();
+                }
 
-                    /* If the current connection parameters being used don't 
-                     * comply with the application's preferred connection 
-                     * parameters and the timer is not running, start a timer
-                     * to trigger the Connection Parameter Update procedure.
-                     */
+                /* Enter connected state */
+                SetState(app_state_connected);
 
-                    if(g_app_data.con_param_update_tid == TIMER_INVALID)
-                    {
-                        appStartConnUpdateTimer();
-                    } /* Else at the expiry of the timer the connection
-                       * parameter update procedure will be triggered
-                       */
+#ifndef PAIRING_SUPPORT
+                /* if the application does not mandate encryption
+                 * requirement on its characteristics, the remote master may
+                 * or may not encrypt the link. A client connects to
+                 * configure the device, so start the connection parameter
+                 * policy in its fast phase straight away.
+                 */
+                ConnParamStart(&g_app_data.con_bd_addr);
 
 #endif /* !PAIRING_SUPPORT */
-                }
             }
             else
             {
-                /* Connection failure - Trigger fast advertisements */
-                GattStartAdverts(&g_app_data.bonded_bd_addr, TRUE);
+                /* Connection failure, or the end of a directed
+                 * advertisement burst - Trigger fast advertisements
+                 */
+                GattStartAdverts(appBondLastHost());
             }
         }
         break;
@@ -1102,7 +1408,8 @@ static void handleSignalGattConnectCfm(GATT_CONNECT_CFM_T *p_event_data)
  *      handleSignalSmKeysInd
  *
  *  DESCRIPTION
- *      This function handles the signal SM_KEYS_IND and copies the IRK from it.
+ *      This function handles the signal SM_KEYS_IND and keeps the diversifier
+ *      and IRK from it until pairing completes.
  *
  *  PARAMETERS
  *      p_event_data [in]       Data supplied by SM_KEYS_IND signal
@@ -1117,34 +1424,17 @@ static void handleSignalSmKeysInd(SM_KEYS_IND_T *p_event_data)
     {
         case app_state_connected:
         {
-
-            /* Store the diversifier which will be used for accepting/rejecting
-             * the encryption requests.
+            /* Keep the diversifier, which will be used for accepting/rejecting
+             * the encryption requests, and the IRK, which is used afterwards
+             * to validate the identity of a host using resolvable random
+             * addresses. A bonding table entry is only taken for them once
+             * pairing has completed successfully.
              */
-            g_app_data.diversifier = (p_event_data->keys)->div;
-
-            /* Write the new diversifier to NVM */
-            Nvm_Write(&g_app_data.diversifier,
-                      sizeof(g_app_data.diversifier), 
-                      NVM_OFFSET_SM_DIV);
-
-            /* Store IRK if the connected host is using random resolvable 
-             * address. IRK is used afterwards to validate the identity of 
-             * connected host 
-             */
-            if(GattIsAddressResolvableRandom(&g_app_data.con_bd_addr)) 
-            {
-                MemCopy(g_app_data.irk, 
-                        (p_event_data->keys)->irk,
-                        MAX_WORDS_IRK);
-
-                /* If bonded device address is resolvable random
-                 * then store IRK to NVM 
-                 */
-                Nvm_Write(g_app_data.irk, 
-                          MAX_WORDS_IRK, 
-                          NVM_OFFSET_SM_IRK);
-            }
+            g_app_data.pending_diversifier = (p_event_data->keys)->div;
+            MemCopy(g_app_data.pending_irk,
+                    (p_event_data->keys)->irk,
+                    MAX_WORDS_IRK);
+            g_app_data.keys_pending = TRUE;
         }
         break;
 
@@ -1178,8 +1468,11 @@ static void handleSignalSmPairingAuthInd(SM_PAIRING_AUTH_IND_T *p_event_data)
     {
         case app_state_connected:
         {
-            /* Authorise the pairing request if the application is NOT bonded */
-            if(!g_app_data.bonded)
+            /* Authorise the pairing request if the connected host is NOT
+             * bonded
+             */
+            if(g_app_data.bond_index == APP_BOND_INDEX_INVALID ||
+               !g_app_data.bond.host[g_app_data.bond_index].bonded)
             {
                 SMPairingAuthRsp(p_event_data->data, TRUE);
             }
@@ -1240,18 +1533,10 @@ static void handleSignalLMEncryptionChange(
                      */
                     TemperatureUpdate(g_app_data.st_ucid);
 
-                    /* If the current connection parameters being used don't 
-                     * comply with the application's preferred connection 
-                     * parameters and the timer is not running, start a timer
-                     * to trigger the Connection Parameter Update procedure.
+                    /* Start the connection parameter policy, if it has not
+                     * already been started
                      */
-                    
-                    if(g_app_data.con_param_update_tid == TIMER_INVALID)
-                    {
-                        appStartConnUpdateTimer();
-                    } /* Else at the expiry of the timer the Connection
-                       * Parameter Update procedure will be triggered
-                       */
+                    ConnParamStart(&g_app_data.con_bd_addr);
                 }
             }
         }
@@ -1290,29 +1575,48 @@ static void handleSignalSmSimplePairingCompleteInd(
         {
             if(p_event_data->status == sys_status_success)
             {
+                APP_BOND_HOST_T *p_host;
+
+                /* Take the bonding table entry for the connected host, now
+                 * that pairing has succeeded
+                 */
+                g_app_data.bond_index = appBondAllocate();
+                p_host = &g_app_data.bond.host[g_app_data.bond_index];
+
                 /* Store bonded host information to NVM. This includes
                  * application and service specific information.
                  */
-                g_app_data.bonded = TRUE;
-                g_app_data.bonded_bd_addr = p_event_data->bd_addr;
+                p_host->bonded = TRUE;
+                p_host->bonded_bd_addr = p_event_data->bd_addr;
+                p_host->last_used = ++ g_app_data.bond.use_count;
 
-                /* Store bonded host typed bd address to NVM */
+                /* Store the keys distributed during pairing */
+                if(g_app_data.keys_pending)
+                {
+                    p_host->diversifier = g_app_data.pending_diversifier;
+                    g_app_data.bond.diversifier =
+                                            g_app_data.pending_diversifier;
+
+                    if(GattIsAddressResolvableRandom(&p_host->bonded_bd_addr))
+                    {
+                        MemCopy(g_app_data.bond.irk[g_app_data.bond_index],
+                                g_app_data.pending_irk,
+                                MAX_WORDS_IRK);
+                    }
 
-                /* Write one word bonded flag */
-                Nvm_Write((uint16*)&g_app_data.bonded, 
-                          sizeof(g_app_data.bonded), 
-                          NVM_OFFSET_BONDED_FLAG);
+                    g_app_data.keys_pending = FALSE;
+                }
 
-                /* Write typed bd address of bonded host */
-                Nvm_Write((uint16*)&g_app_data.bonded_bd_addr, 
-                          sizeof(TYPED_BD_ADDR_T), 
-                          NVM_OFFSET_BONDED_ADDR);
+                /* Store bonded flag, typed bd address and keys of bonded host
+                 * to NVM
+                 */
+                Nvm_WriteRecord(&g_app_data.bond_record);
 
                 /* Configure white list with the Bonded host address only 
                  * if the connected host doesn't support random resolvable
                  * addresses
                  */
-                if(!GattIsAddressResolvableRandom(&g_app_data.bonded_bd_addr))
+                if(!GattIsAddressResolvableRandom(&p_host->bonded_bd_addr))
                 {
                     /* It is important to note that this application does not
                      * support Reconnection Address. In future, if the
@@ -1320,7 +1624,7 @@ static void handleSignalSmSimplePairingCompleteInd(
                      * make sure that we don't add Reconnection Address to the
                      * white list
                      */
-                    if(LsAddWhiteListDevice(&g_app_data.bonded_bd_addr) !=
+                    if(LsAddWhiteListDevice(&p_host->bonded_bd_addr) !=
                         ls_err_none)
                     {
                         ReportPanic(app_panic_add_whitelist);
@@ -1340,6 +1644,9 @@ static void handleSignalSmSimplePairingCompleteInd(
             }
             else
             {
+                /* Discard any keys distributed before pairing failed */
+                g_app_data.keys_pending = FALSE;
+
 #ifdef PAIRING_SUPPORT
                 /* Pairing has failed.
                  * 1. If pairing has failed due to repeated attempts, the 
@@ -1358,7 +1665,8 @@ static void handleSignalSmSimplePairingCompleteInd(
                  {
                     SetState(app_state_disconnecting);
                  }
-                 else if(g_app_data.bonded)
+                 else if(g_app_data.bond_index != APP_BOND_INDEX_INVALID &&
+                         g_app_data.bond.host[g_app_data.bond_index].bonded)
                  {
                     g_app_data.encrypt_enabled = FALSE;
                     g_app_data.bonding_reattempt_tid = 
@@ -1371,15 +1679,22 @@ static void handleSignalSmSimplePairingCompleteInd(
                 /* If application is already bonded to this host and pairing 
                  * fails, remove device from the white list.
                  */
-                if(g_app_data.bonded)
+                if(g_app_data.bond_index != APP_BOND_INDEX_INVALID &&
+                   g_app_data.bond.host[g_app_data.bond_index].bonded)
                 {
-                    if(LsDeleteWhiteListDevice(&g_app_data.bonded_bd_addr) != 
+                    APP_BOND_HOST_T *p_host =
+                                &g_app_data.bond.host[g_app_data.bond_index];
+
+                    if(!GattIsAddressResolvableRandom(&p_host->bonded_bd_addr)
+                       && LsDeleteWhiteListDevice(&p_host->bonded_bd_addr) !=
                                         ls_err_none)
                     {
                         ReportPanic(app_panic_delete_whitelist);
                     }
 
-                    g_app_data.bonded = FALSE;
+                    p_host->bonded = FALSE;
+                    appRpaCacheFlush(g_app_data.bond_index);
+                    g_app_data.bond_index = APP_BOND_INDEX_INVALID;
                 }
 
                 /* The case when pairing has failed. The connection may still be
@@ -1390,9 +1705,7 @@ static void handleSignalSmSimplePairingCompleteInd(
                  */
 
                 /* Update bonded status to NVM */
-                Nvm_Write((uint16*)&g_app_data.bonded,
-                          sizeof(g_app_data.bonded),
-                          NVM_OFFSET_BONDED_FLAG);
+                Nvm_WriteRecord(&g_app_data.bond_record);
 
                 /* Initialise the data of used services as the device is no 
                  * longer bonded to the remote host.
@@ -1444,17 +1757,28 @@ static void handleSignalSmDivApproveInd(SM_DIV_APPROVE_IND_T *p_event_data)
         case app_state_connected:
         {
             sm_div_verdict approve_div = SM_DIV_REVOKED;
+            uint8 i;
             
-            /* Check whether the application is still bonded (bonded flag gets
+            /* Check whether the application is still bonded (bonded flags get
              * reset upon 'connect' button press by the user). Then check 
              * whether the diversifier is the same as the one stored by the 
-             * application
+             * application for one of the bonded hosts
              */
-            if(g_app_data.bonded)
+            for(i = 0; i < MAX_BONDED_HOSTS; i++)
             {
-                if(g_app_data.diversifier == p_event_data->div)
+                if(g_app_data.bond.host[i].bonded &&
+                   g_app_data.bond.host[i].diversifier == p_event_data->div)
                 {
+                    /* The diversifier identifies the bonded host even when
+                     * its address could not be resolved at connection
+                     */
+                    g_app_data.bond_index = i;
                     approve_div = SM_DIV_APPROVED;
+
+                    /* Restore the client configurations of this host */
+                    BatteryDataInit();
+                    TemperatureDataInit();
+                    break;
                 }
             }
 
@@ -1493,25 +1817,12 @@ static void handleSignalLsConnParamUpdateCfm(
         case app_state_connected:
         {
             /* Received in response to the L2CAP_CONNECTION_PARAMETER_UPDATE 
-             * request sent from the slave after encryption is enabled. If 
-             * the request has failed, the device should send the same request
-             * again only after Tgap(conn_param_timeout). Refer Bluetooth 4.0
-             * spec Vol 3 Part C, Section 9.3.9 and profile spec.
+             * request sent by the connection parameter policy. If the request
+             * has failed, the policy sends it again only after
+             * Tgap(conn_param_timeout). Refer Bluetooth 4.0 spec Vol 3 Part C,
+             * Section 9.3.9 and profile spec.
              */
-            if ((p_event_data->status != ls_err_none) &&
-                    (g_app_data.num_conn_update_req < 
-                    MAX_NUM_CONN_PARAM_UPDATE_REQS))
-            {
-                /* Delete timer if running */
-                if (g_app_data.con_param_update_tid != TIMER_INVALID)
-                {
-                    TimerDelete(g_app_data.con_param_update_tid);
-                }
-
-                g_app_data.con_param_update_tid = TimerCreate(
-                                             GAP_CONN_PARAM_TIMEOUT,
-                                             TRUE, requestConnParamUpdate);
-            }
+            ConnParamHandleUpdateCfm(p_event_data->status == ls_err_none);
         }
         break;
 
@@ -1546,23 +1857,17 @@ static void handleSignalLsConnParamUpdateInd(
 
         case app_state_connected:
         {
-            /* Delete timer if running */
-            if (g_app_data.con_param_update_tid != TIMER_INVALID)
-            {
-                TimerDelete(g_app_data.con_param_update_tid);
-                g_app_data.con_param_update_tid = TIMER_INVALID;
-            }
-
             /* Store the new connection parameters. */
             g_app_data.conn_interval = p_event_data->conn_interval;
             g_app_data.conn_latency = p_event_data->conn_latency;
             g_app_data.conn_timeout = p_event_data->supervision_timeout;
             
-            /* Connection parameters have been updated. Check if new parameters 
-             * comply with application preferred parameters. If not, application
-             * shall trigger Connection parameter update procedure.
+            /* Connection parameters have been updated. The connection
+             * parameter policy checks whether they suit its current phase,
+             * and if not triggers the Connection parameter update procedure.
              */
-            appStartConnUpdateTimer();
+            ConnParamHandleUpdateInd(g_app_data.conn_interval,
+                                     g_app_data.conn_latency);
         }
         break;
 
@@ -1596,11 +1901,15 @@ static void handleSignalGattAccessInd(GATT_ACCESS_IND_T *p_event_data)
     {
         case app_state_connected:
         {
-            /* Received GATT ACCESS IND with write access */
-            if(p_event_data->flags == 
-                (ATT_ACCESS_WRITE | 
-                 ATT_ACCESS_PERMISSION | 
-                 ATT_ACCESS_WRITE_COMPLETE))
+            /* Attribute access keeps the link in the fast phase of the
+             * connection parameter policy
+             */
+            ConnParamActivity();
+
+            /* Received GATT ACCESS IND with write access. This includes
+             * each part of a queued (prepared) write.
+             */
+            if(p_event_data->flags & ATT_ACCESS_WRITE)
             {
                 HandleAccessWrite(p_event_data);
             }
@@ -1665,8 +1974,10 @@ static void handleSignalLmDisconnectComplete(
 
     /* ON DISCONNECT: Update the TX Power in *both* RADIO and ADV the tx_level_mode */
     EsurlBeaconUpdateTxPowerFromMode(EsurlBeaconGetTxPowerMode());
-    /* ON DISCONNECT: Write out NVM state for Esurl Beacon Service (DONE LAST) */
-    EsurlBeaconWriteDataToNVM(NULL); // Null argument assumes the prior nvm_offset 
+    /* ON DISCONNECT: Commit any configuration still waiting to be written to
+     * NVM (DONE LAST)
+     */
+    Nvm_CommitPending();
     
     /* Handle signal as per current state */
     switch(g_app_data.state)
@@ -1680,7 +1991,7 @@ static void handleSignalLmDisconnectComplete(
         case app_state_disconnecting:
         {
             /* Start beaconing */
-            SetState(app_state_beaconing);
+            appStartBeaconing();
         }
         break;
         
@@ -1711,6 +2022,14 @@ static void handleSignalLmDisconnectComplete(
  *----------------------------------------------------------------------------*/
 extern void ReportPanic(app_panic_code panic_code)
 {
+    /* Panic resets the chip, so commit any queued configuration first. This
+     * is skipped if NVM itself is failing.
+     */
+    if(panic_code != app_panic_nvm_read && panic_code != app_panic_nvm_write)
+    {
+        Nvm_CommitPending();
+    }
+
     /* Raise panic */
     Panic(panic_code);
 }
@@ -1747,6 +2066,7 @@ extern void HandleShortButtonPress(void)
 
         case app_state_idle:
         case app_state_beaconing:
+        case app_state_dormant:
             /* Trigger fast advertisements */
             SetState(app_state_fast_advertising);
         break;
@@ -1759,6 +2079,77 @@ extern void HandleShortButtonPress(void)
 
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      HandleConfigWindow
+ *
+ *  DESCRIPTION
+ *      This function opens a scheduled connectable configuration window. It
+ *      is called by the beacon when CONFIG_WINDOW_PERIOD has elapsed.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void HandleConfigWindow(void)
+{
+    if(g_app_data.state == app_state_beaconing)
+    {
+        g_app_data.config_window = TRUE;
+
+        SetState(app_state_fast_advertising);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      HandleBatteryCheck
+ *
+ *  DESCRIPTION
+ *      This function checks the battery level while beaconing. It is called
+ *      by the beacon every BATTERY_POLICY_CHECK_PERIOD, and on the battery
+ *      low system event. The device goes dormant if the battery is critical,
+ *      and otherwise beaconing is restarted if the battery policy has moved
+ *      to another rung.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if beaconing was restarted or stopped
+ *----------------------------------------------------------------------------*/
+extern bool HandleBatteryCheck(void)
+{
+    uint8 level;
+
+    if(g_app_data.state != app_state_beaconing)
+    {
+        return FALSE;
+    }
+
+    level = readBatteryLevel();
+
+    if(level <= BATTERY_LEVEL_CRITICAL)
+    {
+        /* Stop beaconing before the battery gives out */
+        SetState(app_state_dormant);
+        return TRUE;
+    }
+
+    if(BatteryPolicyUpdate(level))
+    {
+        BeaconStart(TRUE);
+#ifndef LED_HEARTBEAT_PERIOD
+        LedEnable(BatteryPolicyIndicationsEnabled());
+#endif /* !LED_HEARTBEAT_PERIOD */
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 /*----------------------------------------------------------------------------*
  *  NAME
  *      SetState
@@ -1827,6 +2218,18 @@ extern void SetState(app_state new_state)
                 /* Nothing to do */
             break;
 
+            case app_state_dormant:
+                /* Stop checking the battery */
+                if(g_app_data.dormant_tid != VTIMER_INVALID)
+                {
+                    VTimerDelete(g_app_data.dormant_tid);
+                    g_app_data.dormant_tid = VTIMER_INVALID;
+                }
+
+                /* Bring back the buzzer and LED */
+                HwRestorePios();
+            break;
+
             default:
                 /* Nothing to do */
             break;
@@ -1840,16 +2243,33 @@ extern void SetState(app_state new_state)
         {
             case app_state_fast_advertising:
             {
+#ifdef CONFIG_WINDOW_PERIOD
+                if(g_app_data.config_window)
+                {
+#ifdef CONFIG_WINDOW_WHITELIST_ONLY
+                    /* Only the bonded hosts may use the window */
+                    enableWhiteList();
+#endif /* CONFIG_WINDOW_WHITELIST_ONLY */
+
+                    /* Open the window silently, as nobody is there to hear
+                     * it
+                     */
+                    GattTriggerConfigWindow(appBondLastHost(),
+                                            CONFIG_WINDOW_LENGTH);
+                    break;
+                }
+#endif /* CONFIG_WINDOW_PERIOD */
+
                 /* Enable white list if application is bonded to some remote 
                  * device and that device is not using resolvable random 
                  * address.
                  */
                 enableWhiteList();
                 /* Trigger fast advertisements. */
-                GattTriggerFastAdverts(&g_app_data.bonded_bd_addr);
+                GattTriggerFastAdverts(appBondLastHost());
 
                 /* Indicate advertising mode by sounding two short beeps */
-                SoundBuzzer(buzzer_beep_twice);
+                PatternPlay(pattern_beep_twice);
                 
                 /* start LED indication */
                 /* LedEnable(TRUE); */
@@ -1857,19 +2277,32 @@ extern void SetState(app_state new_state)
             break;
             
             case app_state_beaconing:
-                /* Sound long beep to indicate non-connectable mode */
-                SoundBuzzer(buzzer_beep_long);
+                /* Sound long beep to indicate non-connectable mode, unless
+                 * the battery is saving current
+                 */
+                if(BatteryPolicyIndicationsEnabled())
+                {
+                    PatternPlay(pattern_beep_long);
+                }
 
                 /* Start beaconing */
                 BeaconStart(TRUE);
-                
-                /* start LED indication */
-                LedEnable(TRUE);
+
+#ifndef LED_HEARTBEAT_PERIOD
+                /* start LED indication. With a heartbeat the beacon flashes
+                 * the LED instead.
+                 */
+                LedEnable(BatteryPolicyIndicationsEnabled());
+#endif /* !LED_HEARTBEAT_PERIOD */
             break;
 
             case app_state_idle:
                 /* Sound long beep to indicate non-connectable mode */
-                SoundBuzzer(buzzer_beep_long);
+                PatternPlay(pattern_beep_long);
+            break;
+
+            case app_state_dormant:
+                appEnterDormant();
             break;
 
             case app_state_connected:
@@ -1967,13 +2400,12 @@ extern void HandlePairingRemoval(void)
 
     /* Remove bonding information */
 
-    /* The device will no longer be bonded */
-    g_app_data.bonded = FALSE;
+    /* The device will no longer be bonded to any host */
+    appBondDataInit();
+    g_app_data.bond_index = APP_BOND_INDEX_INVALID;
 
     /* Write bonded status to NVM */
-    Nvm_Write((uint16*)&g_app_data.bonded, 
-              sizeof(g_app_data.bonded), 
-              NVM_OFFSET_BONDED_FLAG);
+    Nvm_WriteRecord(&g_app_data.bond_record);
 
 
     switch(g_app_data.state)
@@ -2071,8 +2503,8 @@ extern void StartAdvertTimer(uint32 interval)
  *      IsDeviceBonded
  *
  *  DESCRIPTION
- *      This function returns the status whether the connected device is 
- *      bonded or not.
+ *      This function returns the status whether the device is bonded to any
+ *      host or not.
  *
  *  PARAMETERS
  *      None
@@ -2082,7 +2514,72 @@ extern void StartAdvertTimer(uint32 interval)
  *----------------------------------------------------------------------------*/
 extern bool IsDeviceBonded(void)
 {
-    return g_app_data.bonded;
+    uint8 i;
+
+    for(i = 0; i < MAX_BONDED_HOSTS; i++)
+    {
+        if(g_app_data.bond.host[i].bonded)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      GetBondIndex
+ *
+ *  DESCRIPTION
+ *      This function returns the bonding table index of the connected host,
+ *      which services use to keep data for each bonded host.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Index of the host, or APP_BOND_INDEX_INVALID if it is not bonded
+ *----------------------------------------------------------------------------*/
+extern uint8 GetBondIndex(void)
+{
+    return g_app_data.bond_index;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      AddBondedHostsToWhiteList
+ *
+ *  DESCRIPTION
+ *      This function resets the white list and adds to it the bonded hosts
+ *      which are not using resolvable random addresses.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void AddBondedHostsToWhiteList(void)
+{
+    APP_BOND_HOST_T *p_host;
+    uint8 i;
+
+    LsResetWhiteList();
+
+    for(i = 0; i < MAX_BONDED_HOSTS; i++)
+    {
+        p_host = &g_app_data.bond.host[i];
+
+        if(p_host->bonded &&
+           !GattIsAddressResolvableRandom(&p_host->bonded_bd_addr))
+        {
+            if(LsAddWhiteListDevice(&p_host->bonded_bd_addr) != ls_err_none)
+            {
+                ReportPanic(app_panic_add_whitelist);
+            }
+        }
+    }
 }
 
 /*----------------------------------------------------------------------------*
@@ -2181,10 +2678,16 @@ extern void AppInit(sleep_state last_sleep_state)
 
     /* Initialise the application timers */
     TimerInit(MAX_APP_TIMERS, (void*)app_timers);
+    VTimerInit();
     
     /* Initialise local timers */
-    g_app_data.con_param_update_tid = TIMER_INVALID;
     g_app_data.app_tid = TIMER_INVALID;
+    g_app_data.dormant_tid = VTIMER_INVALID;
+    ConnParamInit();
+
+    /* Initialise the battery policy */
+    BatteryPolicyInit();
+
 #ifdef PAIRING_SUPPORT
     g_app_data.bonding_reattempt_tid = TIMER_INVALID;
 #endif
@@ -2200,6 +2703,11 @@ extern void AppInit(sleep_state last_sleep_state)
      */
     GattInstallServerWrite();
 
+    /* Install support for queued (prepared) writes, so that values longer
+     * than one ATT PDU can be written
+     */
+    GattInstallServerWriteLongReliable();
+
     /* Don't wakeup on UART RX line */
     SleepWakeOnUartRX(FALSE);
 
@@ -2219,6 +2727,15 @@ extern void AppInit(sleep_state last_sleep_state)
     /* Battery initialisation on chip reset */
     BatteryInitChipReset();
 
+    /* Telemetry initialisation on chip reset */
+    TelemetryInitChipReset();
+
+    /* Schedule initialisation on chip reset */
+    ScheduleInitChipReset();
+
+    /* No private address has been resolved yet */
+    appRpaCacheFlush(APP_BOND_INDEX_INVALID);
+
     /* Beacon initialisation on chip reset */
     EsurlBeaconInitChipReset();    
 
@@ -2242,7 +2759,7 @@ extern void AppInit(sleep_state last_sleep_state)
     /* Tell Security Manager module what value it needs to initialise its
      * diversifier to.
      */
-    SMInit(g_app_data.diversifier);
+    SMInit(g_app_data.bond.diversifier);
     
     /* Initialise hardware data */
     HwDataInit();
@@ -2289,6 +2806,13 @@ void AppProcessSystemEvent(sys_event_id id, void *data)
                 BatteryUpdateLevel(g_app_data.st_ucid);
                 TemperatureUpdate(g_app_data.st_ucid);
             }
+            else
+            {
+                /* Step down the battery policy without waiting for the
+                 * next check
+                 */
+                HandleBatteryCheck();
+            }
         }
         break;
 
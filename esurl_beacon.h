@@ -44,6 +44,7 @@
  *============================================================================*/
 
 #include <types.h>          /* Commonly used type definitions */
+#include <bluetooth.h>      /* Bluetooth specific type definitions */
 
 /*============================================================================*
  *  Local Header Files
@@ -58,6 +59,61 @@
 /* Maximum number of words in central device Identity Resolving Key (IRK) */
 #define MAX_WORDS_IRK                       (8)
 
+/* Number of hosts the device can be bonded to at once. When a further host
+ * bonds, the bond with the least recently connected host is replaced.
+ */
+#define MAX_BONDED_HOSTS                    (4)
+
+/* Bonding table index of a host which is not bonded */
+#define APP_BOND_INDEX_INVALID              (0xFF)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Bonding information for one host */
+typedef struct _APP_BOND_HOST_T
+{
+    /* Boolean flag to indicate whether this entry holds a bonded host */
+    bool                       bonded;
+
+    /* TYPED_BD_ADDR_T of the bonded host */
+    TYPED_BD_ADDR_T            bonded_bd_addr;
+
+    /* Diversifier associated with the Long Term Key (LTK) of the host */
+    uint16                     diversifier;
+
+    /* Value of use_count when the host last connected. The entry used least
+     * recently is replaced when a further host bonds.
+     */
+    uint16                     last_used;
+
+} APP_BOND_HOST_T;
+
+/* Bonding table. It is kept contiguous so that it can be stored in NVM as a
+ * single record.
+ */
+typedef struct _APP_BOND_DATA_T
+{
+    /* Bonded hosts */
+    APP_BOND_HOST_T            host[MAX_BONDED_HOSTS];
+
+    /* Central Private Address Resolution IRKs, indexed like host[]. They are
+     * kept together so that SMPrivacyMatchAddress() checks them all in one
+     * call. Only used for hosts using resolvable random addresses.
+     */
+    uint16                     irk[MAX_BONDED_HOSTS][MAX_WORDS_IRK];
+
+    /* Counter incremented on each connection from a bonded host */
+    uint16                     use_count;
+
+    /* Diversifier most recently handed out, with which the Security Manager
+     * is initialised
+     */
+    uint16                     diversifier;
+
+} APP_BOND_DATA_T;
+
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -72,6 +128,12 @@ extern void ReportPanic(app_panic_code panic_code);
  */
 extern void HandleShortButtonPress(void);
 
+/* Open a connectable configuration window from the beaconing state */
+extern void HandleConfigWindow(void);
+
+/* Apply the battery policy while beaconing */
+extern bool HandleBatteryCheck(void);
+
 /* Change the current state of the application */
 extern void SetState(app_state new_state);
 
@@ -87,9 +149,17 @@ extern void HandlePairingRemoval(void);
 /* Start the advertisement timer. */
 extern void StartAdvertTimer(uint32 interval);
 
-/* Return whether the connected device is bonded or not */
+/* Return whether the device is bonded to any host */
 extern bool IsDeviceBonded(void);
 
+/* Return the bonding table index of the connected host, or
+ * APP_BOND_INDEX_INVALID if it is not bonded
+ */
+extern uint8 GetBondIndex(void);
+
+/* Program the white list with every bonded host */
+extern void AddBondedHostsToWhiteList(void);
+
 /* Return the unique connection ID (UCID) of the connection */
 extern uint16 GetConnectionID(void);
 
@@ -58,6 +58,35 @@
 #include "temperature_service.h"
 #include "battery_service.h"
 
+/*============================================================================*
+ *  Private Definitions
+ *===========================================================================*/
+
+/* The packet counter is checkpointed to NVM every 2^k packets, where k is
+ * ESURL_BEACON_PACKET_CHECKPOINT_SHIFT. After a reset the counter resumes at
+ * the last checkpoint plus 2^k, so it never goes backwards.
+ */
+#define ESURL_BEACON_PACKET_CHECKPOINT_SHIFT    (10)
+
+#define ESURL_BEACON_PACKET_CHECKPOINT_INTERVAL \
+    ((uint32)1 << ESURL_BEACON_PACKET_CHECKPOINT_SHIFT)
+
+/* Characteristic descriptor flags */
+#define ESURL_BEACON_CHAR_READ                  (0x0001)
+#define ESURL_BEACON_CHAR_WRITE                 (0x0002)
+
+/* Writes are refused while the beacon is locked */
+#define ESURL_BEACON_CHAR_LOCKED                (0x0004)
+
+/* Number of attribute handles in the Beacon Service, and the index of a
+ * handle into g_esurl_beacon_chars[]
+ */
+#define ESURL_BEACON_NUM_HANDLES \
+    (HANDLE_ESURL_BEACON_SERVICE_END - HANDLE_ESURL_BEACON_SERVICE + 1)
+
+#define ESURL_BEACON_CHAR_INDEX(handle) \
+    ((handle) - HANDLE_ESURL_BEACON_SERVICE)
+
 /*============================================================================*
  *  Constants Arrays  
  *============================================================================*/ 
@@ -65,7 +94,7 @@
 /* www.bluetooth.org/en-us/specification/assigned-numbers/generic-access-profile */
 
 /* Esurl Beacon ADV header */
-unsigned char adv_service_hdr[] =
+unsigned char adv_service_hdr[ESURL_BEACON_SERVICE_HDR_SIZE] =
 {
     0x03, // Length of Service List
             0x03, // AD Type: Service List 
@@ -74,7 +103,7 @@ unsigned char adv_service_hdr[] =
         };
 
 /* Esurl Beacon Service Local Name Param and Bluetooth SIG assigned 16-bit UUID */
-unsigned char adv_service_name_hdr[] = 
+unsigned char adv_service_name_hdr[ESURL_BEACON_SERVICE_NAME_HDR_SIZE] = 
 {
     0x08 // AD Type: Shortened Local Name
         };
@@ -86,14 +115,16 @@ unsigned char initial_name[] =
         };
 
 /* Esurl Beacon Service Data Param and Bluetooth SIG assigned 16-bit UUID */
-unsigned char adv_service_data_hdr[] = 
+unsigned char adv_service_data_hdr[ESURL_BEACON_SERVICE_DATA_HDR_SIZE] = 
 {
     0x16, // AD Type: Service Data
             0xAA, // Esurl Beacon Service Data UUID LSB
             0xFE  // Esurl Beacon Service Data UUID MSB
         };
 
-/* Initialise Uri to Battery, temperature and packet spaces */
+/* Initialise Uri to an empty URL followed by the battery, temperature and
+ * packet telemetry, see ESURL_BEACON_TELEMETRY_SIZE
+ */
 unsigned char initial_data[] =
 {
     'B', 0x00, 't', 0x00, 0x00 , 'p', 0x00, 0x00, 0x00, 0x00
@@ -102,6 +133,26 @@ unsigned char initial_data[] =
 //Original: 0x02, 'p', 'h', 'y', 's', 'i', 'c', 'a', 'l', '-', 'w', 'e', 'b', 0x08
 //New: 0x02, 'b', 'e', 't', 'r', 'a', 'c', 'k', '.', 'c', 'o'
 
+/* URL schemes, indexed by ESURL_BEACON_URL_SCHEME_xxx code. A scheme which
+ * is a prefix of another must come after it.
+ */
+static const char * const url_schemes[] =
+{
+    "http://www.",
+    "https://www.",
+    "http://",
+    "https://"
+};
+
+/* URL expansions, indexed by code. An expansion which is a prefix of another
+ * must come after it.
+ */
+static const char * const url_expansions[] =
+{
+    ".com/", ".org/", ".edu/", ".net/", ".info/", ".biz/", ".gov/",
+    ".com", ".org", ".edu", ".net", ".info", ".biz", ".gov"
+};
+
 /* Esurl Beacon Adv TX calibration for packets Low to high */
 unsigned char adv_tx_power_levels[] =
 {    ADV_TX_POWER_FOR_NEG_18,  // 0 LOWEST
@@ -122,70 +173,25 @@ unsigned char radio_tx_power_levels[] =
  *  Private Data Types
  *===========================================================================*/
 
-/* Total size 28 bytes */
-typedef struct _ESURL_BEACON_DATA_T
+/* Static description of a Beacon Service characteristic */
+typedef struct _ESURL_BEACON_CHAR_T
 {
-    /* Current beacon data value */
-    uint8 service_hdr[sizeof(adv_service_hdr)];
-    
-    uint8 service_data_length;
-    
-    uint8 service_data_hdr[sizeof(adv_service_data_hdr)];
-            
-    uint8 uri_data[ESURL_BEACON_DATA_MAX];
-    
-} ESURL_BEACON_DATA_T;
+    /* ESURL_BEACON_CHAR_xxx flags, or 0 if the attribute is not handled by
+     * the application
+     */
+    uint16 flags;
 
-/* Total size 28 bytes */
-typedef struct _ESURL_BEACON_NAME_T
-{
-    /* Current beacon name value */
-    uint8 service_hdr[sizeof(adv_service_hdr)];
-    
-    uint8 service_name_length;
-    
-    uint8 service_name_hdr[sizeof(adv_service_name_hdr)];
-            
-    uint8 name_data[ESURL_BEACON_DATA_MAX];
-    
-} ESURL_BEACON_NAME_T;
-
-/* Beacon data type */
-typedef struct _ESURL_BEACON_ADV_T
-{
-    /* Adv name */
-    ESURL_BEACON_NAME_T name;
-    uint8 name_length;
+    /* Value, or NULL if it is not held as a plain array of octets and is
+     * read and written case by case
+     */
+    uint8 *p_value;
 
-    /* Adv data */
-    ESURL_BEACON_DATA_T data;
-    uint8 data_length;
+    /* Length of the value in octets, which a write must match, or 0 if the
+     * length is variable
+     */
+    uint16 length;
 
-    uint8 flags;
-    uint8 tx_power;
-    
-    /* A boolean TRUE/FALSE value determining if the beacon is locked */
-    uint8 lock_state;
-    
-    /* A 128-bit (16 byte) code for locking/unlocking the beacon */
-    uint8 lock_code[ESURL_BEACON_LOCK_CODE_SIZE];
-    
-    /* A value 0-3 that is mapped to a pkt and radio val via the cal tables */
-    uint8 tx_power_mode;
-    
-    /* A calibration table mapping tx_level_code to the packet code */
-    uint8 adv_tx_power_levels[ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE];
-    
-    /* A calibration table mapping tx_level_code to the radio code */
-    uint8 radio_tx_power_levels[ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE];   
-    
-    /* Beacon period in milliseconds 0-65536ms */
-    uint16 period;
-    
-    /* Packets sent */
-    uint32 packet;
-    
-} ESURL_BEACON_ADV_T;
+} ESURL_BEACON_CHAR_T;
 
 /*============================================================================*
  *  Private Data
@@ -194,15 +200,616 @@ typedef struct _ESURL_BEACON_ADV_T
 /* Esurl Beacon Service data instance */
 static ESURL_BEACON_ADV_T g_esurl_beacon_adv;
 
-/* Esurl Beacon nvm write flag indicates if the esurl_beacon_data is dirty */
-static uint8 g_esurl_beacon_nvm_write_flag = FALSE;
+/* Beacon Service characteristics handled by the application, indexed by
+ * ESURL_BEACON_CHAR_INDEX() of the value handle. The entries of other
+ * attributes of the service are left zero.
+ */
+static const ESURL_BEACON_CHAR_T
+                        g_esurl_beacon_chars[ESURL_BEACON_NUM_HANDLES] =
+{
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_LOCK_STATE)] =
+    {ESURL_BEACON_CHAR_READ,
+     &g_esurl_beacon_adv.lock_state,
+     sizeof(g_esurl_beacon_adv.lock_state)},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_LOCK)] =
+    {ESURL_BEACON_CHAR_WRITE,
+     NULL, 0},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_UNLOCK)] =
+    {ESURL_BEACON_CHAR_WRITE,
+     NULL, ESURL_BEACON_LOCK_CODE_SIZE},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_URI_DATA)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     NULL, 0},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_FLAGS)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     &g_esurl_beacon_adv.flags,
+     ESURL_BEACON_FLAGS_SIZE},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_TX_POWER_MODE)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     &g_esurl_beacon_adv.tx_power_mode,
+     sizeof(g_esurl_beacon_adv.tx_power_mode)},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_ADV_TX_POWER_LEVELS)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     g_esurl_beacon_adv.adv_tx_power_levels,
+     ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_PERIOD)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     NULL, ESURL_BEACON_PERIOD_SIZE},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_RESET)] =
+    {ESURL_BEACON_CHAR_WRITE | ESURL_BEACON_CHAR_LOCKED,
+     NULL, ESURL_BEACON_RESET_SIZE},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_RADIO_TX_POWER_LEVELS)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     g_esurl_beacon_adv.radio_tx_power_levels,
+     ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_CONFIG)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     NULL, 0},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_URL)] =
+    {ESURL_BEACON_CHAR_READ | ESURL_BEACON_CHAR_WRITE |
+     ESURL_BEACON_CHAR_LOCKED,
+     NULL, 0},
+
+    [ESURL_BEACON_CHAR_INDEX(HANDLE_ESURL_BEACON_COMMIT)] =
+    {ESURL_BEACON_CHAR_WRITE | ESURL_BEACON_CHAR_LOCKED,
+     NULL, ESURL_BEACON_COMMIT_SIZE}
+};
 
 /* Temporary buffer used for read/write characteristics */
 static uint8 g_esurl_beacon_buf[ESURL_BEACON_PERIOD_SIZE];
 
-/* NVM Offset at which ESURL BEACON data is stored */
-static uint16 g_esurl_beacon_nvm_offset;
+/* URI data encoded from a URL written to the URL characteristic */
+static uint8 g_esurl_beacon_uri_buf[ESURL_BEACON_URI_MAX];
+
+/* Configuration characteristic value being read */
+static uint8 g_esurl_beacon_config_buf[ESURL_BEACON_CONFIG_MAX];
+
+/* NVM record holding the ESURL BEACON data */
+static NVM_RECORD_T g_esurl_beacon_nvm_record;
+
+/* Last packet counter checkpoint and the NVM record holding it */
+static uint32 g_esurl_beacon_packet_checkpoint;
+static NVM_RECORD_T g_esurl_beacon_checkpoint_record;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *===========================================================================*/
+
+/* Checkpoint the packet counter to NVM */
+static void esurlBeaconCheckpointPacket(uint32 packet);
+
+/* Find the descriptor of a characteristic */
+static const ESURL_BEACON_CHAR_T *esurlBeaconFindChar(uint16 handle);
+
+/* Return the size of the encoded URL in the URI data */
+static uint16 esurlBeaconUriSize(void);
+
+/* Set the URI data in the advertising data */
+static void esurlBeaconSetUriData(const uint8 *p_uri, uint16 size);
+
+/* Set the beacon period */
+static void esurlBeaconSetPeriod(uint16 period);
+
+/* Append a field to the configuration characteristic value */
+static uint16 esurlBeaconAddConfigField(uint16 length, uint8 type,
+                                        const uint8 *p_value, uint16 size);
+
+/* Build the configuration characteristic value */
+static uint16 esurlBeaconReadConfig(void);
+
+/* Validate or apply a write to the configuration characteristic */
+static sys_status esurlBeaconWriteConfig(const uint8 *p_value, uint16 size,
+                                         bool apply);
+
+/* Find which of a table of strings a URL continues with */
+static uint16 esurlBeaconMatchUrl(const uint8 *p_url, uint16 size,
+                                  const char * const *p_table,
+                                  uint16 entries, uint16 *p_match_length);
+
+/* Encode a plain-text URL into URI data */
+static sys_status esurlBeaconEncodeUrl(const uint8 *p_url, uint16 size,
+                                       uint16 *p_uri_size);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *===========================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconCheckpointPacket
+ *
+ *  DESCRIPTION
+ *      This function writes a packet counter checkpoint to NVM. It is written
+ *      straight away rather than deferred, as it must be in NVM before any
+ *      packet beyond it is sent.
+ *
+ *  PARAMETERS
+ *      packet [in]             Packet counter value to checkpoint
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void esurlBeaconCheckpointPacket(uint32 packet)
+{
+    g_esurl_beacon_packet_checkpoint = packet;
+    Nvm_WriteRecord(&g_esurl_beacon_checkpoint_record);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconFindChar
+ *
+ *  DESCRIPTION
+ *      This function returns the descriptor of a Beacon Service
+ *      characteristic, looked up by its offset into the service.
+ *
+ *  PARAMETERS
+ *      handle [in]             Handle of the characteristic value
+ *
+ *  RETURNS
+ *      Characteristic descriptor, or NULL if the handle is not that of a
+ *      characteristic handled by the application
+ *----------------------------------------------------------------------------*/
+static const ESURL_BEACON_CHAR_T *esurlBeaconFindChar(uint16 handle)
+{
+    const ESURL_BEACON_CHAR_T *p_char;
+
+    if(handle < HANDLE_ESURL_BEACON_SERVICE ||
+       handle > HANDLE_ESURL_BEACON_SERVICE_END)
+    {
+        return NULL;
+    }
+
+    p_char = &g_esurl_beacon_chars[ESURL_BEACON_CHAR_INDEX(handle)];
+
+    return (p_char->flags != 0) ? p_char : NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconUriSize
+ *
+ *  DESCRIPTION
+ *      This function returns the size of the encoded URL in the URI data,
+ *      which is followed by the telemetry.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Size of the encoded URL, in octets
+ *----------------------------------------------------------------------------*/
+static uint16 esurlBeaconUriSize(void)
+{
+    uint16 size = g_esurl_beacon_adv.data_length - BEACON_DATA_HDR_SIZE -
+                  ESURL_BEACON_TELEMETRY_SIZE;
+
+    /* Protect against overflow */
+    if(size > ESURL_BEACON_URI_MAX)
+    {
+        size = ESURL_BEACON_URI_MAX;
+    }
+
+    return size;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconSetUriData
+ *
+ *  DESCRIPTION
+ *      This function sets the encoded URL in the advertising data, moving the
+ *      telemetry to follow it. The size must have been checked against
+ *      ESURL_BEACON_URI_MAX.
+ *
+ *  PARAMETERS
+ *      p_uri [in]              Encoded URI data
+ *      size [in]               Size of the URI data, in octets
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void esurlBeaconSetUriData(const uint8 *p_uri, uint16 size)
+{
+    uint8 telemetry[ESURL_BEACON_TELEMETRY_SIZE];
+
+    MemCopy(telemetry,
+            &g_esurl_beacon_adv.data.uri_data[esurlBeaconUriSize()],
+            ESURL_BEACON_TELEMETRY_SIZE);
+
+    /* Updated the URL in the beacon structure */
+    MemCopy(g_esurl_beacon_adv.data.uri_data, p_uri, size);
+    MemCopy(&g_esurl_beacon_adv.data.uri_data[size], telemetry,
+            ESURL_BEACON_TELEMETRY_SIZE);
+    g_esurl_beacon_adv.data_length = size + ESURL_BEACON_TELEMETRY_SIZE +
+                                     BEACON_DATA_HDR_SIZE;
+
+    /* Write the new data service size into the ADV header */
+    g_esurl_beacon_adv.data.service_data_length =
+            size + ESURL_BEACON_TELEMETRY_SIZE + SERVICE_DATA_PRE_URI_SIZE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconSetPeriod
+ *
+ *  DESCRIPTION
+ *      This function sets the beacon period, raising it to the minimum
+ *      period unless beaconing is being turned off.
+ *
+ *  PARAMETERS
+ *      period [in]             Beacon period in milliseconds, 0 for off
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void esurlBeaconSetPeriod(uint16 period)
+{
+    if ((period < BEACON_PERIOD_MIN) && (period != 0))
+    { /* minimum beacon period is 100ms; zero turns off beaconing */
+        period = BEACON_PERIOD_MIN;
+    }
+
+    g_esurl_beacon_adv.period = period;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconAddConfigField
+ *
+ *  DESCRIPTION
+ *      This function appends a field to the configuration characteristic
+ *      value being built in g_esurl_beacon_config_buf.
+ *
+ *  PARAMETERS
+ *      length [in]             Length of the value built so far, in octets
+ *      type [in]               ESURL_BEACON_CONFIG_xxx field type
+ *      p_value [in]            Field value
+ *      size [in]               Size of the field value, in octets
+ *
+ *  RETURNS
+ *      Length of the value including the new field, in octets
+ *----------------------------------------------------------------------------*/
+static uint16 esurlBeaconAddConfigField(uint16 length, uint8 type,
+                                        const uint8 *p_value, uint16 size)
+{
+    g_esurl_beacon_config_buf[length++] = type;
+    g_esurl_beacon_config_buf[length++] = size;
+    MemCopy(&g_esurl_beacon_config_buf[length], p_value, size);
+
+    return length + size;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconReadConfig
+ *
+ *  DESCRIPTION
+ *      This function builds the configuration characteristic value, holding
+ *      every configuration field except the lock code, in
+ *      g_esurl_beacon_config_buf.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Length of the value, in octets
+ *----------------------------------------------------------------------------*/
+static uint16 esurlBeaconReadConfig(void)
+{
+    uint8 period[ESURL_BEACON_PERIOD_SIZE];
+    uint16 uri_data_size = esurlBeaconUriSize();
+    uint16 length = 0;
+
+    period[0] = g_esurl_beacon_adv.period & 0xFF;
+    period[1] = (g_esurl_beacon_adv.period >> 8) & 0xFF;
+
+    length = esurlBeaconAddConfigField(length,
+                                       ESURL_BEACON_CONFIG_URI_DATA,
+                                       g_esurl_beacon_adv.data.uri_data,
+                                       uri_data_size);
+    length = esurlBeaconAddConfigField(length,
+                                       ESURL_BEACON_CONFIG_FLAGS,
+                                       &g_esurl_beacon_adv.flags,
+                                       ESURL_BEACON_FLAGS_SIZE);
+    length = esurlBeaconAddConfigField(length,
+                                       ESURL_BEACON_CONFIG_TX_POWER_MODE,
+                                       &g_esurl_beacon_adv.tx_power_mode,
+                                       1);
+    length = esurlBeaconAddConfigField(length,
+                                   ESURL_BEACON_CONFIG_ADV_TX_POWER_LEVELS,
+                                   g_esurl_beacon_adv.adv_tx_power_levels,
+                                   ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE);
+    length = esurlBeaconAddConfigField(length,
+                                   ESURL_BEACON_CONFIG_RADIO_TX_POWER_LEVELS,
+                                   g_esurl_beacon_adv.radio_tx_power_levels,
+                                   ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE);
+    length = esurlBeaconAddConfigField(length,
+                                       ESURL_BEACON_CONFIG_PERIOD,
+                                       period,
+                                       ESURL_BEACON_PERIOD_SIZE);
+
+    return length;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconWriteConfig
+ *
+ *  DESCRIPTION
+ *      This function validates or applies a write to the configuration
+ *      characteristic. The write is first validated as a whole, and is only
+ *      applied if every field is valid, so that a client never leaves the
+ *      beacon half configured.
+ *
+ *  PARAMETERS
+ *      p_value [in]            Value written
+ *      size [in]               Size of the value, in octets
+ *      apply [in]              FALSE to only validate the value, TRUE to
+ *                              apply a value which has been validated
+ *
+ *  RETURNS
+ *      sys_status_success if the value is valid, otherwise the GATT status
+ *      to return to the client
+ *----------------------------------------------------------------------------*/
+static sys_status esurlBeaconWriteConfig(const uint8 *p_value, uint16 size,
+                                         bool apply)
+{
+    uint16 pos = 0;
+    uint8 type;
+    uint8 length;
+    const uint8 *p_field;
+
+    while(pos < size)
+    {
+        if(size - pos < ESURL_BEACON_CONFIG_FIELD_HDR_SIZE)
+        {
+            return gatt_status_invalid_length;
+        }
+
+        type = p_value[pos];
+        length = p_value[pos + 1];
+        p_field = &p_value[pos + ESURL_BEACON_CONFIG_FIELD_HDR_SIZE];
+        pos += ESURL_BEACON_CONFIG_FIELD_HDR_SIZE;
+
+        if(length > size - pos)
+        {
+            return gatt_status_invalid_length;
+        }
+        pos += length;
+
+        switch(type)
+        {
+        case ESURL_BEACON_CONFIG_URI_DATA:
+            if(length > ESURL_BEACON_URI_MAX)
+            {
+                return gatt_status_invalid_length;
+            }
+            if(apply)
+            {
+                esurlBeaconSetUriData(p_field, length);
+            }
+            break;
+
+        case ESURL_BEACON_CONFIG_FLAGS:
+            if(length != ESURL_BEACON_FLAGS_SIZE)
+            {
+                return gatt_status_invalid_length;
+            }
+            if(apply)
+            {
+                g_esurl_beacon_adv.flags = p_field[0];
+            }
+            break;
+
+        case ESURL_BEACON_CONFIG_TX_POWER_MODE:
+            if(length != sizeof(g_esurl_beacon_adv.tx_power_mode))
+            {
+                return gatt_status_invalid_length;
+            }
+            if(p_field[0] > TX_POWER_MODE_HIGH)
+            {
+                return gatt_status_write_not_permitted;
+            }
+            if(apply)
+            {
+                g_esurl_beacon_adv.tx_power_mode = p_field[0];
+            }
+            break;
+
+        case ESURL_BEACON_CONFIG_ADV_TX_POWER_LEVELS:
+            if(length != ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE)
+            {
+                return gatt_status_invalid_length;
+            }
+            if(apply)
+            {
+                MemCopy(g_esurl_beacon_adv.adv_tx_power_levels, p_field,
+                        ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE);
+            }
+            break;
+
+        case ESURL_BEACON_CONFIG_RADIO_TX_POWER_LEVELS:
+            if(length != ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE)
+            {
+                return gatt_status_invalid_length;
+            }
+            if(apply)
+            {
+                MemCopy(g_esurl_beacon_adv.radio_tx_power_levels, p_field,
+                        ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE);
+            }
+            break;
+
+        case ESURL_BEACON_CONFIG_PERIOD:
+            if(length != ESURL_BEACON_PERIOD_SIZE)
+            {
+                return gatt_status_invalid_length;
+            }
+            if(apply)
+            {
+                esurlBeaconSetPeriod(p_field[0] + (p_field[1] << 8));
+            }
+            break;
+
+        case ESURL_BEACON_CONFIG_LOCK:
+            if(length != ESURL_BEACON_LOCK_CODE_SIZE)
+            {
+                return gatt_status_invalid_length;
+            }
+            if(apply)
+            {
+                MemCopy(g_esurl_beacon_adv.lock_code, p_field,
+                        ESURL_BEACON_LOCK_CODE_SIZE);
+                g_esurl_beacon_adv.lock_state = TRUE;
+            }
+            break;
+
+        default:
+            /* Unknown field type */
+            return gatt_status_write_not_permitted;
+        }
+    }
+
+    return sys_status_success;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconMatchUrl
+ *
+ *  DESCRIPTION
+ *      This function finds the first entry of a table of strings which the
+ *      URL starts with.
+ *
+ *  PARAMETERS
+ *      p_url [in]              URL text
+ *      size [in]               Size of the URL text, in octets
+ *      p_table [in]            Table of strings
+ *      entries [in]            Number of entries in the table
+ *      p_match_length [out]    Length of the matching entry, in octets
+ *
+ *  RETURNS
+ *      Index of the matching entry, or entries if none matches
+ *----------------------------------------------------------------------------*/
+static uint16 esurlBeaconMatchUrl(const uint8 *p_url, uint16 size,
+                                  const char * const *p_table,
+                                  uint16 entries, uint16 *p_match_length)
+{
+    const char *p_entry;
+    uint16 i;
+    uint16 j;
+
+    for(i = 0; i < entries; i++)
+    {
+        p_entry = p_table[i];
+
+        for(j = 0; j < size && p_entry[j] != '\0'; j++)
+        {
+            if(p_url[j] != (uint8)p_entry[j])
+            {
+                break;
+            }
+        }
+
+        if(p_entry[j] == '\0')
+        {
+            *p_match_length = j;
+            return i;
+        }
+    }
+
+    return entries;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      esurlBeaconEncodeUrl
+ *
+ *  DESCRIPTION
+ *      This function encodes a plain-text URL into g_esurl_beacon_uri_buf.
+ *      The scheme is replaced by its code, and each expansion by its code,
+ *      so that the URL takes as little of the advertising data as possible.
+ *
+ *  PARAMETERS
+ *      p_url [in]              URL text
+ *      size [in]               Size of the URL text, in octets
+ *      p_uri_size [out]        Size of the encoded URI data, in octets
+ *
+ *  RETURNS
+ *      sys_status_success if the URL was encoded, otherwise the GATT status
+ *      to return to the client
+ *----------------------------------------------------------------------------*/
+static sys_status esurlBeaconEncodeUrl(const uint8 *p_url, uint16 size,
+                                       uint16 *p_uri_size)
+{
+    uint16 num_schemes = sizeof(url_schemes) / sizeof(url_schemes[0]);
+    uint16 num_expansions = sizeof(url_expansions) /
+                            sizeof(url_expansions[0]);
+    uint16 pos = 0;
+    uint16 length = 0;
+    uint16 code;
+    uint16 match_length;
+
+    /* The URI data always starts with the scheme */
+    code = esurlBeaconMatchUrl(p_url, size, url_schemes, num_schemes,
+                               &match_length);
+    if(code == num_schemes)
+    {
+        return gatt_status_write_not_permitted;
+    }
+    g_esurl_beacon_uri_buf[length++] = code;
+    pos = match_length;
+
+    while(pos < size)
+    {
+        if(length == ESURL_BEACON_URI_MAX)
+        {
+            /* The encoded URL does not fit beside the telemetry */
+            return gatt_status_invalid_length;
+        }
+
+        code = esurlBeaconMatchUrl(&p_url[pos], size - pos, url_expansions,
+                                   num_expansions, &match_length);
+        if(code != num_expansions)
+        {
+            g_esurl_beacon_uri_buf[length++] = code;
+            pos += match_length;
+        }
+        else if(p_url[pos] <= ESURL_BEACON_URL_RESERVED_MAX ||
+                p_url[pos] > '~')
+        {
+            /* Not a printable character, and it would clash with the codes */
+            return gatt_status_write_not_permitted;
+        }
+        else
+        {
+            g_esurl_beacon_uri_buf[length++] = p_url[pos++];
+        }
+    }
 
+    *p_uri_size = length;
+
+    return sys_status_success;
+}
 
 /*============================================================================*
  *  Public Function Implementations
@@ -223,9 +830,9 @@ static uint16 g_esurl_beacon_nvm_offset;
  *----------------------------------------------------------------------------*/
 extern void EsurlBeaconDataInit(void)
 {
-    /* Zero packet */
-    g_esurl_beacon_adv.packet = 0;
-    /* Data initialized from NVM during readPersistentStore */    
+    /* Data initialized from NVM during readPersistentStore. The packet
+     * counter is not reset, it carries on across connections and resets.
+     */
 }
 
 /*----------------------------------------------------------------------------*
@@ -295,9 +902,6 @@ extern void EsurlBeaconInitChipReset(void)
     
     /* Set default period = 10 seconds */
     g_esurl_beacon_adv.period = 10000;
-    
-    /* Flag data structure needs writing to NVM */
-    g_esurl_beacon_nvm_write_flag = TRUE;    
 }
 
 /*----------------------------------------------------------------------------*
@@ -317,83 +921,75 @@ extern void EsurlBeaconInitChipReset(void)
  *----------------------------------------------------------------------------*/
 extern void EsurlBeaconHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
 {
+    const ESURL_BEACON_CHAR_T *p_char = esurlBeaconFindChar(p_ind->handle);
     uint16 length = 0;                  /* Length of attribute data, octets */
     uint8 *p_val = NULL;                /* Pointer to attribute value */
     sys_status rc = sys_status_success; /* Function status */
-    uint8 name_data_size = 0;            /* Size of name data */
-    uint8 uri_data_size = 0;            /* Size of uri data */
-    
-    switch(p_ind->handle)
-    {  
-    case HANDLE_ESURL_BEACON_LOCK_STATE:
-        length = sizeof(g_esurl_beacon_adv.lock_state); 
-        p_val = &g_esurl_beacon_adv.lock_state; 
-        break;
-        
-    case HANDLE_ESURL_BEACON_FLAGS:
-        length = ESURL_BEACON_FLAGS_SIZE;
-        p_val = &g_esurl_beacon_adv.flags;
-        break; 
-        
-    case HANDLE_ESURL_BEACON_TX_POWER_MODE:
-        length = sizeof(g_esurl_beacon_adv.tx_power_mode); 
-        p_val = &g_esurl_beacon_adv.tx_power_mode;
-        break;        
-        
-    case HANDLE_DEVICE_NAME:
-        
-        name_data_size = g_esurl_beacon_adv.name_length - BEACON_NAME_HDR_SIZE; 
-        /* Return the beacon data & protect against overflow */
-        if (name_data_size > (ESURL_BEACON_DATA_MAX))
+
+    if(p_char == NULL || (p_char->flags & ESURL_BEACON_CHAR_READ) == 0)
+    {
+        rc = gatt_status_read_not_permitted;
+    }
+    else if(p_char->p_value != NULL)
+    {
+        /* Plain value, return it as it is */
+        length = p_char->length;
+        p_val = p_char->p_value;
+    }
+    else
+    {
+        switch(p_ind->handle)
         {
-            length = ESURL_BEACON_DATA_MAX;
-        } 
-        else
-        {              
-            length = name_data_size;  
+        case HANDLE_ESURL_BEACON_URI_DATA:
+            /* Return the URI data without the telemetry */
+            length = esurlBeaconUriSize();
+            p_val = g_esurl_beacon_adv.data.uri_data;
+            
+            break;    
+            
+        case HANDLE_ESURL_BEACON_PERIOD:          
+            length = ESURL_BEACON_PERIOD_SIZE;
+            g_esurl_beacon_buf[0] = g_esurl_beacon_adv.period & 0xFF;        
+            g_esurl_beacon_buf[1] = (g_esurl_beacon_adv.period >> 8) & 0xFF;
+            p_val = g_esurl_beacon_buf;            
+            break;         
+
+        case HANDLE_ESURL_BEACON_CONFIG:
+            length = esurlBeaconReadConfig();
+            p_val = g_esurl_beacon_config_buf;
+            break;
+
+        case HANDLE_ESURL_BEACON_URL:
+            /* Return the length of the encoded URI data, and the length
+             * it is limited to
+             */
+            length = ESURL_BEACON_URL_READ_SIZE;
+            g_esurl_beacon_buf[0] = esurlBeaconUriSize();
+            g_esurl_beacon_buf[1] = ESURL_BEACON_URI_MAX;
+            p_val = g_esurl_beacon_buf;
+            break;
+            
+        default:
+            rc = gatt_status_read_not_permitted;
         }
-        p_val = g_esurl_beacon_adv.name.name_data;
-        
-        break;
-
-    case HANDLE_ESURL_BEACON_URI_DATA:
-        
-        uri_data_size = g_esurl_beacon_adv.data_length - BEACON_DATA_HDR_SIZE; 
-        /* Return the beacon data & protect against overflow */
-        if (uri_data_size > (ESURL_BEACON_DATA_MAX))
+    }
+
+    /* Values may be longer than one ATT PDU, so honour the offset of a long
+     * read
+     */
+    if(rc == sys_status_success)
+    {
+        if(p_ind->offset > length)
         {
-            length = ESURL_BEACON_DATA_MAX;
-        } 
+            rc = gatt_status_invalid_offset;
+            length = 0;
+            p_val = NULL;
+        }
         else
-        {              
-            length = uri_data_size;  
+        {
+            length -= p_ind->offset;
+            p_val += p_ind->offset;
         }
-        p_val = g_esurl_beacon_adv.data.uri_data;
-        
-        break;    
-        
-    case HANDLE_ESURL_BEACON_ADV_TX_POWER_LEVELS:
-        length = sizeof(g_esurl_beacon_adv.adv_tx_power_levels);
-        p_val = g_esurl_beacon_adv.adv_tx_power_levels;
-        break; 
-        
-    case HANDLE_ESURL_BEACON_RADIO_TX_POWER_LEVELS:
-        length = sizeof(g_esurl_beacon_adv.radio_tx_power_levels);
-        p_val = g_esurl_beacon_adv.radio_tx_power_levels;
-        break;     
-        
-    case HANDLE_ESURL_BEACON_PERIOD:          
-        length = ESURL_BEACON_PERIOD_SIZE;
-        g_esurl_beacon_buf[0] = g_esurl_beacon_adv.period & 0xFF;        
-        g_esurl_beacon_buf[1] = (g_esurl_beacon_adv.period >> 8) & 0xFF;            
-        p_val = g_esurl_beacon_buf;            
-        break;         
-        
-        /* NO MATCH */
-        
-     default:
-        /* No more IRQ characteristics */
-        rc = gatt_status_read_not_permitted;
     }
     
     /* Send ACCESS RESPONSE */
@@ -418,264 +1014,185 @@ extern void EsurlBeaconHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
  *----------------------------------------------------------------------------*/
 extern void EsurlBeaconHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
 {
+    const ESURL_BEACON_CHAR_T *p_char = esurlBeaconFindChar(p_ind->handle);
     uint8 *p_value = p_ind->value;      /* New attribute value */
     uint8 p_size = p_ind->size_value;     /* New value length */    
     sys_status rc = sys_status_success; /* Function status */
+    bool release = FALSE;               /* Disconnect after responding */
     
-    switch(p_ind->handle)
-    {    
-    case HANDLE_ESURL_BEACON_LOCK:
-        /* Sanity check for the data size */
-        if ((p_size != sizeof(g_esurl_beacon_adv.lock_code)) &&
-           (g_esurl_beacon_adv.lock_state == FALSE))           
-        {                
-            rc = gatt_status_invalid_length;
-        }
-        else if ( g_esurl_beacon_adv.lock_state == FALSE) 
-        {
-            MemCopy(g_esurl_beacon_adv.lock_code, 
-                    p_value,
-                    sizeof(g_esurl_beacon_adv.lock_code));
-            
-            /* Flag the lock is set */
-            g_esurl_beacon_adv.lock_state = TRUE;
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;
-        } 
-        else
-        {
-            rc = gatt_status_insufficient_authorization;            
-        }
-        break;
-        
-    case HANDLE_ESURL_BEACON_UNLOCK:
-        /* Sanity check for the data size */
-        if (p_size != sizeof(g_esurl_beacon_adv.lock_code))
-        {                
-            rc = gatt_status_invalid_length;
-        }
-        /* if locked then process the unlock request */
-        else if ( g_esurl_beacon_adv.lock_state) 
-        {
-            if (MemCmp(p_value, 
-                       g_esurl_beacon_adv.lock_code,
-                       sizeof(g_esurl_beacon_adv.lock_code)) == 0)
+    if(p_char == NULL || (p_char->flags & ESURL_BEACON_CHAR_WRITE) == 0)
+    {
+        rc = gatt_status_write_not_permitted;
+    }
+    else if((p_char->flags & ESURL_BEACON_CHAR_LOCKED) &&
+            g_esurl_beacon_adv.lock_state)
+    {
+        rc = gatt_status_insufficient_authorization;
+    }
+    /* Sanity check for the data size */
+    else if(p_char->length != 0 && p_size != p_char->length)
+    {
+        rc = gatt_status_invalid_length;
+    }
+    else
+    {
+        switch(p_ind->handle)
+        {    
+        case HANDLE_ESURL_BEACON_LOCK:
+            /* Sanity check for the data size */
+            if ((p_size != sizeof(g_esurl_beacon_adv.lock_code)) &&
+               (g_esurl_beacon_adv.lock_state == FALSE))           
+            {                
+                rc = gatt_status_invalid_length;
+            }
+            else if ( g_esurl_beacon_adv.lock_state == FALSE) 
             {
-                /* SUCCESS: so unlock beacoon */
-                g_esurl_beacon_adv.lock_state = FALSE; 
+                MemCopy(g_esurl_beacon_adv.lock_code, 
+                        p_value,
+                        sizeof(g_esurl_beacon_adv.lock_code));
                 
-                /* Flag state needs writing to NVM */
-                g_esurl_beacon_nvm_write_flag = TRUE;                       
+                /* Flag the lock is set */
+                g_esurl_beacon_adv.lock_state = TRUE;
+                /* Queue state to be written to NVM */
+                Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
             } 
             else
-            { /* UNLOCK FAILED */
-                rc = gatt_status_insufficient_authorization;    
-            }       
-        }
-        break;
-        
-    case HANDLE_DEVICE_NAME:
-        if (g_esurl_beacon_adv.lock_state) {
-            rc = gatt_status_insufficient_authorization;
-        } 
-        /* Sanity check for URI will fit in the Beacon */            
-        else if (p_size > (ESURL_BEACON_DATA_MAX))
-        {               
-            rc = gatt_status_invalid_length;
-        }
-        /* Process the characteristic Write */
-        else
-        {                    
-            int name_data_size = p_size;
-            
-            /* Updated the URL in the beacon structure */
-            MemCopy(g_esurl_beacon_adv.name.name_data, p_value, name_data_size);
-            g_esurl_beacon_adv.name_length = name_data_size + BEACON_NAME_HDR_SIZE;
-            
-            /* Write the new data service size into the ADV header */
-            g_esurl_beacon_adv.name.service_name_length =
-                    name_data_size + SERVICE_DATA_PRE_URI_SIZE;
-            
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;                  
-        }
-        break;
-
-    case HANDLE_ESURL_BEACON_URI_DATA:
-        if (g_esurl_beacon_adv.lock_state) {
-            rc = gatt_status_insufficient_authorization;
-        } 
-        /* Sanity check for URI will fit in the Beacon */            
-        else if (p_size > (ESURL_BEACON_DATA_MAX))
-        {               
-            rc = gatt_status_invalid_length;
-        }
-        /* Process the characteristic Write */
-        else
-        {                    
-            int uri_data_size = p_size;
-            
-            /* Updated the URL in the beacon structure */
-            MemCopy(g_esurl_beacon_adv.data.uri_data, p_value, uri_data_size);
-            g_esurl_beacon_adv.data_length = uri_data_size + BEACON_DATA_HDR_SIZE;
+            {
+                rc = gatt_status_insufficient_authorization;            
+            }
+            break;
             
-            /* Write the new data service size into the ADV header */
-            g_esurl_beacon_adv.data.service_data_length =
-                    uri_data_size + SERVICE_DATA_PRE_URI_SIZE;
+        case HANDLE_ESURL_BEACON_UNLOCK:
+            /* if locked then process the unlock request */
+            if ( g_esurl_beacon_adv.lock_state) 
+            {
+                if (MemCmp(p_value, 
+                           g_esurl_beacon_adv.lock_code,
+                           sizeof(g_esurl_beacon_adv.lock_code)) == 0)
+                {
+                    /* SUCCESS: so unlock beacoon */
+                    g_esurl_beacon_adv.lock_state = FALSE; 
+                    
+                    /* Queue state to be written to NVM */
+                    Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
+                } 
+                else
+                { /* UNLOCK FAILED */
+                    rc = gatt_status_insufficient_authorization;    
+                }       
+            }
+            break;
             
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;                  
-        }
-        break;     
-        
-    case HANDLE_ESURL_BEACON_FLAGS:
-        if (g_esurl_beacon_adv.lock_state)
-        {
-            rc = gatt_status_insufficient_authorization;
-        }
-        /* Sanity check for the data size */
-        else if (p_size != sizeof(g_esurl_beacon_adv.flags))
-        {                
-            /* invalid length */
-            rc = gatt_status_invalid_length;
-        }
-        /* Write the flags */
-        else
-        {
-            g_esurl_beacon_adv.flags = p_value[0];
+        case HANDLE_ESURL_BEACON_URI_DATA:
+            /* Sanity check for URI will fit in the Beacon */            
+            if (p_size > (ESURL_BEACON_URI_MAX))
+            {               
+                rc = gatt_status_invalid_length;
+            }
+            /* Process the characteristic Write */
+            else
+            {                    
+                esurlBeaconSetUriData(p_value, p_size);
+                
+                /* Queue state to be written to NVM */
+                Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
+            }
+            break;     
             
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;                   
-        }
-        break;        
-        
-        
-    case HANDLE_ESURL_BEACON_TX_POWER_MODE:
-        if (g_esurl_beacon_adv.lock_state)
-        {
-            rc = gatt_status_insufficient_authorization;
-        }
-        /* Sanity check for the data size */
-        else if(p_size != sizeof(g_esurl_beacon_adv.tx_power_mode))
-        {                
-            rc = gatt_status_invalid_length;
-        }
-        /* Write the tx power value */
-        else
-        {       
-            int tx_power_mode = p_value[0];
-            if (( tx_power_mode >= TX_POWER_MODE_LOWEST) && 
-                (tx_power_mode <= TX_POWER_MODE_HIGH))
+        case HANDLE_ESURL_BEACON_TX_POWER_MODE:
+            if ((p_value[0] >= TX_POWER_MODE_LOWEST) && 
+                (p_value[0] <= TX_POWER_MODE_HIGH))
             {
-                g_esurl_beacon_adv.tx_power_mode =  tx_power_mode; 
+                g_esurl_beacon_adv.tx_power_mode = p_value[0]; 
                 
                 /* NOTE: The effects of updating tx_power_mode here are turned
-                 * into ADV and RADIO power updates on esurl beacon service disconnect 
-                 * in the file gatt_access.c
+                 * into ADV and RADIO power updates on esurl beacon service
+                 * disconnect in the file gatt_access.c
                  */
 
-                /* Flag state needs writing to NVM */
-                g_esurl_beacon_nvm_write_flag = TRUE;
+                /* Queue state to be written to NVM */
+                Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
             } 
             else
             {
                 rc = gatt_status_write_not_permitted;
             }  
-        }
-        break;
-        
-    case HANDLE_ESURL_BEACON_ADV_TX_POWER_LEVELS:
-        if (g_esurl_beacon_adv.lock_state)
-        {
-            rc = gatt_status_insufficient_authorization;
-        }
-        /* Sanity check for the data size */
-        else if(p_size != ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE)
-        {                
-            /* invalid length */
-            rc = gatt_status_invalid_length;
-        }
-        /* Do the calibration table write */
-        else 
-        {
-            /* Updated the tx power calibration table for the pkt */
-            MemCopy(g_esurl_beacon_adv.adv_tx_power_levels, p_value, ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE);
-            
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;               
-        }     
-        break;
-        
-    case HANDLE_ESURL_BEACON_RADIO_TX_POWER_LEVELS:
-        if (g_esurl_beacon_adv.lock_state)
-        {
-            rc = gatt_status_insufficient_authorization;
-        }
-        /* Sanity check for the data size */
-        else if (p_size != ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE)
-        {                
-            rc = gatt_status_invalid_length;
-        }
-        /* Update the adv tx power levels */
-        else 
-        {
-            /* Updated the tx power calibration table for the pkt */
-            MemCopy(g_esurl_beacon_adv.adv_tx_power_levels, p_value, ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE);
+            break;
             
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;                 
-        }     
-        break;        
-        
-    case HANDLE_ESURL_BEACON_PERIOD:
-        if (g_esurl_beacon_adv.lock_state)
-        {
-            rc = gatt_status_insufficient_authorization;
-        }
-        else if (p_size != ESURL_BEACON_PERIOD_SIZE)
-        {
-            rc = gatt_status_invalid_length;       
-        }
-        else
-        {
-            /* Write the period (little endian 16-bits in p_value) */;   
-            g_esurl_beacon_adv.period = p_value[0] + (p_value[1] << 8);  
+        case HANDLE_ESURL_BEACON_PERIOD:
+            /* Write the period (little endian 16-bits in p_value) */
+            esurlBeaconSetPeriod(p_value[0] + (p_value[1] << 8));
+
+            /* Queue state to be written to NVM */
+            Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
+            break;      
             
-            if ((g_esurl_beacon_adv.period < BEACON_PERIOD_MIN) && (g_esurl_beacon_adv.period != 0))
-            { /* minimum beacon period is 100ms; zero turns off beaconing */
-                g_esurl_beacon_adv.period = BEACON_PERIOD_MIN;
+        case HANDLE_ESURL_BEACON_CONFIG:
+            /* Apply the fields only once they have all been validated */
+            rc = esurlBeaconWriteConfig(p_value, p_size, FALSE);
+            if(rc == sys_status_success)
+            {
+                esurlBeaconWriteConfig(p_value, p_size, TRUE);
+
+                /* Queue state to be written to NVM */
+                Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
             }
-            /* Flag state needs writing to NVM */
-            g_esurl_beacon_nvm_write_flag = TRUE;           
-        }
-        break;      
-        
-    case HANDLE_ESURL_BEACON_RESET:
-        if (g_esurl_beacon_adv.lock_state)
-        {
-            rc = gatt_status_insufficient_authorization;
             break;
-        } 
-        else if (p_size != ESURL_BEACON_RESET_SIZE)
-        {
-            rc = gatt_status_invalid_length;       
-        }   
-        else
-        {
+
+        case HANDLE_ESURL_BEACON_URL:
+            {
+                uint16 uri_size;
+
+                /* Only replace the URI data if the whole URL encodes and
+                 * fits
+                 */
+                rc = esurlBeaconEncodeUrl(p_value, p_size, &uri_size);
+                if(rc == sys_status_success)
+                {
+                    esurlBeaconSetUriData(g_esurl_beacon_uri_buf, uri_size);
+
+                    /* Queue state to be written to NVM */
+                    Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
+                }
+            }
+            break;
+
+        case HANDLE_ESURL_BEACON_COMMIT:
+            /* Write the configuration to NVM now rather than on disconnect,
+             * then release the link once the client has its response
+             */
+            Nvm_CommitPending();
+            release = TRUE;
+            break;
+
+        case HANDLE_ESURL_BEACON_RESET:
             /* Reset local data and NVM memory */
             EsurlBeaconInitChipReset();
             
-            /* Update NVM from g_esurl_beacon_adv */       
-            EsurlBeaconWriteDataToNVM(NULL); 
-        }
-        break;
-        
+            /* Queue NVM update from g_esurl_beacon_adv */
+            Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
+            break;
+            
         default:
-        rc = gatt_status_write_not_permitted;
+            /* Plain value whose length has already been checked */
+            MemCopy(p_char->p_value, p_value, p_char->length);
+
+            /* Queue state to be written to NVM */
+            Nvm_WriteRecordDeferred(&g_esurl_beacon_nvm_record);
+            break;
+        }
     }
     
     /* Send ACCESS RESPONSE */
     GattAccessRsp(p_ind->cid, p_ind->handle, rc, 0, NULL);
+
+    if(release)
+    {
+        /* Disconnect, which returns the device to beaconing straight away
+         * rather than when the client disconnects
+         */
+        SetState(app_state_disconnecting);
+    }
 }
 
 /*----------------------------------------------------------------------------*
@@ -697,41 +1214,45 @@ extern void EsurlBeaconGetName(uint8** name, uint8* name_size)
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      EsurlBeaconGetName
+ *      EsurlBeaconUpdateData
  *
  *  DESCRIPTION
- *      This function returns the current value of the beacon name
+ *      This function counts a beacon packet and refreshes the telemetry which
+ *      follows the encoded URL in the URI data.
+ *
+ *  PARAMETERS
+ *      low_battery [in]        TRUE to flag the battery level as a last gasp
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void EsurlBeaconUpdateData(void)
+extern void EsurlBeaconUpdateData(bool low_battery)
 {
     /* Update the ADV data */
-    uint8 batt = readBatteryLevel(); 
+    uint8 *p_data = &g_esurl_beacon_adv.data.uri_data[esurlBeaconUriSize()];
     int16 temp = readTemperature();
     uint32 packet = (++g_esurl_beacon_adv.packet);
-    uint8 battsize = sizeof(batt);
-    uint8 tempsize = 2*sizeof(temp);
-    uint8 packetsize = 2*sizeof(packet);
-    /* Update uri_data with a URI:  http://betrack.co */
-    uint8 i;
-    uint8 data;
-    for(i = battsize; i > 0; i--){
-        data = (uint8)batt;
-        MemCopy(g_esurl_beacon_adv.data.uri_data+0+i, &data, 1);
-        batt>>=8;
-    }
-    for(i = tempsize; i > 0; i-=sizeof(temp)){
-        data = (uint8)temp;
-        MemCopy(g_esurl_beacon_adv.data.uri_data+battsize+1+i, &data, 1);
-        temp>>=8;
-    }
-    for(i = packetsize; i > 0; i--){
-        data = (uint8)packet;
-        MemCopy(g_esurl_beacon_adv.data.uri_data+battsize+1+tempsize+1+i, &data, 1);
-        packet>>=8;
+    uint8 battery = readBatteryLevel();
+
+    /* Checkpoint the counter before the first packet of each interval is
+     * sent
+     */
+    if((packet & (ESURL_BEACON_PACKET_CHECKPOINT_INTERVAL - 1)) == 0)
+    {
+        esurlBeaconCheckpointPacket(packet);
     }
+
+    *p_data++ = 'B';
+    *p_data++ = low_battery ? (battery | ESURL_BEACON_TELEMETRY_LOW_BATTERY) :
+                              battery;
+    *p_data++ = 't';
+    *p_data++ = (temp >> 8) & 0xFF;
+    *p_data++ = temp & 0xFF;
+    *p_data++ = 'p';
+    *p_data++ = (packet >> 24) & 0xFF;
+    *p_data++ = (packet >> 16) & 0xFF;
+    *p_data++ = (packet >> 8) & 0xFF;
+    *p_data = packet & 0xFF;
 }
 
 /*----------------------------------------------------------------------------*
@@ -776,78 +1297,73 @@ extern uint32 EsurlBeaconGetPeriodMillis(void)
  *      NVM.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to Beacon Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void EsurlBeaconReadDataFromNVM(uint16 *p_offset)
+extern void EsurlBeaconReadDataFromNVM(void)
 {
-    g_esurl_beacon_nvm_offset = *p_offset;
-    
-    /* Read beacon data size */
-    Nvm_Read((uint16*)&g_esurl_beacon_adv, sizeof(g_esurl_beacon_adv),
-             g_esurl_beacon_nvm_offset);
-    
-    *p_offset += sizeof(g_esurl_beacon_adv);
-}
+    Nvm_InitRecord(&g_esurl_beacon_nvm_record, nvm_partition_esurl_beacon,
+                   (uint16*)&g_esurl_beacon_adv, sizeof(g_esurl_beacon_adv));
 
-/*----------------------------------------------------------------------------*
- *  NAME
- *      EsurlBeaconWriteDataToNVM
- *
- *  DESCRIPTION
- *      This function is used to write Beacon Service specific data in memory to 
- *      NVM.
- *
- *  PARAMETERS
-*      p_offset  [in]           Offset to EsurlBeacon Service data in NVM
- *               [out]          Offset to next entry in NVM
- *
- *  RETURNS
- *      Nothing
- *----------------------------------------------------------------------------*/
-extern void EsurlBeaconWriteDataToNVM(uint16 *p_offset)
-{
-    if (*p_offset != NULL) 
-    { /* Update the stored nvm offset with the pointer arg */
-        g_esurl_beacon_nvm_offset = *p_offset;    
-    } else {
-        /* Null arg, so the .nvm_offset is already set correctly */      
-        *p_offset = g_esurl_beacon_nvm_offset;
+    /* Read beacon data */
+    if(!Nvm_ReadRecord(&g_esurl_beacon_nvm_record))
+    {
+        /* Neither copy is valid, restore and rewrite the defaults */
+        EsurlBeaconInitChipReset();
+        Nvm_WriteRecord(&g_esurl_beacon_nvm_record);
     }
-    
-    /* Only write out the esurl beacon data if it is flagged dirty */
-    if (g_esurl_beacon_nvm_write_flag) 
+
+    Nvm_InitRecord(&g_esurl_beacon_checkpoint_record,
+                   nvm_partition_packet_checkpoint,
+                   (uint16*)&g_esurl_beacon_packet_checkpoint,
+                   sizeof(g_esurl_beacon_packet_checkpoint));
+
+    /* Resume the packet counter past any packet which may have been sent
+     * since the last checkpoint. If there is no valid checkpoint, carry on
+     * from the value last saved with the beacon data.
+     */
+    if(Nvm_ReadRecord(&g_esurl_beacon_checkpoint_record))
     {
-        /* Write all esurl beacon service data into NVM */
-        Nvm_Write((uint16*)&g_esurl_beacon_adv, sizeof(g_esurl_beacon_adv),
-                  g_esurl_beacon_nvm_offset); 
-        g_esurl_beacon_nvm_write_flag = FALSE;
+        g_esurl_beacon_adv.packet = g_esurl_beacon_packet_checkpoint +
+                                    ESURL_BEACON_PACKET_CHECKPOINT_INTERVAL;
     }
-    
-    *p_offset += sizeof(g_esurl_beacon_adv);   
+
+    /* Checkpoint the resume point, so that another reset before the next
+     * checkpoint does not resume at the same value
+     */
+    esurlBeaconCheckpointPacket(g_esurl_beacon_adv.packet);
 }
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      EsurlBeaconCheckHandleRange
+ *      EsurlBeaconWriteDataToNVM
  *
  *  DESCRIPTION
- *      This function is used to check if the handle belongs to the Beacon 
- *      Service.
+ *      This function is used to write Beacon Service specific data in memory to 
+ *      NVM.
  *
  *  PARAMETERS
- *      handle [in]             Handle to check
+ *      None
  *
  *  RETURNS
- *      TRUE if handle belongs to the Battery Service, FALSE otherwise
+ *      Nothing
  *----------------------------------------------------------------------------*/
-extern bool EsurlBeaconCheckHandleRange(uint16 handle)
+extern void EsurlBeaconWriteDataToNVM(void)
 {
-    return ((handle >= HANDLE_ESURL_BEACON_SERVICE) &&
-            (handle <= HANDLE_ESURL_BEACON_SERVICE_END));
+    Nvm_InitRecord(&g_esurl_beacon_nvm_record, nvm_partition_esurl_beacon,
+                   (uint16*)&g_esurl_beacon_adv, sizeof(g_esurl_beacon_adv));
+
+    /* First write, so also set up the packet counter checkpoint */
+    Nvm_InitRecord(&g_esurl_beacon_checkpoint_record,
+                   nvm_partition_packet_checkpoint,
+                   (uint16*)&g_esurl_beacon_packet_checkpoint,
+                   sizeof(g_esurl_beacon_packet_checkpoint));
+    esurlBeaconCheckpointPacket(g_esurl_beacon_adv.packet);
+
+    /* Write all esurl beacon service data into NVM */
+    Nvm_WriteRecord(&g_esurl_beacon_nvm_record);
 }
 
 /*----------------------------------------------------------------------------*
@@ -909,4 +1425,42 @@ extern void EsurlBeaconUpdateTxPowerFromMode(uint8 tx_power_mode)
 extern uint8 EsurlBeaconGetTxPowerMode(void) 
 {
     return g_esurl_beacon_adv.tx_power_mode;
-}
\ No newline at end of file
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      EsurlBeaconGetPacketCount
+ *
+ *  DESCRIPTION
+ *      This function returns the number of beacon packets sent. The count
+ *      carries on across connections and resets.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Packet counter
+ *----------------------------------------------------------------------------*/
+extern uint32 EsurlBeaconGetPacketCount(void)
+{
+    return g_esurl_beacon_adv.packet;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      EsurlBeaconIsLocked
+ *
+ *  DESCRIPTION
+ *      This function returns whether the beacon is locked, in which case
+ *      its configuration may not be written until it is unlocked.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if the beacon is locked
+ *----------------------------------------------------------------------------*/
+extern bool EsurlBeaconIsLocked(void)
+{
+    return g_esurl_beacon_adv.lock_state;
+}
@@ -69,6 +69,11 @@
 
 /* Size of fields in the ADV packet */
 
+/* Service list, service data and local name AD headers */
+#define ESURL_BEACON_SERVICE_HDR_SIZE (4)
+#define ESURL_BEACON_SERVICE_DATA_HDR_SIZE (3)
+#define ESURL_BEACON_SERVICE_NAME_HDR_SIZE (1)
+
 /* length of service data hdr before URI */
 #define BEACON_DATA_HDR_SIZE (10)
 #define BEACON_NAME_HDR_SIZE (7)
@@ -78,12 +83,26 @@
 #define SERVICE_NAME_PRE_URI_SIZE (1)
 #define ESURL_BEACON_FLAGS_SIZE (1) 
 
+/* The URI data holds the encoded URL followed by telemetry, which is
+ * refreshed before each beacon: 'B' and the battery level in percent, 't'
+ * and the temperature (2 octets), then 'p' and the packet counter
+ * (4 octets), each most significant octet first. The URL may only take the
+ * octets the telemetry leaves free. The battery level has
+ * ESURL_BEACON_TELEMETRY_LOW_BATTERY set in the last gasp bursts sent on an
+ * almost flat battery.
+ */
+#define ESURL_BEACON_TELEMETRY_SIZE (10)
+#define ESURL_BEACON_TELEMETRY_LOW_BATTERY (0x80)
+#define ESURL_BEACON_URI_MAX (ESURL_BEACON_DATA_MAX - \
+                              ESURL_BEACON_TELEMETRY_SIZE)
+
 /* Size of array definitions for uribeacon data structure */
 #define ESURL_BEACON_LOCK_CODE_SIZE  (16)
 #define ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE (4)
 #define ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE (4)
 #define ESURL_BEACON_PERIOD_SIZE (2)
 #define ESURL_BEACON_RESET_SIZE (1)
+#define ESURL_BEACON_COMMIT_SIZE (1)
 
 /* TX Power mode values */
 #define TX_POWER_MODE_LOWEST   (0)
@@ -123,6 +142,119 @@
 /* Time in milliseconds */
 #define BEACON_PERIOD_MIN (100)
 
+/* Configuration characteristic. Its value is a sequence of fields, each a
+ * one-octet type and a one-octet length followed by the value. A write may
+ * hold any subset of the fields; it is validated as a whole before any field
+ * is applied. A read returns every field except the lock code. Both may be
+ * longer than one ATT PDU, using long reads and queued writes.
+ */
+#define ESURL_BEACON_CONFIG_URI_DATA                (0x01)
+#define ESURL_BEACON_CONFIG_FLAGS                   (0x02)
+#define ESURL_BEACON_CONFIG_TX_POWER_MODE           (0x03)
+#define ESURL_BEACON_CONFIG_ADV_TX_POWER_LEVELS     (0x04)
+#define ESURL_BEACON_CONFIG_RADIO_TX_POWER_LEVELS   (0x05)
+#define ESURL_BEACON_CONFIG_PERIOD                  (0x06)
+
+/* Write only. Sets the lock code and locks the beacon. */
+#define ESURL_BEACON_CONFIG_LOCK                    (0x07)
+
+/* Size of the type and length preceding each field value */
+#define ESURL_BEACON_CONFIG_FIELD_HDR_SIZE          (2)
+
+/* Size of the complete configuration returned by a read */
+#define ESURL_BEACON_CONFIG_MAX \
+    (6 * ESURL_BEACON_CONFIG_FIELD_HDR_SIZE + ESURL_BEACON_URI_MAX + \
+     ESURL_BEACON_FLAGS_SIZE + 1 + ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE + \
+     ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE + ESURL_BEACON_PERIOD_SIZE)
+
+/* URL characteristic. A write holds a plain-text URL such as
+ * "https://www.example.com/", which is encoded into the URI data: the scheme
+ * becomes the first octet and each of the expansions below a single octet.
+ * A URL whose encoding is longer than ESURL_BEACON_URI_MAX octets is refused.
+ * A read returns the encoded length in one octet, followed by
+ * ESURL_BEACON_URI_MAX in one octet.
+ */
+#define ESURL_BEACON_URL_READ_SIZE                  (2)
+#define ESURL_BEACON_URL_SCHEME_HTTP_WWW            (0x00)  /* http://www. */
+#define ESURL_BEACON_URL_SCHEME_HTTPS_WWW           (0x01)  /* https://www. */
+#define ESURL_BEACON_URL_SCHEME_HTTP                (0x02)  /* http:// */
+#define ESURL_BEACON_URL_SCHEME_HTTPS               (0x03)  /* https:// */
+
+/* Codes 0x00 to 0x06 are ".com/" to ".gov/", 0x07 to 0x0D the same without
+ * the trailing slash. Codes up to 0x20 are reserved, so a URL containing
+ * control characters or spaces is refused.
+ */
+#define ESURL_BEACON_URL_RESERVED_MAX               (0x20)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Total size 28 bytes */
+typedef struct _ESURL_BEACON_DATA_T
+{
+    /* Current beacon data value */
+    uint8 service_hdr[ESURL_BEACON_SERVICE_HDR_SIZE];
+    
+    uint8 service_data_length;
+    
+    uint8 service_data_hdr[ESURL_BEACON_SERVICE_DATA_HDR_SIZE];
+            
+    uint8 uri_data[ESURL_BEACON_DATA_MAX];
+    
+} ESURL_BEACON_DATA_T;
+
+/* Total size 28 bytes */
+typedef struct _ESURL_BEACON_NAME_T
+{
+    /* Current beacon name value */
+    uint8 service_hdr[ESURL_BEACON_SERVICE_HDR_SIZE];
+    
+    uint8 service_name_length;
+    
+    uint8 service_name_hdr[ESURL_BEACON_SERVICE_NAME_HDR_SIZE];
+            
+    uint8 name_data[ESURL_BEACON_DATA_MAX];
+    
+} ESURL_BEACON_NAME_T;
+
+/* Beacon data type. It is stored in NVM as a single record. */
+typedef struct _ESURL_BEACON_ADV_T
+{
+    /* Adv name */
+    ESURL_BEACON_NAME_T name;
+    uint8 name_length;
+
+    /* Adv data */
+    ESURL_BEACON_DATA_T data;
+    uint8 data_length;
+
+    uint8 flags;
+    uint8 tx_power;
+    
+    /* A boolean TRUE/FALSE value determining if the beacon is locked */
+    uint8 lock_state;
+    
+    /* A 128-bit (16 byte) code for locking/unlocking the beacon */
+    uint8 lock_code[ESURL_BEACON_LOCK_CODE_SIZE];
+    
+    /* A value 0-3 that is mapped to a pkt and radio val via the cal tables */
+    uint8 tx_power_mode;
+    
+    /* A calibration table mapping tx_level_code to the packet code */
+    uint8 adv_tx_power_levels[ESURL_BEACON_ADV_TX_POWER_LEVELS_SIZE];
+    
+    /* A calibration table mapping tx_level_code to the radio code */
+    uint8 radio_tx_power_levels[ESURL_BEACON_RADIO_TX_POWER_LEVELS_SIZE];   
+    
+    /* Beacon period in milliseconds 0-65536ms */
+    uint16 period;
+    
+    /* Packets sent */
+    uint32 packet;
+    
+} ESURL_BEACON_ADV_T;
+
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -146,8 +278,8 @@ extern void EsurlBeaconHandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
 /* Returns the current value of the beacon data */
 extern void EsurlBeaconGetName(uint8** name, uint8* name_size);
 
-/* Returns the current value of the beacon data */
-extern void EsurlBeaconUpdateData(void);
+/* Count a beacon packet and refresh the telemetry in the beacon data */
+extern void EsurlBeaconUpdateData(bool low_battery);
 
 /* Returns the current value of the beacon data */
 extern void EsurlBeaconGetData(uint8** data, uint8* data_size);
@@ -156,16 +288,10 @@ extern void EsurlBeaconGetData(uint8** data, uint8* data_size);
 extern uint32 EsurlBeaconGetPeriodMillis(void);
 
 /* Read the Esurl Beacon Service specific data stored in NVM */
-extern void EsurlBeaconReadDataFromNVM(uint16 *p_offset);
-
-/* Read the Esurl Beacon Service specific data stored in NVM */
-extern void OldEsurlBeaconReadDataFromNVM(uint16 *p_offset);
+extern void EsurlBeaconReadDataFromNVM(void);
 
 /* Write the Esurl Beacon Sevice specific data to NVM */ 
-extern void EsurlBeaconWriteDataToNVM(uint16 *p_offset);
-
-/* Check if the handle belongs to the Beacon Service */
-extern bool EsurlBeaconCheckHandleRange(uint16 handle);
+extern void EsurlBeaconWriteDataToNVM(void);
 
 /* Notify bonding status to the Beacon Service */
 extern void EsurlBeaconBondingNotify(void);
@@ -176,4 +302,10 @@ extern void EsurlBeaconUpdateTxPowerFromMode(uint8 tx_power_mode);
 /* Get the Esurl Beacon Tx Power Mode */
 extern uint8 EsurlBeaconGetTxPowerMode(void);
 
+/* Return the number of beacon packets sent */
+extern uint32 EsurlBeaconGetPacketCount(void);
+
+/* Return TRUE if the beacon is locked */
+extern bool EsurlBeaconIsLocked(void);
+
 #endif /* __ESURL_BEACON_SERVICE_H__ */
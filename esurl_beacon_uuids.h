@@ -66,4 +66,13 @@
 #define UUID_ESURL_BEACON_RESET                 0xee0c2089878640baab9699b91ac981d8
 #define UUID_ESURL_BEACON_RADIO_TX_POWER_LEVELS 0xee0c208a878640baab9699b91ac981d8  
 
+/* Betrack extension: whole configuration as a type-length-value blob */
+#define UUID_ESURL_BEACON_CONFIG                0xee0c2090878640baab9699b91ac981d8
+
+/* Betrack extension: URL as plain text, encoded by the firmware */
+#define UUID_ESURL_BEACON_URL                   0xee0c2091878640baab9699b91ac981d8
+
+/* Betrack extension: commit the configuration and return to beaconing */
+#define UUID_ESURL_BEACON_COMMIT                0xee0c2092878640baab9699b91ac981d8
+
 #endif /* __ESURL_BEACON_UUIDS_H__ */
@@ -43,23 +43,30 @@
  *  Public Definitions
  *============================================================================*/
 
-/* Advertising parameters. Time is expressed in microseconds and the firmware
- * will round this down to the nearest slot. Acceptable range is 20ms to 10.24s
- * and the minimum must be no larger than the maximum. This value needs to be 
- * modified at a later stage as decided GPA for specific profile.
- *
- * For the GATT Server application, use 60ms as the fast connection
- * advertisement interval. For reduced power connections the recommended range
- * is 1s to 2.5s. Vendors will need to tune these values as per their
- * requirements.
+/* Connectable advertising schedule. Advertising steps through these tiers,
+ * each advertising at its interval for its duration, and the device returns
+ * to beaconing at the end of the last tier. Phones connect fastest in the
+ * first seconds, so the schedule starts fast and backs off. Time is
+ * expressed in microseconds and the firmware will round the interval down to
+ * the nearest slot. Acceptable interval range is 20ms to 10.24s. Vendors will
+ * need to tune these values as per their requirements.
+ */
+#define ADVERT_TIER_0_INTERVAL              (20 * MILLISECOND)
+#define ADVERT_TIER_0_DURATION              (5 * SECOND)
+#define ADVERT_TIER_1_INTERVAL              (150 * MILLISECOND)
+#define ADVERT_TIER_1_DURATION              (30 * SECOND)
+#define ADVERT_TIER_2_INTERVAL              (1000 * MILLISECOND)
+#define ADVERT_TIER_2_DURATION              (2 * MINUTE)
+
+/* Maximum number of connection parameter update requests that can be sent in
+ * each phase of the connection parameter policy
  */
-#define FC_ADVERTISING_INTERVAL_MIN         (1000 * MILLISECOND)
-#define FC_ADVERTISING_INTERVAL_MAX         (100000 * MILLISECOND)
+#define CONN_PARAM_MAX_ATTEMPTS             (2)
 
-/* Maximum number of connection parameter update requests that can be sent when 
- * connected
+/* Time without attribute access after which the connection parameter policy
+ * moves from the fast to the slow connection parameters
  */
-#define MAX_NUM_CONN_PARAM_UPDATE_REQS      (2)
+#define CONN_PARAM_QUIET_PERIOD             (10 * SECOND)
 
 /* Brackets should not be used around the values of these macros. This file is
  * imported by the GATT Database Generator (gattdbgen) which does not understand 
@@ -80,4 +87,10 @@
 /* Supervision timeout (ms) = PREFERRED_SUPERVISION_TIMEOUT * 10 ms */
 #define PREFERRED_SUPERVISION_TIMEOUT       0x03E8 /* 10 seconds */
 
+/* Connection parameters requested while a client is configuring the device */
+#define FAST_MIN_CON_INTERVAL               0x000C /* 15 ms */
+#define FAST_MAX_CON_INTERVAL               0x0018 /* 30 ms */
+#define FAST_SLAVE_LATENCY                  0x0000
+#define FAST_SUPERVISION_TIMEOUT            0x01F4 /* 5 seconds */
+
 #endif /* __GAP_CONN_PARAMS_H__ */
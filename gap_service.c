@@ -66,8 +66,8 @@ typedef struct _GAP_DATA_T
     /* Pointer to hold device name used by the application */
     uint8   *p_dev_name;
 
-    /* NVM offset at which GAP Service data is stored */
-    uint16  nvm_offset;
+    /* NVM record holding the device name */
+    NVM_RECORD_T nvm_record;
 
 } GAP_DATA_T;
 
@@ -79,26 +79,14 @@ typedef struct _GAP_DATA_T
 static GAP_DATA_T g_gap_data;
 
 /* Default device name - added two for storing AD Type and Null ('\0') */ 
-static uint8 g_device_name[DEVICE_NAME_MAX_LENGTH + 2] = {
+static const uint8 g_default_device_name[DEVICE_NAME_MAX_LENGTH + 2] = {
     AD_TYPE_LOCAL_NAME_COMPLETE, 
     'E', 'S', ' ', 'C', 'o', 'n', 'f', 'i', 'g', ' ', 'U', 'R', 'L', '\0'};
 
-/*============================================================================*
- *  Private Definitions
- *============================================================================*/
-
-/* Number of words of NVM memory used by the GAP Service */
-
-/* Add space for Device Name Length and Device Name */
-#define GAP_SERVICE_NVM_MEMORY_WORDS  (DEVICE_NAME_MAX_LENGTH + 2)
-
-/* The offset of data being stored in NVM for the GAP Service. This offset is 
- * added to the GAP Service offset in the NVM region (see g_gap_data.nvm_offset) 
- * to get the absolute offset at which this data is stored in NVM.
+/* Device name in use, including the AD Type and Null ('\0'). This is also the
+ * RAM image of the GAP Service NVM record.
  */
-#define GAP_NVM_DEVICE_LENGTH_OFFSET  (0)
-
-#define GAP_NVM_DEVICE_NAME_OFFSET    (1)
+static uint8 g_device_name[DEVICE_NAME_MAX_LENGTH + 2];
 
 /*============================================================================*
  *  Private Function Prototypes
@@ -130,20 +118,8 @@ static void updateDeviceName(uint16 length, uint8 *name);
  *----------------------------------------------------------------------------*/
 static void gapWriteDeviceNameToNvm(void)
 {
-
-    /* Write device name length to NVM */
-    Nvm_Write(&g_gap_data.length, sizeof(g_gap_data.length), 
-              g_gap_data.nvm_offset + 
-              GAP_NVM_DEVICE_LENGTH_OFFSET);
-
-    /* Write device name to NVM 
-     * Typecasting uint8 to uint16 or vice-versa does not have any side effects
-     * as both types (uint8 and uint16) take one word of memory on the XAP
-     */
-    Nvm_Write((uint16*)g_gap_data.p_dev_name, g_gap_data.length, 
-              g_gap_data.nvm_offset + 
-              GAP_NVM_DEVICE_NAME_OFFSET);
-
+    /* Write device name to NVM */
+    Nvm_WriteRecord(&g_gap_data.nvm_record);
 }
 
 /*----------------------------------------------------------------------------*
@@ -178,8 +154,14 @@ static void updateDeviceName(uint16 length, uint8 *name)
     /* Null terminate the device name string */
     p_name[g_gap_data.length] = '\0';
 
-    /* Write updated device name to NVM */
-    gapWriteDeviceNameToNvm();
+    /* The name is part of the connectable advertisements */
+    GattInvalidateAdvertData();
+
+    /* Queue the updated device name to be written to NVM. The new name is
+     * in use straight away, the write happens once the configuration session
+     * goes idle.
+     */
+    Nvm_WriteRecordDeferred(&g_gap_data.nvm_record);
 
 }
 
@@ -307,37 +289,33 @@ extern void GapHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
  *      This function is used to read GAP Service specific data stored in NVM.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to GAP Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void GapReadDataFromNVM(uint16 *p_offset)
+extern void GapReadDataFromNVM(void)
 {
-
-    g_gap_data.nvm_offset = *p_offset;
-
-    /* Read Device Length */
-    Nvm_Read(&g_gap_data.length, sizeof(g_gap_data.length), 
-             *p_offset + 
-             GAP_NVM_DEVICE_LENGTH_OFFSET);
-
-    /* Read Device Name
-     * Typecasting uint8 to uint16 or vice-versa does not have any side effects
+    /* Typecasting uint8 to uint16 or vice-versa does not have any side effects
      * as both types (uint8 and uint16) take one word of memory on the XAP
      */
-    Nvm_Read((uint16*)g_gap_data.p_dev_name, g_gap_data.length, 
-             *p_offset + 
-             GAP_NVM_DEVICE_NAME_OFFSET);
+    Nvm_InitRecord(&g_gap_data.nvm_record, nvm_partition_gap,
+                   (uint16*)g_device_name, DEVICE_NAME_MAX_LENGTH + 2);
 
-    /* Add NUL character to terminate the device name string */
-    g_gap_data.p_dev_name[g_gap_data.length] = '\0';
+    if(Nvm_ReadRecord(&g_gap_data.nvm_record))
+    {
+        /* Add NUL character to terminate the device name string */
+        g_device_name[DEVICE_NAME_MAX_LENGTH + 1] = '\0';
+    }
+    else
+    {
+        /* Neither copy is valid, restore the default device name */
+        MemCopy(g_device_name, g_default_device_name,
+                sizeof(g_default_device_name));
+        gapWriteDeviceNameToNvm();
+    }
 
-    /* Increase NVM offset for maximum device name length. Add 1 for
-     * 'device name length' field as well
-     */
-    *p_offset += DEVICE_NAME_MAX_LENGTH + 1;
+    GapDataInit();
 
 }
 
@@ -350,46 +328,27 @@ extern void GapReadDataFromNVM(uint16 *p_offset)
  *      first time during application initialisation.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to GAP Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void GapInitWriteDataToNVM(uint16 *p_offset)
+extern void GapInitWriteDataToNVM(void)
 {
 
-    /* The NVM offset at which GAP Service data will be stored */
-    g_gap_data.nvm_offset = *p_offset;
+    /* GAP Service data is stored in its own NVM partition */
+    Nvm_InitRecord(&g_gap_data.nvm_record, nvm_partition_gap,
+                   (uint16*)g_device_name, DEVICE_NAME_MAX_LENGTH + 2);
+
+    /* Start from the default device name */
+    MemCopy(g_device_name, g_default_device_name,
+            sizeof(g_default_device_name));
+    GapDataInit();
 
     /* Write device name to NVM */
     gapWriteDeviceNameToNvm();
 
-    /* Increase NVM offset for maximum device name length. Add 1 for
-     * 'device name length' field as well
-     */
-    *p_offset += DEVICE_NAME_MAX_LENGTH + 1;
-
-}
 
-/*----------------------------------------------------------------------------*
- *  NAME
- *      GapCheckHandleRange
- *
- *  DESCRIPTION
- *      This function is used to check if the handle belongs to the GAP Service.
- *
- *  PARAMETERS
- *      handle [in]             Handle to check
- *
- *  RETURNS
- *      TRUE if handle belongs to the GAP Service, FALSE otherwise
- *----------------------------------------------------------------------------*/
-extern bool GapCheckHandleRange(uint16 handle)
-{
-    return ((handle >= HANDLE_GAP_SERVICE) &&
-            (handle <= HANDLE_GAP_SERVICE_END))
-            ? TRUE : FALSE;
 }
 
 /*----------------------------------------------------------------------------*
@@ -70,15 +70,12 @@ extern void GapHandleAccessRead(GATT_ACCESS_IND_T *p_ind);
 extern void GapHandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
 
 /* Read the GAP Service specific data stored in NVM */
-extern void GapReadDataFromNVM(uint16 *p_offset);
+extern void GapReadDataFromNVM(void);
 
 /* Write GAP Service specific data to NVM for the first time during
  * application initialisation
  */
-extern void GapInitWriteDataToNVM(uint16 *p_offset);
-
-/* Check if the handle belongs to the GAP Service */
-extern bool GapCheckHandleRange(uint16 handle);
+extern void GapInitWriteDataToNVM(void);
 
 /* Get the reference to the 'g_device_name' array, which contains AD Type and
  * device name
@@ -49,6 +49,7 @@
 #include <gatt.h>           /* GATT application interface */
 #include <gatt_uuid.h>      /* Common Bluetooth UUIDs and macros */
 #include <timer.h>          /* Chip timer functions */
+#include <mem.h>            /* Memory library */
 
 /*============================================================================*
  *  Local Header Files
@@ -63,11 +64,14 @@
 #include "battery_service.h"  /* Battery Service interface */
 #include "temperature_service.h"  /* Battery Service interface */
 #include "esurl_beacon_service.h"/* Beacon2 Service interface */
+#include "telemetry_service.h"  /* Telemetry Service interface */
+#include "schedule_service.h"  /* Schedule Service interface */
 #include "esurl_beacon_uuids.h"  /* Battery Service UUIDs */
 #include "battery_uuids.h"    /* Battery Service UUIDs */
 #include "dev_info_uuids.h"   /* Device Information Service UUIDs */
 #include "dev_info_service.h" /* Device Information Service interface */
 #include "debug_interface.h"  /* Debug serial-port for adding print statements */
+#include "user_config.h"      /* User configuration */
 
 /*============================================================================*
  *  Private Definitions
@@ -86,6 +90,11 @@
 /* Length of Tx Power prefixed with 'Tx Power' AD Type */
 #define TX_POWER_VALUE_LENGTH                             (2)
 
+/* Longest attribute value which can be written with a queued (prepared)
+ * write, in octets
+ */
+#define GATT_LONG_WRITE_MAX                               (64)
+
 /*============================================================================*
  *  Private Data types
  *============================================================================*/
@@ -107,8 +116,75 @@ typedef struct _APP_GATT_DATA_T
      */
     uint32                     advert_timer_value;
 
+    /* Index into g_advert_tiers[] of the current advertising tier */
+    uint16                     advert_tier;
+
 } APP_GATT_DATA_T;
 
+/* Tier of the connectable advertising schedule */
+typedef struct _GATT_ADVERT_TIER_T
+{
+    /* Advertising interval, microseconds */
+    uint32 interval;
+
+    /* Time spent advertising in this tier, microseconds */
+    uint32 duration;
+
+} GATT_ADVERT_TIER_T;
+
+/* Attribute access handlers of a service */
+typedef struct _GATT_SERVICE_T
+{
+    /* First and last attribute handles of the service */
+    uint16 start_handle;
+    uint16 end_handle;
+
+    /* Handlers for read and write access, or NULL if the service does not
+     * support the operation
+     */
+    void (*read)(GATT_ACCESS_IND_T *p_ind);
+    void (*write)(GATT_ACCESS_IND_T *p_ind);
+
+} GATT_SERVICE_T;
+
+/* Value of an attribute being written with a queued (prepared) write */
+typedef struct _GATT_LONG_WRITE_T
+{
+    /* Attribute of the Prepare Write Requests queued so far, or
+     * INVALID_ATT_HANDLE if none is queued
+     */
+    uint16 prepare_handle;
+
+    /* Attribute being written, or INVALID_ATT_HANDLE if there is none */
+    uint16 handle;
+
+    /* Number of octets received so far */
+    uint16 length;
+
+    /* Value received so far */
+    uint8 value[GATT_LONG_WRITE_MAX];
+
+} GATT_LONG_WRITE_T;
+
+/* Compiled connectable advertising and scan response data. Each image holds
+ * the AD structures in over the air form: a length octet followed by the AD
+ * Type and data. The AD Flags are added by the GAP layer.
+ */
+typedef struct _GATT_ADV_IMAGE_T
+{
+    /* TRUE once the images have been compiled for the current device name */
+    bool valid;
+
+    /* Advertising data image and its length */
+    uint8 adv[MAX_ADV_DATA_LEN];
+    uint16 adv_len;
+
+    /* Scan response data image and its length */
+    uint8 scan[MAX_ADV_DATA_LEN];
+    uint16 scan_len;
+
+} GATT_ADV_IMAGE_T;
+
 /*============================================================================*
  *  Private Data 
  *============================================================================*/
@@ -116,6 +192,53 @@ typedef struct _APP_GATT_DATA_T
 /* Application GATT data instance */
 static APP_GATT_DATA_T g_gatt_data;
 
+/* Connectable advertising schedule, see gap_conn_params.h */
+static const GATT_ADVERT_TIER_T g_advert_tiers[] =
+{
+    {ADVERT_TIER_0_INTERVAL, ADVERT_TIER_0_DURATION},
+    {ADVERT_TIER_1_INTERVAL, ADVERT_TIER_1_DURATION},
+    {ADVERT_TIER_2_INTERVAL, ADVERT_TIER_2_DURATION}
+};
+
+/* Number of tiers in the advertising schedule */
+#define GATT_NUM_ADVERT_TIERS \
+    (sizeof(g_advert_tiers) / sizeof(g_advert_tiers[0]))
+
+/* Services whose attributes are handled by the application. The handle ranges
+ * are generated from the service .db files into app_gatt_db.h; a new service
+ * only needs an entry here.
+ */
+static const GATT_SERVICE_T g_gatt_services[] =
+{
+    {HANDLE_GAP_SERVICE,            HANDLE_GAP_SERVICE_END,
+     GapHandleAccessRead,           GapHandleAccessWrite},
+
+    {HANDLE_DEVICE_INFO_SERVICE,    HANDLE_DEVICE_INFO_SERVICE_END,
+     DeviceInfoHandleAccessRead,    NULL},
+
+    {HANDLE_BATTERY_SERVICE,        HANDLE_BATTERY_SERVICE_END,
+     BatteryHandleAccessRead,       BatteryHandleAccessWrite},
+
+    {HANDLE_ESURL_BEACON_SERVICE,   HANDLE_ESURL_BEACON_SERVICE_END,
+     EsurlBeaconHandleAccessRead,   EsurlBeaconHandleAccessWrite},
+
+    {HANDLE_TELEMETRY_SERVICE,      HANDLE_TELEMETRY_SERVICE_END,
+     TelemetryHandleAccessRead,     TelemetryHandleAccessWrite},
+
+    {HANDLE_SCHEDULE_SERVICE,       HANDLE_SCHEDULE_SERVICE_END,
+     ScheduleHandleAccessRead,      ScheduleHandleAccessWrite}
+};
+
+/* Number of entries in g_gatt_services[] */
+#define GATT_NUM_SERVICES \
+    (sizeof(g_gatt_services) / sizeof(g_gatt_services[0]))
+
+/* Queued write being received */
+static GATT_LONG_WRITE_T g_gatt_long_write;
+
+/* Compiled connectable advertising data */
+static GATT_ADV_IMAGE_T g_gatt_adv_image;
+
 /*============================================================================*
  *  Private Function Prototypes
  *============================================================================*/
@@ -124,7 +247,28 @@ static APP_GATT_DATA_T g_gatt_data;
 static void addDeviceNameToAdvData(uint16 adv_data_len, uint16 scan_data_len);
 
 /* Set advertisement parameters */
-static void gattSetAdvertParams(TYPED_BD_ADDR_T* p_addr, bool fast_connection);
+static void gattSetAdvertParams(void);
+
+/* Append an AD structure to the advertising or scan response image */
+static void gattAddToAdvImage(uint16 length, uint8 *p_data, ad_src src);
+
+/* Compile the advertising and scan response images */
+static void gattCompileAdvImage(void);
+
+/* Give the stack the AD structures of a compiled image */
+static void gattReplayAdvImage(uint8 *p_image, uint16 image_len, ad_src src);
+
+#ifdef ENABLE_DIRECTED_ADVERTS
+/* Start a burst of directed advertisements to the bonded host */
+static void gattStartDirectedAdverts(TYPED_BD_ADDR_T *p_addr);
+#endif /* ENABLE_DIRECTED_ADVERTS */
+
+/* Find the service which owns an attribute handle */
+static const GATT_SERVICE_T *gattFindService(uint16 handle);
+
+/* Handle one part of a queued write */
+static void gattHandleLongWrite(GATT_ACCESS_IND_T *p_ind,
+                                const GATT_SERVICE_T *p_service);
 
 /*============================================================================*
  *  Private Function Implementations
@@ -173,22 +317,16 @@ static void addDeviceNameToAdvData(uint16 adv_data_len, uint16 scan_data_len)
     if((device_name_adtype_len + 1) <= (MAX_ADV_DATA_LEN - adv_data_len))
     {
         /* Add Complete Device Name to Advertisement Data */
-        if (LsStoreAdvScanData(device_name_adtype_len, p_device_name, 
-                      ad_src_advertise) != ls_err_none)
-        {
-            ReportPanic(app_panic_set_advert_data);
-        }
+        gattAddToAdvImage(device_name_adtype_len, p_device_name, 
+                      ad_src_advertise);
 
     }
     /* Check if Complete Device Name can fit in Scan response message */
     else if((device_name_adtype_len + 1) <= (MAX_ADV_DATA_LEN - scan_data_len)) 
     {
         /* Add Complete Device Name to Scan Response Data */
-        if (LsStoreAdvScanData(device_name_adtype_len, p_device_name, 
-                      ad_src_scan_rsp) != ls_err_none)
-        {
-            ReportPanic(app_panic_set_scan_rsp_data);
-        }
+        gattAddToAdvImage(device_name_adtype_len, p_device_name, 
+                      ad_src_scan_rsp);
 
     }
     /* Check if Shortened Device Name can fit in remaining advertisement 
@@ -202,24 +340,20 @@ static void addDeviceNameToAdvData(uint16 adv_data_len, uint16 scan_data_len)
         /* Add shortened device name to Advertisement data */
         p_device_name[0] = AD_TYPE_LOCAL_NAME_SHORT;
 
-       if (LsStoreAdvScanData(SHORTENED_DEV_NAME_LEN, p_device_name, 
-                      ad_src_advertise) != ls_err_none)
-        {
-            ReportPanic(app_panic_set_advert_data);
-        }
+       gattAddToAdvImage(SHORTENED_DEV_NAME_LEN, p_device_name, 
+                      ad_src_advertise);
 
     }
     else /* Add device name to remaining Scan response data space */
     {
-        /* Add as much as can be stored in Scan Response data */
+        /* Add as much as can be stored in Scan Response data, leaving one
+         * octet for the Length field
+         */
         p_device_name[0] = AD_TYPE_LOCAL_NAME_SHORT;
 
-       if (LsStoreAdvScanData(MAX_ADV_DATA_LEN - scan_data_len, 
+       gattAddToAdvImage(MAX_ADV_DATA_LEN - scan_data_len - 1, 
                                     p_device_name, 
-                                    ad_src_scan_rsp) != ls_err_none)
-        {
-            ReportPanic(app_panic_set_scan_rsp_data);
-        }
+                                    ad_src_scan_rsp);
 
     }
 
@@ -230,23 +364,126 @@ static void addDeviceNameToAdvData(uint16 adv_data_len, uint16 scan_data_len)
  *      gattSetAdvertParams
  *
  *  DESCRIPTION
- *      This function is used to set advertisement parameters.
+ *      This function is used to set advertisement parameters for the current
+ *      tier of the advertising schedule.
  *
  *  PARAMETERS
- *      p_addr [in]             Bonded host address
- *      fast_connection [in]    TRUE:  Fast advertisements
- *                              FALSE: Slow advertisements
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void gattSetAdvertParams(void)
+{
+    /* Advertisement interval, microseconds */
+    uint32 adv_interval =
+                    g_advert_tiers[g_gatt_data.advert_tier].interval;
+
+    if((GapSetMode(gap_role_peripheral, gap_mode_discover_general,
+                        gap_mode_connect_undirected, 
+                        gap_mode_bond_yes,
+                        gap_mode_security_unauthenticate) != ls_err_none) ||
+       (GapSetAdvInterval(adv_interval, adv_interval) 
+                        != ls_err_none))
+    {
+        ReportPanic(app_panic_set_advert_params);
+    }
+
+    /* Add bonded devices to white list.*/
+    if(IsWhiteListEnabled())
+    {
+        /* Initial case when advertisements are started for Bonded hosts for 
+         * 10 seconds. White list is configured with the Bonded host addresses
+         */
+        AddBondedHostsToWhiteList();
+    }
+
+    /* Change the Radio tx params for CONFIG mode. The adv tx power is part of
+     * the advertising image.
+     */
+    
+    /* Update the radio tx power level here */
+    LsSetTransmitPowerLevel(RADIO_TX_POWER_CONFIG); 
+    
+    /* NOTE: The tx params are reset to the tx_power_mode on disconnection */
+
+    /* The advertising and scan response data only change with the device
+     * name, so they are compiled once and replayed on every start
+     */
+    if(!g_gatt_adv_image.valid)
+    {
+        gattCompileAdvImage();
+    }
+
+    gattReplayAdvImage(g_gatt_adv_image.adv, g_gatt_adv_image.adv_len,
+                       ad_src_advertise);
+    gattReplayAdvImage(g_gatt_adv_image.scan, g_gatt_adv_image.scan_len,
+                       ad_src_scan_rsp);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      gattAddToAdvImage
+ *
+ *  DESCRIPTION
+ *      This function appends an AD structure to the advertising or scan
+ *      response image. The structure is stored behind its length, as it will
+ *      be sent over the air.
+ *
+ *  PARAMETERS
+ *      length [in]             Length of the AD structure, including AD Type
+ *      p_data [in]             AD Type followed by the AD data
+ *      src [in]                Advertising or scan response image
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-static void gattSetAdvertParams(TYPED_BD_ADDR_T *p_addr, bool fast_connection)
+static void gattAddToAdvImage(uint16 length, uint8 *p_data, ad_src src)
+{
+    uint8 *p_image;
+    uint16 *p_image_len;
+
+    if(src == ad_src_advertise)
+    {
+        p_image = g_gatt_adv_image.adv;
+        p_image_len = &g_gatt_adv_image.adv_len;
+    }
+    else
+    {
+        p_image = g_gatt_adv_image.scan;
+        p_image_len = &g_gatt_adv_image.scan_len;
+    }
+
+    if(*p_image_len + length + 1 > MAX_ADV_DATA_LEN)
+    {
+        ReportPanic(src == ad_src_advertise ? app_panic_set_advert_data :
+                                              app_panic_set_scan_rsp_data);
+    }
+
+    p_image[(*p_image_len) ++] = (uint8)length;
+    MemCopy(&p_image[*p_image_len], p_data, length);
+    *p_image_len += length;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      gattCompileAdvImage
+ *
+ *  DESCRIPTION
+ *      This function compiles the connectable advertising and scan response
+ *      images from the supported services, the appearance, the tx power and
+ *      the device name.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void gattCompileAdvImage(void)
 {
     uint8 advert_data[MAX_ADV_DATA_LEN];/* Advertisement packet */
     uint16 length;                      /* Length of advertisement packet */
-    /* Advertisement interval, microseconds */
-    uint32 adv_interval_min;
-    uint32 adv_interval_max;
 
     /* Tx power level value prefixed with 'Tx Power' AD Type */
     /* Refer to BT4.0 specification, Vol3-part-C-Section-11.1.5 */ 
@@ -271,96 +508,269 @@ static void gattSetAdvertParams(TYPED_BD_ADDR_T *p_addr, bool fast_connection)
      */
     uint16 length_added_to_adv = 3;
 
-    if(fast_connection)
+    g_gatt_adv_image.adv_len = 0;
+    g_gatt_adv_image.scan_len = 0;
+
+    /* Add UUID list of the services supported by the device */
+    length = GetSupportedUUIDServiceList(advert_data);
+
+    /* One added for Length field, which will be added to Adv Data by GAP 
+     * layer 
+     */
+    length_added_to_adv += (length + 1);
+
+    gattAddToAdvImage(length, advert_data, ad_src_advertise);
+
+    /* One added for Length field, which will be added to Adv Data by GAP 
+     * layer 
+     */
+    length_added_to_adv += (sizeof(device_appearance) + 1);
+
+    /* Add device appearance to the advertisements */
+    gattAddToAdvImage(ATTR_LEN_DEVICE_APPEARANCE + 1, device_appearance,
+                      ad_src_advertise);
+
+    /* Advertise the tx power of CONFIG mode */
+    device_tx_power[TX_POWER_VALUE_LENGTH - 1] = ADV_TX_POWER_CONFIG;
+
+    /* One added for Length field, it will be added to Adv Data by GAP layer */
+    length_added_to_adv += (TX_POWER_VALUE_LENGTH + 1);
+
+    /* Add tx power value of device to the advertising data */
+    gattAddToAdvImage(TX_POWER_VALUE_LENGTH, device_tx_power,
+                      ad_src_advertise);
+
+    addDeviceNameToAdvData(length_added_to_adv, 0);
+
+    g_gatt_adv_image.valid = TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      gattReplayAdvImage
+ *
+ *  DESCRIPTION
+ *      This function replaces the advertising or scan response data held by
+ *      the stack with the AD structures of a compiled image.
+ *
+ *  PARAMETERS
+ *      p_image [in]            Compiled image
+ *      image_len [in]          Length of the image
+ *      src [in]                Advertising or scan response data
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void gattReplayAdvImage(uint8 *p_image, uint16 image_len, ad_src src)
+{
+    uint16 offset = 0;
+    uint16 length;
+    ls_err result;
+
+    /* Reset existing data */
+    result = LsStoreAdvScanData(0, NULL, src);
+
+    while(offset < image_len && result == ls_err_none)
     {
-        adv_interval_min = FC_ADVERTISING_INTERVAL_MIN;
-        adv_interval_max = FC_ADVERTISING_INTERVAL_MAX;
+        length = p_image[offset ++];
+        result = LsStoreAdvScanData(length, &p_image[offset], src);
+        offset += length;
     }
 
-    if((GapSetMode(gap_role_peripheral, gap_mode_discover_general,
-                        gap_mode_connect_undirected, 
-                        gap_mode_bond_yes,
-                        gap_mode_security_unauthenticate) != ls_err_none) ||
-       (GapSetAdvInterval(adv_interval_min, adv_interval_max) 
-                        != ls_err_none))
+    if(result != ls_err_none)
     {
-        ReportPanic(app_panic_set_advert_params);
+        ReportPanic(src == ad_src_advertise ? app_panic_set_advert_data :
+                                              app_panic_set_scan_rsp_data);
     }
+}
 
-    /* Add bonded device to white list.*/
-    if(IsWhiteListEnabled())
+#ifdef ENABLE_DIRECTED_ADVERTS
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      gattStartDirectedAdverts
+ *
+ *  DESCRIPTION
+ *      This function starts a burst of high duty cycle directed
+ *      advertisements to the bonded host. The controller ends the burst after
+ *      1.28 seconds if the host has not connected, and the resulting
+ *      GATT_CONNECT_CFM failure starts the undirected advertisements.
+ *
+ *  PARAMETERS
+ *      p_addr [in]             Bonded host address
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void gattStartDirectedAdverts(TYPED_BD_ADDR_T *p_addr)
+{
+#ifdef USE_STATIC_RANDOM_ADDRESS
+    uint16 connect_flags = L2CAP_CONNECTION_SLAVE_DIRECTED | 
+                           L2CAP_OWN_ADDR_TYPE_RANDOM;
+#else
+    uint16 connect_flags = L2CAP_CONNECTION_SLAVE_DIRECTED | 
+                           L2CAP_OWN_ADDR_TYPE_PUBLIC;
+#endif /* USE_STATIC_RANDOM_ADDRESS */
+
+    if(p_addr->type == L2CA_RANDOM_ADDR_TYPE)
     {
-        /* Initial case when advertisements are started for Bonded host for 
-         * 10 seconds. White list is configured with the Bonded host address
-         */
-        if(LsAddWhiteListDevice(p_addr)!= ls_err_none)
-        {
-            ReportPanic(app_panic_add_whitelist);
-        }
+        connect_flags |= L2CAP_PEER_ADDR_TYPE_RANDOM;
+    }
+    else
+    {
+        connect_flags |= L2CAP_PEER_ADDR_TYPE_PUBLIC;
     }
 
-    /* Reset existing advertising data */
-    if(LsStoreAdvScanData(0, NULL, ad_src_advertise) != ls_err_none)
+    if(GapSetMode(gap_role_peripheral, gap_mode_discover_no,
+                        gap_mode_connect_directed, 
+                        gap_mode_bond_yes,
+                        gap_mode_security_unauthenticate) != ls_err_none)
     {
-        ReportPanic(app_panic_set_advert_data);
+        ReportPanic(app_panic_set_advert_params);
     }
 
-    /* Reset existing scan response data */
-    if(LsStoreAdvScanData(0, NULL, ad_src_scan_rsp) != ls_err_none)
+    /* Start GATT connection in Slave role. The burst is bounded by the
+     * controller, so the advertisement timer is not started.
+     */
+    GattConnectReq(p_addr, connect_flags);
+}
+#endif /* ENABLE_DIRECTED_ADVERTS */
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      gattFindService
+ *
+ *  DESCRIPTION
+ *      This function returns the service which owns an attribute handle,
+ *      searching the handle ranges of g_gatt_services[].
+ *
+ *  PARAMETERS
+ *      handle [in]             Attribute handle
+ *
+ *  RETURNS
+ *      Service owning the handle, or NULL if the handle is not handled by the
+ *      application
+ *----------------------------------------------------------------------------*/
+static const GATT_SERVICE_T *gattFindService(uint16 handle)
+{
+    uint16 i;
+
+    for(i = 0; i < GATT_NUM_SERVICES; i++)
     {
-        ReportPanic(app_panic_set_scan_rsp_data);
+        if(handle >= g_gatt_services[i].start_handle &&
+           handle <= g_gatt_services[i].end_handle)
+        {
+            return &g_gatt_services[i];
+        }
     }
 
-    /* Setup ADVERTISEMENT DATA */
+    return NULL;
+}
 
-    /* Add UUID list of the services supported by the device */
-    length = GetSupportedUUIDServiceList(advert_data);
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      gattHandleLongWrite
+ *
+ *  DESCRIPTION
+ *      This function handles one part of a queued (prepared) write. On a
+ *      Prepare Write Request the firmware only asks the application for
+ *      permission; the parts are delivered in order on the Execute Write
+ *      Request, the last one flagged ATT_ACCESS_WRITE_COMPLETE. The parts are
+ *      staged in RAM and the complete value is passed to the service as one
+ *      ordinary write, so services need no knowledge of queued writes.
+ *
+ *      Only one attribute can be written per queued write. A Prepare Write
+ *      Request for a second attribute is refused when it is made, rather
+ *      than the value of the first being lost when the write is executed.
+ *
+ *  PARAMETERS
+ *      p_ind [in]              Data received in GATT_ACCESS_IND message.
+ *      p_service [in]          Service owning the attribute
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void gattHandleLongWrite(GATT_ACCESS_IND_T *p_ind,
+                                const GATT_SERVICE_T *p_service)
+{
+    GATT_ACCESS_IND_T ind;
+    sys_status rc = sys_status_success;
 
-    /* One added for Length field, which will be added to Adv Data by GAP 
-     * layer 
-     */
-    length_added_to_adv += (length + 1);
+    /* A Prepare Write Request only asks for permission */
+    bool prepare = (p_ind->flags & ATT_ACCESS_PERMISSION) &&
+                   !(p_ind->flags & ATT_ACCESS_WRITE_COMPLETE);
 
-    if (LsStoreAdvScanData(length, advert_data, 
-                        ad_src_advertise) != ls_err_none)
+    if(p_ind->offset > GATT_LONG_WRITE_MAX ||
+       p_ind->size_value > GATT_LONG_WRITE_MAX - p_ind->offset)
+    {
+        /* The value would not fit in the staging buffer */
+        rc = gatt_status_invalid_length;
+    }
+    else if(prepare)
+    {
+        /* Nothing to store until the write is executed, but the queue may
+         * only hold parts of one attribute
+         */
+        if(g_gatt_long_write.prepare_handle == INVALID_ATT_HANDLE)
+        {
+            g_gatt_long_write.prepare_handle = p_ind->handle;
+        }
+        else if(p_ind->handle != g_gatt_long_write.prepare_handle)
+        {
+            rc = gatt_status_prepare_queue_full;
+        }
+    }
+    else if(p_ind->offset == 0)
+    {
+        /* First part of a new value */
+        g_gatt_long_write.handle = p_ind->handle;
+        g_gatt_long_write.length = 0;
+    }
+    else if(p_ind->handle != g_gatt_long_write.handle ||
+            p_ind->offset != g_gatt_long_write.length)
     {
-        ReportPanic(app_panic_set_advert_data);
+        /* Parts must follow on from each other */
+        g_gatt_long_write.handle = INVALID_ATT_HANDLE;
+        rc = gatt_status_invalid_offset;
     }
 
-    /* One added for Length field, which will be added to Adv Data by GAP 
-     * layer 
-     */
-    length_added_to_adv += (sizeof(device_appearance) + 1);
+    if(!prepare &&
+       (rc != sys_status_success ||
+        (p_ind->flags & ATT_ACCESS_WRITE_COMPLETE)))
+    {
+        /* The queue is being executed, and has ended */
+        g_gatt_long_write.prepare_handle = INVALID_ATT_HANDLE;
+    }
 
-    /* Add device appearance to the advertisements */
-    if (LsStoreAdvScanData(ATTR_LEN_DEVICE_APPEARANCE + 1, 
-        device_appearance, ad_src_advertise) != ls_err_none)
+    if(rc != sys_status_success || prepare)
     {
-        ReportPanic(app_panic_set_advert_data);
+        GattAccessRsp(p_ind->cid, p_ind->handle, rc, 0, NULL);
+        return;
     }
 
-    /* Change the Radio and Adv tx params for CONFIG mode */
-    
-    /* Update the radio tx power level here */
-    LsSetTransmitPowerLevel(RADIO_TX_POWER_CONFIG); 
+    MemCopy(&g_gatt_long_write.value[p_ind->offset], p_ind->value,
+            p_ind->size_value);
+    g_gatt_long_write.length = p_ind->offset + p_ind->size_value;
 
-    /* Update the adv tx power level here */
-    device_tx_power[TX_POWER_VALUE_LENGTH - 1] = ADV_TX_POWER_CONFIG;
-    
-    /* NOTE: The 2 tx params above are reset to the tx_power_mode on disconnection */
+    if(p_ind->flags & ATT_ACCESS_WRITE_COMPLETE)
+    {
+        /* Last part, pass the complete value to the service, which sends
+         * the response
+         */
+        ind = *p_ind;
+        ind.flags = ATT_ACCESS_WRITE | ATT_ACCESS_PERMISSION |
+                    ATT_ACCESS_WRITE_COMPLETE;
+        ind.offset = 0;
+        ind.size_value = g_gatt_long_write.length;
+        ind.value = g_gatt_long_write.value;
 
-    /* One added for Length field, it will be added to Adv Data by GAP layer */
-    length_added_to_adv += (TX_POWER_VALUE_LENGTH + 1);
+        g_gatt_long_write.handle = INVALID_ATT_HANDLE;
 
-    /* Add tx power value of device to the advertising data */
-    if (LsStoreAdvScanData(TX_POWER_VALUE_LENGTH, device_tx_power, 
-                          ad_src_advertise) != ls_err_none)
+        p_service->write(&ind);
+    }
+    else
     {
-        ReportPanic(app_panic_set_advert_data);
+        GattAccessRsp(p_ind->cid, p_ind->handle, rc, 0, NULL);
     }
-
-    addDeviceNameToAdvData(length_added_to_adv, 0);
-
 }
 
 /*============================================================================*
@@ -383,6 +793,32 @@ static void gattSetAdvertParams(TYPED_BD_ADDR_T *p_addr, bool fast_connection)
 extern void InitGattData(void)
 {
     g_gatt_data.advert_timer_value = TIMER_INVALID;
+
+    /* Discard any queued write left over from the last connection */
+    g_gatt_long_write.prepare_handle = INVALID_ATT_HANDLE;
+    g_gatt_long_write.handle = INVALID_ATT_HANDLE;
+    g_gatt_long_write.length = 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      GattInvalidateAdvertData
+ *
+ *  DESCRIPTION
+ *      This function discards the compiled advertising data, so that it is
+ *      compiled again when advertisements are next started. It must be called
+ *      whenever the content of the advertisements, such as the device name,
+ *      changes.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void GattInvalidateAdvertData(void)
+{
+    g_gatt_adv_image.valid = FALSE;
 }
 
 /*----------------------------------------------------------------------------*
@@ -402,30 +838,13 @@ extern void InitGattData(void)
  *----------------------------------------------------------------------------*/
 extern void HandleAccessRead(GATT_ACCESS_IND_T *p_ind)
 {
-    /* For the received attribute handle, check all the services that support 
-     * attribute 'Read' operation handled by application.
-     */
-    /* More services may be added here to support their read operations */
-    if(GapCheckHandleRange(p_ind->handle))
-    {
-        /* Attribute handle belongs to the GAP service */
-        GapHandleAccessRead(p_ind);
-    }
-    else if(DeviceInfoCheckHandleRange(p_ind->handle))
-    {
-        /* Attribute handle belongs to the DEVICE INFORMATION service */
-        DeviceInfoHandleAccessRead(p_ind);
-    }
-    else if(BatteryCheckHandleRange(p_ind->handle))
+    const GATT_SERVICE_T *p_service = gattFindService(p_ind->handle);
+
+    if(p_service != NULL && p_service->read != NULL)
     {
-        /* Attribute handle belongs to BATTERY service */
-        BatteryHandleAccessRead(p_ind);
+        /* Attribute handle belongs to a service supporting 'Read' */
+        p_service->read(p_ind);
     }
-    else if(EsurlBeaconCheckHandleRange (p_ind->handle))
-    {
-        /* Attribute handle belongs to Beacon service */
-        EsurlBeaconHandleAccessRead(p_ind);
-    }    
     else
     {
         /* Application doesn't support 'Read' operation on received attribute
@@ -435,7 +854,6 @@ extern void HandleAccessRead(GATT_ACCESS_IND_T *p_ind)
                       gatt_status_read_not_permitted,
                       0, NULL);
     }
-
 }
 
 /*----------------------------------------------------------------------------*
@@ -445,7 +863,8 @@ extern void HandleAccessRead(GATT_ACCESS_IND_T *p_ind)
  *  DESCRIPTION
  *      This function handles write operations on attributes (as received in 
  *      GATT_ACCESS_IND message) maintained by the application and responds
- *      with the GATT_ACCESS_RSP message.
+ *      with the GATT_ACCESS_RSP message. Queued (prepared) writes are
+ *      assembled here and passed to the service as a single write.
  *
  *  PARAMETERS
  *      p_ind [in]              Data received in GATT_ACCESS_IND message.
@@ -455,25 +874,32 @@ extern void HandleAccessRead(GATT_ACCESS_IND_T *p_ind)
  *----------------------------------------------------------------------------*/
 extern void HandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
 {
-    /* For the received attribute handle, check all the services that support 
-     * attribute 'Write' operation handled by application.
-     */
-    /* More services may be added here to support their write operations */
-    if(GapCheckHandleRange(p_ind->handle))
-    {
-        /* Attribute handle belongs to GAP service */
-        GapHandleAccessWrite(p_ind);
-    }
-    else if(BatteryCheckHandleRange(p_ind->handle))
+    const GATT_SERVICE_T *p_service = gattFindService(p_ind->handle);
+
+    if(p_service != NULL && p_service->write != NULL)
     {
-        /* Attribute handle belongs to BATTERY service */
-        BatteryHandleAccessWrite(p_ind);
+        if(p_ind->flags == (ATT_ACCESS_WRITE | ATT_ACCESS_PERMISSION |
+                            ATT_ACCESS_WRITE_COMPLETE) &&
+           p_ind->offset == 0 &&
+           g_gatt_long_write.handle == INVALID_ATT_HANDLE)
+        {
+            /* A queued write of a single part is executed as a plain
+             * write, which ends the queue
+             */
+            if(p_ind->handle == g_gatt_long_write.prepare_handle)
+            {
+                g_gatt_long_write.prepare_handle = INVALID_ATT_HANDLE;
+            }
+
+            /* Attribute handle belongs to a service supporting 'Write' */
+            p_service->write(p_ind);
+        }
+        else
+        {
+            /* Part of a queued write */
+            gattHandleLongWrite(p_ind, p_service);
+        }
     }
-    else if(EsurlBeaconCheckHandleRange(p_ind->handle))
-    {
-        /* Attribute handle belongs to Beacon service */
-        EsurlBeaconHandleAccessWrite(p_ind);
-    }    
     else
     {
         /* Application doesn't support 'Write' operation on received  attribute
@@ -483,7 +909,6 @@ extern void HandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
                       gatt_status_write_not_permitted,
                       0, NULL);
     }
-
 }
 
 /*----------------------------------------------------------------------------*
@@ -491,23 +916,20 @@ extern void HandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
  *      GattStartAdverts
  *
  *  DESCRIPTION
- *      This function is used to start undirected advertisements and moves to 
- *      ADVERTISING state.
+ *      This function is used to start undirected advertisements in the
+ *      current tier of the advertising schedule.
  *
  *  PARAMETERS
  *      p_addr [in]             Bonded host address
- *      fast_connection [in]    TRUE:  Fast advertisements
- *                              FALSE: Slow advertisements
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void GattStartAdverts(TYPED_BD_ADDR_T *p_addr, bool fast_connection)
+extern void GattStartAdverts(TYPED_BD_ADDR_T *p_addr)
 {
-    /* Variable 'connect_flags' needs to be updated to have peer address type 
-     * if Directed advertisements are supported as peer address type will 
-     * only be used in that case. We don't support directed advertisements for 
-     * this application.
+    /* Variable 'connect_flags' does not need the peer address type, which is
+     * only used by directed advertisements. Those are started by
+     * gattStartDirectedAdverts().
      */
 #ifdef USE_STATIC_RANDOM_ADDRESS
     uint16 connect_flags = L2CAP_CONNECTION_SLAVE_UNDIRECTED | 
@@ -518,7 +940,7 @@ extern void GattStartAdverts(TYPED_BD_ADDR_T *p_addr, bool fast_connection)
 #endif /* USE_STATIC_RANDOM_ADDRESS */
 
     /* Set advertisement parameters */
-    gattSetAdvertParams(p_addr, fast_connection);
+    gattSetAdvertParams();
 
     /* If white list is enabled, set the controller's advertising filter policy 
      * to "process scan and connection requests only from devices in the White 
@@ -620,17 +1042,89 @@ extern bool GattIsAddressResolvableRandom(TYPED_BD_ADDR_T *p_addr)
  *----------------------------------------------------------------------------*/
 extern void GattTriggerFastAdverts(TYPED_BD_ADDR_T *p_addr)
 {
-    if(IsDeviceBonded())
+    /* Start the advertising schedule from its fastest tier. The bonded hosts
+     * are first given a white list phase of their own.
+     */
+    g_gatt_data.advert_tier = 0;
+
+    if(IsWhiteListEnabled())
     {
         g_gatt_data.advert_timer_value = BONDED_DEVICE_ADVERT_TIMEOUT_VALUE;
     }
     else
     {
-        g_gatt_data.advert_timer_value = FAST_CONNECTION_ADVERT_TIMEOUT_VALUE;
+        g_gatt_data.advert_timer_value = g_advert_tiers[0].duration;
     }
 
+#ifdef ENABLE_DIRECTED_ADVERTS
+    /* A bonded host with a fixed address is first given a burst of directed
+     * advertisements, through which it reconnects within milliseconds. A
+     * resolvable random address will have changed since it was stored, so
+     * it cannot be advertised to.
+     */
+    if(IsDeviceBonded() && !GattIsAddressResolvableRandom(p_addr))
+    {
+        gattStartDirectedAdverts(p_addr);
+        return;
+    }
+#endif /* ENABLE_DIRECTED_ADVERTS */
+
     /* Trigger fast connections */
-    GattStartAdverts(p_addr, TRUE);
+    GattStartAdverts(p_addr);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      GattNextAdvertTier
+ *
+ *  DESCRIPTION
+ *      This function moves to the next tier of the advertising schedule once
+ *      the current tier has ended. Advertisements must then be started again
+ *      for the new interval to take effect.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if there is a next tier, FALSE if the schedule has ended
+ *----------------------------------------------------------------------------*/
+extern bool GattNextAdvertTier(void)
+{
+    if(g_gatt_data.advert_tier + 1 >= GATT_NUM_ADVERT_TIERS)
+    {
+        return FALSE;
+    }
+
+    ++ g_gatt_data.advert_tier;
+    g_gatt_data.advert_timer_value =
+                    g_advert_tiers[g_gatt_data.advert_tier].duration;
+
+    return TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      GattTriggerConfigWindow
+ *
+ *  DESCRIPTION
+ *      This function is used to trigger fast advertisements for a
+ *      configuration window, which is not followed by any further phase of
+ *      advertisements.
+ *
+ *  PARAMETERS
+ *      p_addr [in]             Bonded host address
+ *      window_length [in]      Length of the window, microseconds
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void GattTriggerConfigWindow(TYPED_BD_ADDR_T *p_addr,
+                                    uint32 window_length)
+{
+    g_gatt_data.advert_tier = 0;
+    g_gatt_data.advert_timer_value = window_length;
+
+    GattStartAdverts(p_addr);
 }
 
 /*----------------------------------------------------------------------------*
@@ -654,12 +1148,12 @@ extern void GattStopAdverts(void)
         {
             if(IsWhiteListEnabled())
             {
-                /* Set advertisement timer for remaining 20 seconds for fast
-                 * connections without any device in the white list.
+                /* The white list phase has ended. Set advertisement timer for
+                 * the first tier of the schedule without any device in the
+                 * white list.
                  */
-                g_gatt_data.advert_timer_value = 
-                                FAST_CONNECTION_ADVERT_TIMEOUT_VALUE - 
-                                BONDED_DEVICE_ADVERT_TIMEOUT_VALUE;
+                g_gatt_data.advert_timer_value =
+                                g_advert_tiers[g_gatt_data.advert_tier].duration;
             }
 
             /* Stop on-going advertisements */
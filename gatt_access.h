@@ -51,9 +51,10 @@
  *  Public Definitions
  *============================================================================*/
 
-/* Timeout values for advertisements */
+/* Length of the white list phase for bonded hosts, which precedes the
+ * advertising schedule in gap_conn_params.h
+ */
 #define BONDED_DEVICE_ADVERT_TIMEOUT_VALUE       (5 * SECOND)
-#define FAST_CONNECTION_ADVERT_TIMEOUT_VALUE     (10 * SECOND)
 
 /*============================================================================*
  *  Public Data Types
@@ -78,7 +79,12 @@ typedef enum
     app_state_disconnecting,
 
     /* Application is neither advertising nor connected to a host */
-    app_state_idle
+    app_state_idle,
+
+    /* Beaconing is turned off or the battery is critical. The application
+     * sleeps until the button is pressed or the battery recovers.
+     */
+    app_state_dormant
 
 } app_state;
 
@@ -95,12 +101,11 @@ typedef enum
 /* AD Type for Appearance */
 #define AD_TYPE_APPEARANCE                   (0x19)
 
-/* Maximum Length of Device Name 
- * Note: Do not increase device name length beyond (DEFAULT_ATT_MTU - 3 = 20) 
- * octets as the GAP service doesn't support handling of Prepare write and
- * Execute write procedures.
+/* Maximum Length of Device Name. A name longer than (DEFAULT_ATT_MTU - 3 = 20)
+ * octets is written with a queued (prepared) write. This is the longest name
+ * which fits in the scan response as a Complete Local Name.
  */
-#define DEVICE_NAME_MAX_LENGTH               (20)
+#define DEVICE_NAME_MAX_LENGTH               (29)
 
 /* The following macro definition should be included only if a user wants the
  * application to have a static random address.
@@ -160,8 +165,14 @@ typedef enum
     /* Event received in an unexpected application state */
     app_panic_invalid_state,
 
-    /* Unexpected beep type */
-    app_panic_unexpected_beep_type
+    /* Unexpected feedback pattern or output */
+    app_panic_unexpected_pattern,
+
+    /* Failure while accessing NVM outside its partition */
+    app_panic_nvm_layout,
+
+    /* Failure while creating a timer */
+    app_panic_timer_create
 
 } app_panic_code;
 
@@ -175,8 +186,10 @@ extern void HandleAccessRead(GATT_ACCESS_IND_T *p_ind);
 /* Handle write operations on attributes maintained by the application. */
 extern void HandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
 
-/* Start undirected advertisements and move to ADVERTISING state */
-extern void GattStartAdverts(TYPED_BD_ADDR_T *p_addr, bool fast_connection);
+/* Start undirected advertisements in the current tier of the advertising
+ * schedule
+ */
+extern void GattStartAdverts(TYPED_BD_ADDR_T *p_addr);
 
 /* Stop on-going advertisements */
 extern void GattStopAdverts(void);
@@ -192,7 +205,17 @@ extern bool GattIsAddressResolvableRandom(TYPED_BD_ADDR_T *p_addr);
 /* Trigger fast advertisements */
 extern void GattTriggerFastAdverts(TYPED_BD_ADDR_T *p_addr);
 
+/* Move to the next tier of the advertising schedule */
+extern bool GattNextAdvertTier(void);
+
+/* Trigger fast advertisements for a configuration window */
+extern void GattTriggerConfigWindow(TYPED_BD_ADDR_T *p_addr,
+                                    uint32 window_length);
+
 /* Initialise the application GATT data. */
 extern void InitGattData(void);
 
+/* Discard the compiled advertising data after its content has changed */
+extern void GattInvalidateAdvertData(void);
+
 #endif /* __GATT_ACCESS_H__ */
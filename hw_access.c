@@ -42,6 +42,7 @@
 #include <pio.h>            /* PIO configuration and control functions */
 #include <pio_ctrlr.h>      /* Access to the PIO controller */
 #include <timer.h>          /* Chip timer functions */
+#include <sleep.h>          /* Control of the sleep modes */
 
 /*============================================================================*
  *  Local Header Files
@@ -50,6 +51,7 @@
 #include "hw_access.h"      /* Interface to this file */
 #include "esurl_beacon.h"    /* Definitions used throughout the GATT server */
 #include "buzzer.h"         /* Buzzer functions */
+#include "pattern.h"        /* Feedback patterns */
 #include "led.h"            /* LED functions */
 
 /*============================================================================*
@@ -61,6 +63,24 @@
 
 #define BUTTON_PIO_MASK             (PIO_BIT_MASK(BUTTON_PIO))
 
+/* Number of PIOs on the chip (PIO0 to PIO11) */
+#define HW_NUM_PIOS                 (12)
+
+/* PIOs used by the debug UART, which stays live while the chip sleeps with
+ * a timer wake
+ */
+#ifdef DEBUG_OUTPUT_ENABLED
+#define UART_PIO_MASK               (PIO_BIT_MASK(0) | PIO_BIT_MASK(1))
+#else
+#define UART_PIO_MASK               (0UL)
+#endif /* DEBUG_OUTPUT_ENABLED */
+
+/* PIOs parked while the chip is dormant: all of them except the button,
+ * which wakes it, and the debug UART
+ */
+#define PARK_PIO_MASK               (((1UL << HW_NUM_PIOS) - 1UL) & \
+                                     ~(BUTTON_PIO_MASK | UART_PIO_MASK))
+
 /* Extra long button press timer */
 #define EXTRA_LONG_BUTTON_PRESS_TIMER \
                                     (4*SECOND)
@@ -118,7 +138,7 @@ static void handleExtraLongButtonPress(timer_id tid)
         g_app_hw_data.button_press_tid = TIMER_INVALID;
 
         /* Sound three beeps to indicate pairing removal to user */
-        SoundBuzzer(buzzer_beep_thrice);
+        PatternPlay(pattern_beep_thrice);
         
         /* Handle pairing removal */
         HandlePairingRemoval();
@@ -191,8 +211,8 @@ extern void HwDataInit(void)
     /* Initialise button press timer */
     g_app_hw_data.button_press_tid = TIMER_INVALID;
 
-    /* Initialise buzzer data */
-    BuzzerInitData();
+    /* Initialise the pattern sequencer */
+    PatternInitData();
 }
 
 /*----------------------------------------------------------------------------*
@@ -219,8 +239,8 @@ extern void HwDataReset(void)
         g_app_hw_data.button_press_tid = TIMER_INVALID;
     }
 
-    /* Reset buzzer data */
-    BuzzerResetData();
+    /* Stop any pattern playing */
+    PatternStop();
 }
 
 /*----------------------------------------------------------------------------*
@@ -271,7 +291,7 @@ extern void HandlePIOChangedEvent(pio_changed_data *pio_data)
                 g_app_hw_data.button_press_tid = TIMER_INVALID;
 
                 /* Indicate short button press using short beep */
-                SoundBuzzer(buzzer_beep_short);
+                PatternPlay(pattern_beep_short);
 
                 HandleShortButtonPress();
             }
@@ -279,3 +299,84 @@ extern void HandlePIOChangedEvent(pio_changed_data *pio_data)
     }
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      HwParkPios
+ *
+ *  DESCRIPTION
+ *      This function stops the PWMs and drives every PIO except the button
+ *      and the debug UART to its lowest leakage state, an input pulled down,
+ *      before the chip goes dormant. HwRestorePios() undoes it.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void HwParkPios(void)
+{
+    /* Stop the buzzer and LED PWMs */
+    BuzzerSet(FALSE);
+    LedEnable(FALSE);
+
+    PioSetModes(PARK_PIO_MASK, pio_mode_user);
+    PioSetDirs(PARK_PIO_MASK, 0UL);
+    PioSetPullModes(PARK_PIO_MASK, pio_mode_strong_pull_down);
+    PioSetEventMask(PARK_PIO_MASK, pio_event_mode_disable);
+
+    /* Keep the I2C lines pulled down */
+    PioSetI2CPullMode(pio_i2c_pull_mode_strong_pull_down);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      HwRestorePios
+ *
+ *  DESCRIPTION
+ *      This function restores the buzzer and LED PIOs parked by HwParkPios()
+ *      when the chip leaves the dormant state without a reset.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void HwRestorePios(void)
+{
+    BuzzerInitHardware();
+    LedInitHardware();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      HwEnterDormant
+ *
+ *  DESCRIPTION
+ *      This function puts the chip in the dormant state, its lowest power
+ *      state, with the button as the only wake source. Waking from dormant
+ *      restarts the chip from reset, so this function does not return.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void HwEnterDormant(void)
+{
+    /* Stop any feedback pattern and the button press timer */
+    HwDataReset();
+
+    /* Park every PIO except the button */
+    HwParkPios();
+
+    /* The button stays pulled up. Wake the chip when it is pressed, which
+     * pulls its PIO low, instead of raising PIO events.
+     */
+    PioSetEventMask(BUTTON_PIO_MASK, pio_event_mode_disable);
+    PioSetWakeupStateMask(BUTTON_PIO_MASK, 0UL);
+
+    SleepRequest(sleep_state_dormant, FALSE, NULL);
+}
@@ -76,4 +76,13 @@ extern void HwDataReset(void);
 /* Handle the PIO changed event */
 extern void HandlePIOChangedEvent(pio_changed_data *pio_data);
 
+/* Park the PIOs in their lowest leakage state before the chip goes dormant */
+extern void HwParkPios(void);
+
+/* Restore the PIOs parked by HwParkPios() */
+extern void HwRestorePios(void);
+
+/* Put the chip in the dormant state until the button is pressed */
+extern void HwEnterDormant(void);
+
 #endif /* __HW_ACCESS_H__ */
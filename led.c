@@ -148,4 +148,26 @@ extern void LedEnable(bool enable)
     }
 }
 
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      LedSet
+ *
+ *  DESCRIPTION
+ *      This function turns the LED fully on or off, without the PWM, which
+ *      would otherwise keep running. Flashes are timed by the pattern
+ *      sequencer, see pattern.c.
+ *
+ *  PARAMETERS
+ *      on [in]                 TRUE to turn the LED on
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void LedSet(bool on)
+{
+    PioEnablePWM(LED_PWM_INDEX, FALSE);
+    PioSetModes(LED_PIO_MASK, pio_mode_user);
+    PioSet(LED_PIO, on ? PIO_STATE_HIGH : PIO_STATE_LOW);
+}
+
 #endif /* ENABLE_LED */
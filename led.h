@@ -58,6 +58,9 @@ extern void LedInitHardware(void);
 /* Enables or disables LED indication */
 extern void LedEnable(bool enable);
 
+/* Turn the LED fully on or off */
+extern void LedSet(bool on);
+
 #else /* ENABLE_LED */
 
 /* Define LED functions to expand to nothing as LED functionality is not 
@@ -66,6 +69,7 @@ extern void LedEnable(bool enable);
 
 #define LedInitHardware()
 #define LedEnable(enable)
+#define LedSet(on)
 
 #endif /* ENABLE_LED */
 
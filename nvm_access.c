@@ -51,6 +51,503 @@
 
 #include "nvm_access.h"     /* Interface to this file */
 #include "esurl_beacon.h"    /* Definitions used throughout the GATT server */
+#include "vtimer.h"         /* Virtual timers */
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Word indices within the header stored in front of each copy of a record */
+#define NVM_RECORD_HEADER_SEQ               (0)
+#define NVM_RECORD_HEADER_CRC               (1)
+
+/* Number of words read back at a time when verifying a record copy */
+#define NVM_VERIFY_CHUNK_WORDS              (8)
+
+/* Number of times a record write is attempted before giving up */
+#define NVM_RECORD_WRITE_ATTEMPTS           (2)
+
+/* CRC-16-CCITT polynomial and initial value */
+#define NVM_CRC_POLYNOMIAL                  (0x1021)
+#define NVM_CRC_INIT                        (0xFFFF)
+
+/* Maximum number of records waiting to be committed. This is the number of
+ * records which can be written while the application is running.
+ */
+#define NVM_MAX_PENDING_RECORDS             (4)
+
+/* Time for which NVM writes must have been idle before queued records are
+ * committed
+ */
+#define NVM_COMMIT_IDLE_TIMEOUT             (2 * SECOND)
+
+/* Time by which the commit may be delayed to share a wake with other work */
+#define NVM_COMMIT_SLACK                    (1 * SECOND)
+
+/*============================================================================*
+ *  Private Data Types
+ *============================================================================*/
+
+/* Extent of an NVM partition */
+typedef struct _NVM_PARTITION_T
+{
+    /* NVM offset of the start of the partition, in words */
+    uint16 base;
+
+    /* Size of the partition, in words */
+    uint16 size;
+
+    /* TRUE if each copy of the record in the partition starts on a page
+     * boundary and is written a page at a time
+     */
+    bool paged;
+
+} NVM_PARTITION_T;
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Partition table, indexed by nvm_partition. See nvm_layout.h. */
+static const NVM_PARTITION_T g_nvm_partitions[nvm_partition_count] =
+{
+    {NVM_SANITY_BASE,            NVM_SANITY_SIZE,            FALSE},
+    {NVM_APP_BOND_BASE,          NVM_APP_BOND_SIZE,          TRUE},
+    {NVM_GAP_BASE,               NVM_GAP_SIZE,               FALSE},
+    {NVM_BATTERY_BASE,           NVM_BATTERY_SIZE,           FALSE},
+    {NVM_TEMPERATURE_BASE,       NVM_TEMPERATURE_SIZE,       FALSE},
+    {NVM_ESURL_BEACON_BASE,      NVM_ESURL_BEACON_SIZE,      TRUE},
+    {NVM_PACKET_CHECKPOINT_BASE, NVM_PACKET_CHECKPOINT_SIZE, FALSE},
+    {NVM_SCHEDULE_BASE,          NVM_SCHEDULE_SIZE,          FALSE}
+};
+
+#ifdef NVM_TYPE_EEPROM
+/* Image of one page of a record copy being written */
+static uint16 g_nvm_page_buffer[NVM_PAGE_WORDS];
+#endif /* NVM_TYPE_EEPROM */
+
+/* Records waiting to be committed */
+static NVM_RECORD_T *g_nvm_pending[NVM_MAX_PENDING_RECORDS];
+
+/* Number of records waiting to be committed */
+static uint16 g_nvm_num_pending = 0;
+
+/* Timer ID for the idle commit timer */
+static vtimer_id g_nvm_commit_tid = VTIMER_INVALID;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+/* Return the distance between the two copies of a record */
+static uint16 nvmRecordCopyStride(nvm_partition partition, uint16 length);
+
+/* Convert an offset within a partition to an NVM offset */
+static uint16 nvmPartitionOffset(nvm_partition partition, uint16 length,
+                                 uint16 offset);
+
+/* Read words from NVM without disabling it afterwards */
+static void nvmReadWords(uint16 *buffer, uint16 length, uint16 offset);
+
+/* Write words to NVM without disabling it afterwards */
+static void nvmWriteWords(uint16 *buffer, uint16 length, uint16 offset);
+
+/* Add a word to a running CRC */
+static uint16 nvmCrcUpdate(uint16 crc, uint16 word);
+
+/* Start the CRC of a record copy */
+static uint16 nvmCrcStart(uint16 length, uint16 seq);
+
+/* Return the NVM offset of one of the copies of a record */
+static uint16 nvmRecordCopyOffset(const NVM_RECORD_T *p_rec, uint16 copy);
+
+/* Write the header and payload of a record copy */
+static void nvmWriteRecordCopy(const NVM_RECORD_T *p_rec, uint16 offset,
+                               const uint16 *p_header);
+
+/* Read the headers of both copies of a record and find the newer one */
+static uint16 nvmReadRecordHeaders(const NVM_RECORD_T *p_rec,
+                                   uint16 header[2][NVM_RECORD_HEADER_WORDS]);
+
+/* Read back a record copy and check it against the header written */
+static bool nvmVerifyRecordCopy(const NVM_RECORD_T *p_rec, uint16 offset,
+                                const uint16 *p_header);
+
+/* Handle the expiry of the idle commit timer */
+static void nvmCommitTimerHandler(vtimer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmRecordCopyStride
+ *
+ *  DESCRIPTION
+ *      Return the distance between the headers of the two copies of a record.
+ *      In a paged partition each copy starts on a page boundary.
+ *
+ *  PARAMETERS
+ *      partition [in]          Partition holding the record
+ *      length [in]             Length of the payload, in words
+ *
+ *  RETURNS
+ *      Distance between the copies, in words
+ *----------------------------------------------------------------------------*/
+static uint16 nvmRecordCopyStride(nvm_partition partition, uint16 length)
+{
+    /* An invalid partition is reported by nvmPartitionOffset */
+    if(partition < nvm_partition_count && g_nvm_partitions[partition].paged)
+    {
+        return NVM_PAGE_ALIGN(length + NVM_RECORD_HEADER_WORDS);
+    }
+
+    return length + NVM_RECORD_HEADER_WORDS;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmPartitionOffset
+ *
+ *  DESCRIPTION
+ *      Convert an offset within a partition to an NVM offset, reporting a
+ *      panic if the words accessed do not lie within the partition.
+ *
+ *  PARAMETERS
+ *      partition [in]          Partition being accessed
+ *      length [in]             Number of words being accessed
+ *      offset [in]             Offset within the partition, in words
+ *
+ *  RETURNS
+ *      NVM offset, in words
+ *----------------------------------------------------------------------------*/
+static uint16 nvmPartitionOffset(nvm_partition partition, uint16 length,
+                                 uint16 offset)
+{
+    if(partition >= nvm_partition_count ||
+       offset > g_nvm_partitions[partition].size ||
+       length > g_nvm_partitions[partition].size - offset)
+    {
+        ReportPanic(app_panic_nvm_layout);
+    }
+
+    return g_nvm_partitions[partition].base + offset;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmReadWords
+ *
+ *  DESCRIPTION
+ *      Read words from the NVM Store, reporting a panic on failure. The NVM is
+ *      left enabled so that several reads can be made before calling
+ *      Nvm_Disable.
+ *
+ *  PARAMETERS
+ *      buffer [out]            Data read from NVM
+ *      length [in]             Number of words of data to read
+ *      offset [in]             Offset from which to start reading, in words
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void nvmReadWords(uint16 *buffer, uint16 length, uint16 offset)
+{
+    if(sys_status_success != NvmRead(buffer, length, offset))
+    {
+        Nvm_Disable();
+        ReportPanic(app_panic_nvm_read);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmWriteWords
+ *
+ *  DESCRIPTION
+ *      Write words to the NVM Store, reporting a panic on failure. The NVM is
+ *      left enabled so that several writes can be made before calling
+ *      Nvm_Disable.
+ *
+ *  PARAMETERS
+ *      buffer [in]             Data to write to NVM
+ *      length [in]             Number of words of data to write
+ *      offset [in]             Offset from which to start writing, in words
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void nvmWriteWords(uint16 *buffer, uint16 length, uint16 offset)
+{
+    if(sys_status_success != NvmWrite(buffer, length, offset))
+    {
+        Nvm_Disable();
+        ReportPanic(app_panic_nvm_write);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmCrcUpdate
+ *
+ *  DESCRIPTION
+ *      Add a 16-bit word to a running CRC-16-CCITT, most significant bit
+ *      first.
+ *
+ *  PARAMETERS
+ *      crc [in]                CRC so far
+ *      word [in]               Word to add
+ *
+ *  RETURNS
+ *      Updated CRC
+ *----------------------------------------------------------------------------*/
+static uint16 nvmCrcUpdate(uint16 crc, uint16 word)
+{
+    uint16 bit;
+
+    crc ^= word;
+
+    for(bit = 0; bit < 16; bit++)
+    {
+        if(crc & 0x8000)
+        {
+            crc = (crc << 1) ^ NVM_CRC_POLYNOMIAL;
+        }
+        else
+        {
+            crc <<= 1;
+        }
+    }
+
+    return crc;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmCrcStart
+ *
+ *  DESCRIPTION
+ *      Start the CRC of a record copy. The payload length is included so that
+ *      erased NVM, or a copy written with a different layout, cannot pass the
+ *      check.
+ *
+ *  PARAMETERS
+ *      length [in]             Length of the payload, in words
+ *      seq [in]                Sequence number of the copy
+ *
+ *  RETURNS
+ *      CRC covering the length and sequence number
+ *----------------------------------------------------------------------------*/
+static uint16 nvmCrcStart(uint16 length, uint16 seq)
+{
+    return nvmCrcUpdate(nvmCrcUpdate(NVM_CRC_INIT, length), seq);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmRecordCopyOffset
+ *
+ *  DESCRIPTION
+ *      Return the NVM offset of the header of one of the copies of a record.
+ *
+ *  PARAMETERS
+ *      p_rec [in]              Record descriptor
+ *      copy [in]               Index of the copy (0 or 1)
+ *
+ *  RETURNS
+ *      NVM offset, in words
+ *----------------------------------------------------------------------------*/
+static uint16 nvmRecordCopyOffset(const NVM_RECORD_T *p_rec, uint16 copy)
+{
+    /* Both copies were checked against the partition by Nvm_InitRecord */
+    return g_nvm_partitions[p_rec->partition].base +
+           copy * nvmRecordCopyStride(p_rec->partition, p_rec->length);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmWriteRecordCopy
+ *
+ *  DESCRIPTION
+ *      Write the header and payload of a record copy. The header is always
+ *      written last: until it has been written the copy fails its CRC check,
+ *      so a power failure part way through leaves the previous copy in use.
+ *
+ *      On I2C EEPROM a copy in a paged partition is written one whole page at
+ *      a time, last page first, so that each page is programmed once. Any
+ *      other copy is written as the payload followed by the header.
+ *
+ *  PARAMETERS
+ *      p_rec [in]              Record descriptor
+ *      offset [in]             NVM offset of the copy
+ *      p_header [in]           Header to write
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void nvmWriteRecordCopy(const NVM_RECORD_T *p_rec, uint16 offset,
+                               const uint16 *p_header)
+{
+#ifdef NVM_TYPE_EEPROM
+    uint16 image_words;
+    uint16 start;
+    uint16 count;
+    uint16 i;
+
+    if(g_nvm_partitions[p_rec->partition].paged)
+    {
+        image_words = p_rec->length + NVM_RECORD_HEADER_WORDS;
+        start = NVM_PAGE_ALIGN(image_words);
+
+        /* The copy starts on a page boundary, so the first page, which holds
+         * the header, is written last
+         */
+        while(start > 0)
+        {
+            start -= NVM_PAGE_WORDS;
+
+            count = image_words - start;
+            if(count > NVM_PAGE_WORDS)
+            {
+                count = NVM_PAGE_WORDS;
+            }
+
+            for(i = 0; i < count; i++)
+            {
+                if(start + i < NVM_RECORD_HEADER_WORDS)
+                {
+                    g_nvm_page_buffer[i] = p_header[start + i];
+                }
+                else
+                {
+                    g_nvm_page_buffer[i] = p_rec->p_data[start + i -
+                                                 NVM_RECORD_HEADER_WORDS];
+                }
+            }
+
+            nvmWriteWords(g_nvm_page_buffer, count, offset + start);
+        }
+
+        return;
+    }
+#endif /* NVM_TYPE_EEPROM */
+
+    nvmWriteWords(p_rec->p_data, p_rec->length,
+                  offset + NVM_RECORD_HEADER_WORDS);
+    nvmWriteWords((uint16*)p_header, NVM_RECORD_HEADER_WORDS, offset);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmReadRecordHeaders
+ *
+ *  DESCRIPTION
+ *      Read the headers of both copies of a record and return the index of
+ *      the copy with the newer sequence number. Sequence numbers wrap, so
+ *      they are compared by their signed difference. The NVM is left enabled.
+ *
+ *  PARAMETERS
+ *      p_rec [in]              Record descriptor
+ *      header [out]            Headers of copy 0 and copy 1
+ *
+ *  RETURNS
+ *      Index (0 or 1) of the copy with the newer sequence number
+ *----------------------------------------------------------------------------*/
+static uint16 nvmReadRecordHeaders(const NVM_RECORD_T *p_rec,
+                                   uint16 header[2][NVM_RECORD_HEADER_WORDS])
+{
+    uint16 copy;
+
+    for(copy = 0; copy < 2; copy++)
+    {
+        nvmReadWords(header[copy], NVM_RECORD_HEADER_WORDS,
+                     nvmRecordCopyOffset(p_rec, copy));
+    }
+
+    return ((int16)(header[1][NVM_RECORD_HEADER_SEQ] -
+                    header[0][NVM_RECORD_HEADER_SEQ]) > 0) ? 1 : 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmVerifyRecordCopy
+ *
+ *  DESCRIPTION
+ *      Read back a record copy that has just been written, a few words at a
+ *      time, and check both its header and the CRC of its payload.
+ *
+ *  PARAMETERS
+ *      p_rec [in]              Record descriptor
+ *      offset [in]             NVM offset of the copy
+ *      p_header [in]           Header that was written
+ *
+ *  RETURNS
+ *      TRUE if the copy reads back correctly
+ *----------------------------------------------------------------------------*/
+static bool nvmVerifyRecordCopy(const NVM_RECORD_T *p_rec, uint16 offset,
+                                const uint16 *p_header)
+{
+    uint16 buffer[NVM_VERIFY_CHUNK_WORDS];
+    uint16 crc;
+    uint16 done;
+    uint16 chunk;
+    uint16 i;
+
+    nvmReadWords(buffer, NVM_RECORD_HEADER_WORDS, offset);
+
+    if(buffer[NVM_RECORD_HEADER_SEQ] != p_header[NVM_RECORD_HEADER_SEQ] ||
+       buffer[NVM_RECORD_HEADER_CRC] != p_header[NVM_RECORD_HEADER_CRC])
+    {
+        return FALSE;
+    }
+
+    crc = nvmCrcStart(p_rec->length, p_header[NVM_RECORD_HEADER_SEQ]);
+
+    for(done = 0; done < p_rec->length; done += chunk)
+    {
+        chunk = p_rec->length - done;
+        if(chunk > NVM_VERIFY_CHUNK_WORDS)
+        {
+            chunk = NVM_VERIFY_CHUNK_WORDS;
+        }
+
+        nvmReadWords(buffer, chunk,
+                     offset + NVM_RECORD_HEADER_WORDS + done);
+
+        for(i = 0; i < chunk; i++)
+        {
+            crc = nvmCrcUpdate(crc, buffer[i]);
+        }
+    }
+
+    return (crc == p_header[NVM_RECORD_HEADER_CRC]);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      nvmCommitTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function handles the expiry of the idle commit timer by committing
+ *      the queued records.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of timer that has expired
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void nvmCommitTimerHandler(vtimer_id tid)
+{
+    if(tid == g_nvm_commit_tid)
+    {
+        /* The timer has just expired, so mark it as invalid */
+        g_nvm_commit_tid = VTIMER_INVALID;
+
+        Nvm_CommitPending();
+    }
+}
 
 /*============================================================================*
  *  Public Function Implementations
@@ -81,30 +578,34 @@ void Nvm_Disable(void)
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      Nvm_Read
+ *      Nvm_ReadPartition
  *
  *  DESCRIPTION
  *      Read words from the NVM Store after preparing the NVM to be readable. 
  *      After the read operation, perform the actions necessary to save power
  *      on NVM.
  *
- *      Read words starting at the word offset, and store them in the supplied
- *      buffer.
+ *      Read words starting at the word offset within the partition, and store
+ *      them in the supplied buffer. Reports a panic if the words do not lie
+ *      within the partition.
  *
  *  PARAMETERS
+ *      partition [in]          Partition to read from
  *      buffer [out]            Data read from NVM
  *      length [in]             Number of words of data to read
- *      offset [in]             Offset from which to start reading, in words
+ *      offset [in]             Offset within the partition, in words
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-void Nvm_Read(uint16 *buffer, uint16 length, uint16 offset)
+void Nvm_ReadPartition(nvm_partition partition, uint16 *buffer,
+                       uint16 length, uint16 offset)
 {
     sys_status result;
 
     /* Read from NVM. Firmware re-enables the NVM if it is disabled */
-    result = NvmRead(buffer, length, offset);
+    result = NvmRead(buffer, length,
+                     nvmPartitionOffset(partition, length, offset));
 
     /* Disable NVM to save power after read operation */
     Nvm_Disable();
@@ -118,7 +619,7 @@ void Nvm_Read(uint16 *buffer, uint16 length, uint16 offset)
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      Nvm_Write
+ *      Nvm_WritePartition
  *
  *  DESCRIPTION
  *      Write words to the NVM Store after preparing the NVM to be writable. 
@@ -126,22 +627,26 @@ void Nvm_Read(uint16 *buffer, uint16 length, uint16 offset)
  *      on NVM.
  *
  *      Write words from the supplied buffer into the NVM Store, starting at the
- *      word offset.
+ *      word offset within the partition. Reports a panic if the words do not
+ *      lie within the partition.
  *
  *  PARAMETERS
+ *      partition [in]          Partition to write to
  *      buffer [in]             Data to write to NVM
  *      length [in]             Number of words of data to write
- *      offset [in]             Offset from which to start writing, in words
+ *      offset [in]             Offset within the partition, in words
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-void Nvm_Write(uint16 *buffer, uint16 length, uint16 offset)
+void Nvm_WritePartition(nvm_partition partition, uint16 *buffer,
+                        uint16 length, uint16 offset)
 {
     sys_status result;          /* Function status */
 
     /* Write to NVM. Firmware re-enables the NVM if it is disabled */
-    result = NvmWrite(buffer, length, offset);
+    result = NvmWrite(buffer, length,
+                      nvmPartitionOffset(partition, length, offset));
 
     /* Disable NVM to save power after write operation */
     Nvm_Disable();
@@ -152,3 +657,257 @@ void Nvm_Write(uint16 *buffer, uint16 length, uint16 offset)
         ReportPanic(app_panic_nvm_write);
     }
 }
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_InitRecord
+ *
+ *  DESCRIPTION
+ *      Initialise a double-buffered record descriptor. Neither copy is
+ *      considered valid until the record has been read or written. Reports a
+ *      panic if both copies of the record do not fit in the partition.
+ *
+ *  PARAMETERS
+ *      p_rec [out]             Record descriptor
+ *      partition [in]          Partition holding the record
+ *      p_data [in]             RAM image of the payload
+ *      length [in]             Length of the payload, in words
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+void Nvm_InitRecord(NVM_RECORD_T *p_rec, nvm_partition partition,
+                    uint16 *p_data, uint16 length)
+{
+    /* Check both copies lie within the partition */
+    nvmPartitionOffset(partition,
+                       nvmRecordCopyStride(partition, length) +
+                       length + NVM_RECORD_HEADER_WORDS, 0);
+
+    p_rec->partition = partition;
+    p_rec->p_data = p_data;
+    p_rec->length = length;
+    p_rec->seq = 0;
+    p_rec->active = NVM_RECORD_COPY_NONE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_ReadRecord
+ *
+ *  DESCRIPTION
+ *      Load the newest copy of a record whose CRC is valid into its RAM image.
+ *      The newer copy is tried first, so in the normal case the payload is
+ *      read from NVM only once.
+ *
+ *  PARAMETERS
+ *      p_rec [in/out]          Record descriptor
+ *
+ *  RETURNS
+ *      TRUE if a valid copy was loaded. FALSE if neither copy is valid, in
+ *      which case the contents of the RAM image are undefined and the caller
+ *      must restore its defaults.
+ *----------------------------------------------------------------------------*/
+bool Nvm_ReadRecord(NVM_RECORD_T *p_rec)
+{
+    uint16 header[2][NVM_RECORD_HEADER_WORDS];
+    uint16 first;
+    uint16 copy;
+    uint16 i;
+    uint16 j;
+    uint16 crc;
+
+    p_rec->active = NVM_RECORD_COPY_NONE;
+
+    first = nvmReadRecordHeaders(p_rec, header);
+
+    for(i = 0; i < 2; i++)
+    {
+        copy = first ^ i;
+
+        nvmReadWords(p_rec->p_data, p_rec->length,
+                     nvmRecordCopyOffset(p_rec, copy) +
+                     NVM_RECORD_HEADER_WORDS);
+
+        crc = nvmCrcStart(p_rec->length, header[copy][NVM_RECORD_HEADER_SEQ]);
+        for(j = 0; j < p_rec->length; j++)
+        {
+            crc = nvmCrcUpdate(crc, p_rec->p_data[j]);
+        }
+
+        if(crc == header[copy][NVM_RECORD_HEADER_CRC])
+        {
+            p_rec->active = copy;
+            p_rec->seq = header[copy][NVM_RECORD_HEADER_SEQ];
+            break;
+        }
+    }
+
+    /* Disable NVM to save power after read operation */
+    Nvm_Disable();
+
+    return (p_rec->active != NVM_RECORD_COPY_NONE);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_WriteRecord
+ *
+ *  DESCRIPTION
+ *      Commit the RAM image of a record to the copy not currently in use, with
+ *      the next sequence number. The record only switches to the new copy
+ *      once it has been read back and its CRC verified. If the record has not
+ *      been read, the headers in NVM are read first, so that the new copy
+ *      is written over the older one and is numbered after the newer one.
+ *      Reports a panic if the new copy cannot be verified, in which case the
+ *      previous copy remains in NVM.
+ *
+ *  PARAMETERS
+ *      p_rec [in/out]          Record descriptor
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+void Nvm_WriteRecord(NVM_RECORD_T *p_rec)
+{
+    uint16 header[NVM_RECORD_HEADER_WORDS];
+    uint16 old_header[2][NVM_RECORD_HEADER_WORDS];
+    uint16 copy;
+    uint16 seq;
+    uint16 offset;
+    uint16 attempt;
+    uint16 i;
+    bool verified = FALSE;
+
+    if(p_rec->active == NVM_RECORD_COPY_NONE)
+    {
+        /* Continue from whatever is already in NVM, valid or not, as a read
+         * which loads the older copy would otherwise undo this write
+         */
+        copy = nvmReadRecordHeaders(p_rec, old_header);
+        seq = old_header[copy][NVM_RECORD_HEADER_SEQ];
+        copy ^= 1;
+    }
+    else
+    {
+        copy = p_rec->active ^ 1;
+        seq = p_rec->seq;
+    }
+
+    offset = nvmRecordCopyOffset(p_rec, copy);
+
+    header[NVM_RECORD_HEADER_SEQ] = seq + 1;
+    header[NVM_RECORD_HEADER_CRC] = nvmCrcStart(p_rec->length,
+                                                header[NVM_RECORD_HEADER_SEQ]);
+    for(i = 0; i < p_rec->length; i++)
+    {
+        header[NVM_RECORD_HEADER_CRC] =
+            nvmCrcUpdate(header[NVM_RECORD_HEADER_CRC], p_rec->p_data[i]);
+    }
+
+    for(attempt = 0; attempt < NVM_RECORD_WRITE_ATTEMPTS && !verified;
+        attempt++)
+    {
+        nvmWriteRecordCopy(p_rec, offset, header);
+
+        verified = nvmVerifyRecordCopy(p_rec, offset, header);
+    }
+
+    /* Disable NVM to save power after write operation */
+    Nvm_Disable();
+
+    if(!verified)
+    {
+        ReportPanic(app_panic_nvm_write);
+    }
+
+    p_rec->active = copy;
+    p_rec->seq = header[NVM_RECORD_HEADER_SEQ];
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_WriteRecordDeferred
+ *
+ *  DESCRIPTION
+ *      Queue a record to be committed once NVM writes have been idle for
+ *      NVM_COMMIT_IDLE_TIMEOUT. The RAM image is the live copy of the data
+ *      until then, so a GATT write can be acknowledged straight away.
+ *
+ *  PARAMETERS
+ *      p_rec [in]              Record descriptor
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+void Nvm_WriteRecordDeferred(NVM_RECORD_T *p_rec)
+{
+    uint16 i;
+
+    for(i = 0; i < g_nvm_num_pending; i++)
+    {
+        if(g_nvm_pending[i] == p_rec)
+        {
+            break;
+        }
+    }
+
+    if(i == g_nvm_num_pending)
+    {
+        if(g_nvm_num_pending == NVM_MAX_PENDING_RECORDS)
+        {
+            /* No room in the queue, commit what is already there */
+            Nvm_CommitPending();
+        }
+
+        g_nvm_pending[g_nvm_num_pending++] = p_rec;
+    }
+
+    /* Restart the idle timer so that a burst of writes is committed once */
+    if(g_nvm_commit_tid != VTIMER_INVALID)
+    {
+        VTimerDelete(g_nvm_commit_tid);
+    }
+    g_nvm_commit_tid = VTimerCreate(NVM_COMMIT_IDLE_TIMEOUT, NVM_COMMIT_SLACK,
+                                    nvmCommitTimerHandler);
+
+    if(g_nvm_commit_tid == VTIMER_INVALID)
+    {
+        ReportPanic(app_panic_timer_create);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_CommitPending
+ *
+ *  DESCRIPTION
+ *      Commit all queued records now. This must be called before any request
+ *      to sleep or reset the chip.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+void Nvm_CommitPending(void)
+{
+    NVM_RECORD_T *p_rec;
+
+    if(g_nvm_commit_tid != VTIMER_INVALID)
+    {
+        VTimerDelete(g_nvm_commit_tid);
+        g_nvm_commit_tid = VTIMER_INVALID;
+    }
+
+    /* Take each record off the queue before writing it, so that a panic
+     * raised by the write cannot commit it again
+     */
+    while(g_nvm_num_pending > 0)
+    {
+        p_rec = g_nvm_pending[--g_nvm_num_pending];
+
+        Nvm_WriteRecord(p_rec);
+    }
+}
@@ -45,6 +45,48 @@
 
 #include <types.h>          /* Commonly used type definitions */
 
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "nvm_layout.h"     /* Static NVM layout */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Value of NVM_RECORD_T.active when neither copy holds valid data */
+#define NVM_RECORD_COPY_NONE                (0xFFFF)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Double-buffered NVM record. Two copies of the payload are kept in NVM, each
+ * preceded by a sequence number and a CRC. A write always goes to the copy
+ * that is not in use and the record only switches to it once it has been read
+ * back and verified, so a write interrupted by a power failure leaves the
+ * previous copy intact.
+ */
+typedef struct _NVM_RECORD_T
+{
+    /* NVM partition holding both copies */
+    nvm_partition partition;
+
+    /* RAM image of the payload */
+    uint16 *p_data;
+
+    /* Length of the payload, in words */
+    uint16  length;
+
+    /* Sequence number of the copy in use */
+    uint16  seq;
+
+    /* Index (0 or 1) of the copy in use, or NVM_RECORD_COPY_NONE */
+    uint16  active;
+
+} NVM_RECORD_T;
+
 /*============================================================================*
  *  Public Function Prototypes
  *============================================================================*/
@@ -67,29 +109,32 @@ extern void Nvm_Disable(void);
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      Nvm_Read
+ *      Nvm_ReadPartition
  *
  *  DESCRIPTION
  *      Read words from the NVM Store after preparing the NVM to be readable. 
  *      After the read operation, perform the actions necessary to save power
  *      on NVM.
  *
- *      Read words starting at the word offset, and store them in the supplied
- *      buffer.
+ *      Read words starting at the word offset within the partition, and store
+ *      them in the supplied buffer. Reports a panic if the words do not lie
+ *      within the partition.
  *
  *  PARAMETERS
+ *      partition [in]          Partition to read from
  *      buffer [out]            Data read from NVM
  *      length [in]             Number of words of data to read
- *      offset [in]             Offset from which to start reading, in words
+ *      offset [in]             Offset within the partition, in words
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void Nvm_Read(uint16 *buffer, uint16 length, uint16 offset);
+extern void Nvm_ReadPartition(nvm_partition partition, uint16 *buffer,
+                              uint16 length, uint16 offset);
 
 /*----------------------------------------------------------------------------*
  *  NAME
- *      Nvm_Write
+ *      Nvm_WritePartition
  *
  *  DESCRIPTION
  *      Write words to the NVM Store after preparing the NVM to be writable. 
@@ -97,16 +142,111 @@ extern void Nvm_Read(uint16 *buffer, uint16 length, uint16 offset);
  *      on NVM.
  *
  *      Write words from the supplied buffer into the NVM Store, starting at the
- *      word offset.
+ *      word offset within the partition. Reports a panic if the words do not
+ *      lie within the partition.
  *
  *  PARAMETERS
+ *      partition [in]          Partition to write to
  *      buffer [in]             Data to write to NVM
  *      length [in]             Number of words of data to write
- *      offset [in]             Offset from which to start writing, in words
+ *      offset [in]             Offset within the partition, in words
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void Nvm_WritePartition(nvm_partition partition, uint16 *buffer,
+                               uint16 length, uint16 offset);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_InitRecord
+ *
+ *  DESCRIPTION
+ *      Initialise a double-buffered record descriptor. Neither copy is
+ *      considered valid until the record has been read or written. Reports a
+ *      panic if both copies of the record do not fit in the partition.
+ *
+ *  PARAMETERS
+ *      p_rec [out]             Record descriptor
+ *      partition [in]          Partition holding the record
+ *      p_data [in]             RAM image of the payload
+ *      length [in]             Length of the payload, in words
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void Nvm_InitRecord(NVM_RECORD_T *p_rec, nvm_partition partition,
+                           uint16 *p_data, uint16 length);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_ReadRecord
+ *
+ *  DESCRIPTION
+ *      Load the newest copy of a record whose CRC is valid into its RAM image.
+ *      The newer copy is tried first, so in the normal case the payload is
+ *      read from NVM only once.
+ *
+ *  PARAMETERS
+ *      p_rec [in/out]          Record descriptor
+ *
+ *  RETURNS
+ *      TRUE if a valid copy was loaded. FALSE if neither copy is valid, in
+ *      which case the contents of the RAM image are undefined and the caller
+ *      must restore its defaults.
+ *----------------------------------------------------------------------------*/
+extern bool Nvm_ReadRecord(NVM_RECORD_T *p_rec);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_WriteRecord
+ *
+ *  DESCRIPTION
+ *      Commit the RAM image of a record to the copy not currently in use, with
+ *      the next sequence number. The record only switches to the new copy
+ *      once it has been read back and its CRC verified. A record which has
+ *      not been read continues from the newer copy in NVM. Reports a panic
+ *      if the new copy cannot be verified; the previous copy remains in NVM.
+ *
+ *  PARAMETERS
+ *      p_rec [in/out]          Record descriptor
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void Nvm_WriteRecord(NVM_RECORD_T *p_rec);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_WriteRecordDeferred
+ *
+ *  DESCRIPTION
+ *      Queue a record to be committed once NVM writes have been idle for
+ *      NVM_COMMIT_IDLE_TIMEOUT. The RAM image is the live copy of the data
+ *      until then, so a GATT write can be acknowledged straight away.
+ *
+ *  PARAMETERS
+ *      p_rec [in]              Record descriptor
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void Nvm_WriteRecordDeferred(NVM_RECORD_T *p_rec);
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      Nvm_CommitPending
+ *
+ *  DESCRIPTION
+ *      Commit all queued records now. This must be called before any request
+ *      to sleep or reset the chip.
+ *
+ *  PARAMETERS
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void Nvm_Write(uint16 *buffer, uint16 length, uint16 offset);
+extern void Nvm_CommitPending(void);
 
 #endif /* __NVM_ACCESS_H__ */
@@ -0,0 +1,184 @@
+/******************************************************************************
+ *  FILE
+ *      nvm_layout.h
+ *
+ *  DESCRIPTION
+ *      Static layout of the application's NVM. Each user of NVM owns one
+ *      partition with a fixed base and size, and accesses it only through the
+ *      bounds-checked partition-relative routines in nvm_access.h.
+ *
+ *****************************************************************************/
+
+#ifndef __NVM_LAYOUT_H__
+#define __NVM_LAYOUT_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <gatt.h>           /* GATT application interface */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "gatt_access.h"    /* GATT-related routines */
+#include "esurl_beacon.h"   /* Bonding information */
+#include "esurl_beacon_service.h" /* Beacon Service configuration */
+#include "schedule_service.h" /* Schedule Service windows */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Number of words stored in front of each copy of a record: a sequence
+ * number followed by a CRC-16 calculated over the sequence number and the
+ * payload.
+ */
+#define NVM_RECORD_HEADER_WORDS             (2)
+
+/* Number of words of NVM occupied by a double-buffered record with a payload
+ * of 'length' words
+ */
+#define NVM_RECORD_WORDS(length)            (2 * ((length) + \
+                                             NVM_RECORD_HEADER_WORDS))
+
+/* NVM_TYPE_EEPROM is defined by the build when the NVM store is I2C EEPROM */
+#ifdef NVM_TYPE_EEPROM
+
+/* Page size of the I2C EEPROM, in words. A write which crosses a page boundary
+ * costs an extra page program cycle. This is the 64-byte page of the 128kbit
+ * and 256kbit parts; a 64-byte aligned block never crosses the 128-byte page
+ * of the 512kbit part either.
+ */
+#define NVM_PAGE_WORDS                      (32)
+
+#else /* NVM_TYPE_EEPROM */
+
+/* SPI flash is not programmed a page at a time, so do not align anything */
+#define NVM_PAGE_WORDS                      (1)
+
+#endif /* NVM_TYPE_EEPROM */
+
+/* Round a number of words up to a whole number of pages */
+#define NVM_PAGE_ALIGN(words)               ((((words) + NVM_PAGE_WORDS - 1) \
+                                              / NVM_PAGE_WORDS) * \
+                                             NVM_PAGE_WORDS)
+
+/* Number of words of NVM occupied by a double-buffered record whose copies
+ * each start on a page boundary. Records which are written often are laid out
+ * like this, so that each page of a copy is programmed exactly once.
+ */
+#define NVM_PAGED_RECORD_WORDS(length)      (2 * NVM_PAGE_ALIGN((length) + \
+                                             NVM_RECORD_HEADER_WORDS))
+
+/* Payload of each record, in words, taken from the size of the data stored.
+ * A record is also checked against its partition when it is initialised.
+ */
+#define NVM_APP_BOND_DATA_WORDS             (sizeof(APP_BOND_DATA_T))
+#define NVM_GAP_DATA_WORDS                  (DEVICE_NAME_MAX_LENGTH + 2)
+#define NVM_BATTERY_DATA_WORDS              (sizeof(gatt_client_config) * \
+                                             MAX_BONDED_HOSTS)
+#define NVM_TEMPERATURE_DATA_WORDS          (sizeof(gatt_client_config) * \
+                                             MAX_BONDED_HOSTS)
+#define NVM_ESURL_BEACON_DATA_WORDS         (sizeof(ESURL_BEACON_ADV_T))
+#define NVM_PACKET_CHECKPOINT_DATA_WORDS    (sizeof(uint32))
+#define NVM_SCHEDULE_DATA_WORDS             (sizeof(SCHEDULE_NVM_T))
+
+/* Partition bases and sizes, in words. Each partition starts where the
+ * previous one ends, except that the paged partitions holding the bonding
+ * information and the beacon configuration start on a page boundary.
+ */
+#define NVM_SANITY_BASE                     (0)
+#define NVM_SANITY_SIZE                     (1)
+
+#define NVM_APP_BOND_BASE                   \
+    NVM_PAGE_ALIGN(NVM_SANITY_BASE + NVM_SANITY_SIZE)
+#define NVM_APP_BOND_SIZE                   \
+    NVM_PAGED_RECORD_WORDS(NVM_APP_BOND_DATA_WORDS)
+
+#define NVM_GAP_BASE                        (NVM_APP_BOND_BASE + \
+                                             NVM_APP_BOND_SIZE)
+#define NVM_GAP_SIZE                        \
+    NVM_RECORD_WORDS(NVM_GAP_DATA_WORDS)
+
+#define NVM_BATTERY_BASE                    (NVM_GAP_BASE + NVM_GAP_SIZE)
+#define NVM_BATTERY_SIZE                    \
+    NVM_RECORD_WORDS(NVM_BATTERY_DATA_WORDS)
+
+#define NVM_TEMPERATURE_BASE                (NVM_BATTERY_BASE + \
+                                             NVM_BATTERY_SIZE)
+#define NVM_TEMPERATURE_SIZE                \
+    NVM_RECORD_WORDS(NVM_TEMPERATURE_DATA_WORDS)
+
+#define NVM_ESURL_BEACON_BASE               \
+    NVM_PAGE_ALIGN(NVM_TEMPERATURE_BASE + NVM_TEMPERATURE_SIZE)
+#define NVM_ESURL_BEACON_SIZE               \
+    NVM_PAGED_RECORD_WORDS(NVM_ESURL_BEACON_DATA_WORDS)
+
+#define NVM_PACKET_CHECKPOINT_BASE          (NVM_ESURL_BEACON_BASE + \
+                                             NVM_ESURL_BEACON_SIZE)
+#define NVM_PACKET_CHECKPOINT_SIZE          \
+    NVM_RECORD_WORDS(NVM_PACKET_CHECKPOINT_DATA_WORDS)
+
+#define NVM_SCHEDULE_BASE                   (NVM_PACKET_CHECKPOINT_BASE + \
+                                             NVM_PACKET_CHECKPOINT_SIZE)
+#define NVM_SCHEDULE_SIZE                   \
+    NVM_RECORD_WORDS(NVM_SCHEDULE_DATA_WORDS)
+
+/* Total number of words of NVM used by the application */
+#define NVM_LAYOUT_WORDS                    (NVM_SCHEDULE_BASE + \
+                                             NVM_SCHEDULE_SIZE)
+
+/* Number of words of NVM available to the application. This must match the
+ * nvm_size CS key in the .keyr files, and a layout which outgrows it fails
+ * to build, see nvm_layout_check below. The layout takes about 480 words on
+ * SPI flash and about 580 words on EEPROM, where the paged partitions are
+ * rounded up to whole pages. A SPI flash block must hold a whole number of
+ * NVM areas, which 1024 words does.
+ */
+#define NVM_SIZE_WORDS                      (0x400)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Fails to compile, having a negative size, if the layout does not fit in the
+ * NVM available to the application
+ */
+typedef uint8 nvm_layout_check[(NVM_LAYOUT_WORDS <= NVM_SIZE_WORDS) ? 1 : -1];
+
+/* NVM partitions, in layout order */
+typedef enum
+{
+    /* Sanity word identifying the layout */
+    nvm_partition_sanity = 0,
+
+    /* Bonding information */
+    nvm_partition_app_bond,
+
+    /* GAP Service device name */
+    nvm_partition_gap,
+
+    /* Battery Service client configuration of each bonded host */
+    nvm_partition_battery,
+
+    /* Temperature Service client configuration of each bonded host */
+    nvm_partition_temperature,
+
+    /* Beacon Service configuration */
+    nvm_partition_esurl_beacon,
+
+    /* Beacon packet counter checkpoint */
+    nvm_partition_packet_checkpoint,
+
+    /* Schedule Service beaconing windows */
+    nvm_partition_schedule,
+
+    /* Number of partitions */
+    nvm_partition_count
+
+} nvm_partition;
+
+#endif /* __NVM_LAYOUT_H__ */
@@ -0,0 +1,428 @@
+/******************************************************************************
+ *  FILE
+ *      pattern.c
+ *
+ *  DESCRIPTION
+ *      This file implements the feedback pattern sequencer. Each step of a
+ *      pattern sets one output to a level and then waits for its duration;
+ *      steps with no duration take effect together with the step after them,
+ *      so one pattern may drive the buzzer and the LED at once. A new
+ *      pattern is a new table below, not new code, and however many outputs
+ *      a pattern uses it takes a single timer.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <timer.h>          /* Chip timer functions */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "user_config.h"    /* User configuration */
+#include "pattern.h"        /* Interface to this file */
+#include "buzzer.h"         /* Buzzer functions */
+#include "led.h"            /* LED functions */
+#include "esurl_beacon.h"   /* Definitions used throughout the GATT server */
+
+/* Only compile this file if the sequencer has an output to drive */
+#ifdef ENABLE_PATTERNS
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Step durations, in milliseconds */
+#define PATTERN_BEEP_SHORT                  (100)
+#define PATTERN_BEEP_LONG                   (500)
+#define PATTERN_BEEP_GAP                    (25)
+
+#ifdef LED_HEARTBEAT_ON_TIME
+#define PATTERN_HEARTBEAT_ON                (LED_HEARTBEAT_ON_TIME / MILLISECOND)
+#else
+#define PATTERN_HEARTBEAT_ON                (5)
+#endif /* LED_HEARTBEAT_ON_TIME */
+
+/* Bit of an output in a mask of outputs */
+#define PATTERN_OUTPUT_MASK(output)         (1U << (output))
+
+/* Outputs compiled into the application. A pattern which drives none of
+ * them is not played, so that it does not wake the chip for nothing.
+ */
+#ifdef ENABLE_BUZZER
+#define PATTERN_BUZZER_ENABLED   PATTERN_OUTPUT_MASK(pattern_output_buzzer)
+#else
+#define PATTERN_BUZZER_ENABLED              (0)
+#endif /* ENABLE_BUZZER */
+
+#ifdef ENABLE_LED
+#define PATTERN_LED_ENABLED      PATTERN_OUTPUT_MASK(pattern_output_led)
+#else
+#define PATTERN_LED_ENABLED                 (0)
+#endif /* ENABLE_LED */
+
+#define PATTERN_OUTPUTS_ENABLED \
+    (PATTERN_BUZZER_ENABLED | PATTERN_LED_ENABLED)
+
+/* Entry of the pattern table */
+#define PATTERN(steps) \
+    {steps, sizeof(steps) / sizeof(steps[0])}
+
+/*============================================================================*
+ *  Private Data Types
+ *============================================================================*/
+
+/* Outputs driven by the sequencer */
+typedef enum
+{
+    pattern_output_buzzer = 0,
+    pattern_output_led
+
+} pattern_output;
+
+/* Step of a pattern */
+typedef struct _PATTERN_STEP_T
+{
+    /* Output to set */
+    pattern_output output;
+
+    /* Level to set it to, zero for off */
+    uint8 level;
+
+    /* Time to wait before the next step, in milliseconds */
+    uint16 duration;
+
+} PATTERN_STEP_T;
+
+/* Pattern */
+typedef struct _PATTERN_T
+{
+    /* Steps, played in order */
+    const PATTERN_STEP_T *p_steps;
+
+    /* Number of steps */
+    uint16 num_steps;
+
+} PATTERN_T;
+
+/* Sequencer data */
+typedef struct _PATTERN_DATA_T
+{
+    /* Timer for the current step */
+    timer_id tid;
+
+    /* Pattern playing, or NULL */
+    const PATTERN_T *p_pattern;
+
+    /* Index of the next step */
+    uint16 step;
+
+    /* Mask of the outputs the pattern has left on */
+    uint16 outputs_on;
+
+} PATTERN_DATA_T;
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+static const PATTERN_STEP_T g_pattern_beep_short[] =
+{
+    {pattern_output_buzzer, 1, PATTERN_BEEP_SHORT},
+    {pattern_output_buzzer, 0, 0}
+};
+
+static const PATTERN_STEP_T g_pattern_beep_long[] =
+{
+    {pattern_output_buzzer, 1, PATTERN_BEEP_LONG},
+    {pattern_output_buzzer, 0, 0}
+};
+
+static const PATTERN_STEP_T g_pattern_beep_twice[] =
+{
+    {pattern_output_buzzer, 1, PATTERN_BEEP_SHORT},
+    {pattern_output_buzzer, 0, PATTERN_BEEP_GAP},
+    {pattern_output_buzzer, 1, PATTERN_BEEP_SHORT},
+    {pattern_output_buzzer, 0, 0}
+};
+
+static const PATTERN_STEP_T g_pattern_beep_thrice[] =
+{
+    {pattern_output_buzzer, 1, PATTERN_BEEP_SHORT},
+    {pattern_output_buzzer, 0, PATTERN_BEEP_GAP},
+    {pattern_output_buzzer, 1, PATTERN_BEEP_SHORT},
+    {pattern_output_buzzer, 0, PATTERN_BEEP_GAP},
+    {pattern_output_buzzer, 1, PATTERN_BEEP_SHORT},
+    {pattern_output_buzzer, 0, 0}
+};
+
+static const PATTERN_STEP_T g_pattern_heartbeat[] =
+{
+    {pattern_output_led,    1, PATTERN_HEARTBEAT_ON},
+    {pattern_output_led,    0, 0}
+};
+
+/* Pattern table, indexed by pattern_id */
+static const PATTERN_T g_patterns[pattern_count] =
+{
+    PATTERN(g_pattern_beep_short),
+    PATTERN(g_pattern_beep_long),
+    PATTERN(g_pattern_beep_twice),
+    PATTERN(g_pattern_beep_thrice),
+    PATTERN(g_pattern_heartbeat)
+};
+
+/* Sequencer data instance */
+static PATTERN_DATA_T g_pattern_data;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+/* Set an output to a level */
+static void patternSetOutput(pattern_output output, uint8 level);
+
+/* Play steps up to the next one with a duration */
+static void patternRun(void);
+
+/* Move to the next step at timer expiry */
+static void patternTimerHandler(timer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      patternSetOutput
+ *
+ *  DESCRIPTION
+ *      This function sets an output to a level, and records whether the
+ *      pattern has left it on.
+ *
+ *  PARAMETERS
+ *      output [in]             Output to set
+ *      level [in]              Level to set it to, zero for off
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void patternSetOutput(pattern_output output, uint8 level)
+{
+    switch(output)
+    {
+        case pattern_output_buzzer:
+            BuzzerSet(level != 0);
+        break;
+
+        case pattern_output_led:
+            LedSet(level != 0);
+        break;
+
+        default:
+            /* No such output */
+            ReportPanic(app_panic_unexpected_pattern);
+        break;
+    }
+
+    if(level != 0)
+    {
+        g_pattern_data.outputs_on |= PATTERN_OUTPUT_MASK(output);
+    }
+    else
+    {
+        g_pattern_data.outputs_on &= ~PATTERN_OUTPUT_MASK(output);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      patternRun
+ *
+ *  DESCRIPTION
+ *      This function plays the steps of the current pattern up to and
+ *      including the next one with a duration, and starts the timer for it.
+ *      The pattern ends after its last step.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void patternRun(void)
+{
+    const PATTERN_T *p_pattern = g_pattern_data.p_pattern;
+    const PATTERN_STEP_T *p_step;
+
+    while(g_pattern_data.step < p_pattern->num_steps)
+    {
+        p_step = &p_pattern->p_steps[g_pattern_data.step++];
+
+        patternSetOutput(p_step->output, p_step->level);
+
+        if(p_step->duration != 0)
+        {
+            g_pattern_data.tid = TimerCreate(
+                                    (uint32)p_step->duration * MILLISECOND,
+                                    TRUE, patternTimerHandler);
+            return;
+        }
+    }
+
+    g_pattern_data.p_pattern = NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      patternTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function moves to the next step of the pattern at the end of the
+ *      current one.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of timer that has expired
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void patternTimerHandler(timer_id tid)
+{
+    if(tid == g_pattern_data.tid)
+    {
+        g_pattern_data.tid = TIMER_INVALID;
+
+        patternRun();
+    }
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PatternInitData
+ *
+ *  DESCRIPTION
+ *      This function initialises the sequencer data to a known state. It is
+ *      intended to be called once, after a power-on reset or HCI reset.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void PatternInitData(void)
+{
+    g_pattern_data.tid = TIMER_INVALID;
+    g_pattern_data.p_pattern = NULL;
+    g_pattern_data.step = 0;
+    g_pattern_data.outputs_on = 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PatternPlay
+ *
+ *  DESCRIPTION
+ *      This function plays a pattern from its first step, stopping any
+ *      pattern already playing. A pattern which drives only outputs left out
+ *      of the build is not played.
+ *
+ *  PARAMETERS
+ *      pattern [in]            Pattern to play
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void PatternPlay(pattern_id pattern)
+{
+    const PATTERN_T *p_pattern;
+    uint16 outputs = 0;
+    uint16 i;
+
+    if(pattern >= pattern_count)
+    {
+        /* No such pattern */
+        ReportPanic(app_panic_unexpected_pattern);
+    }
+
+    PatternStop();
+
+    p_pattern = &g_patterns[pattern];
+
+    for(i = 0; i < p_pattern->num_steps; i++)
+    {
+        outputs |= PATTERN_OUTPUT_MASK(p_pattern->p_steps[i].output);
+    }
+
+    if((outputs & PATTERN_OUTPUTS_ENABLED) != 0)
+    {
+        g_pattern_data.p_pattern = p_pattern;
+        g_pattern_data.step = 0;
+
+        patternRun();
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PatternStop
+ *
+ *  DESCRIPTION
+ *      This function stops the pattern playing and turns off every output it
+ *      left on. It is intended to be called when the hardware data needs to
+ *      be reset to a clean state.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void PatternStop(void)
+{
+    if(g_pattern_data.tid != TIMER_INVALID)
+    {
+        TimerDelete(g_pattern_data.tid);
+        g_pattern_data.tid = TIMER_INVALID;
+    }
+
+    if(g_pattern_data.outputs_on & PATTERN_OUTPUT_MASK(pattern_output_buzzer))
+    {
+        patternSetOutput(pattern_output_buzzer, 0);
+    }
+
+    if(g_pattern_data.outputs_on & PATTERN_OUTPUT_MASK(pattern_output_led))
+    {
+        patternSetOutput(pattern_output_led, 0);
+    }
+
+    g_pattern_data.p_pattern = NULL;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      PatternIsPlaying
+ *
+ *  DESCRIPTION
+ *      This function returns whether a pattern is playing.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if a pattern is playing
+ *----------------------------------------------------------------------------*/
+extern bool PatternIsPlaying(void)
+{
+    return (g_pattern_data.p_pattern != NULL);
+}
+
+#endif /* ENABLE_PATTERNS */
@@ -0,0 +1,90 @@
+/******************************************************************************
+ *  FILE
+ *      pattern.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the feedback pattern sequencer. A pattern is a
+ *      table of steps, each setting the buzzer or the LED to a level and
+ *      then waiting, and every pattern is played on the same timer.
+ *
+ *****************************************************************************/
+
+#ifndef __PATTERN_H__
+#define __PATTERN_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "user_config.h"    /* User configuration */
+
+/* Only compile the sequencer if it has an output to drive */
+#if defined(ENABLE_BUZZER) || defined(ENABLE_LED)
+#define ENABLE_PATTERNS
+#endif
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Feedback patterns, indexing the pattern table in pattern.c */
+typedef enum
+{
+    /* One short beep */
+    pattern_beep_short = 0,
+
+    /* One long beep */
+    pattern_beep_long,
+
+    /* Two short beeps */
+    pattern_beep_twice,
+
+    /* Three short beeps */
+    pattern_beep_thrice,
+
+    /* One flash of LED_HEARTBEAT_ON_TIME */
+    pattern_heartbeat,
+
+    /* Number of patterns */
+    pattern_count
+
+} pattern_id;
+
+#ifdef ENABLE_PATTERNS
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Initialise the sequencer data to a known state */
+extern void PatternInitData(void);
+
+/* Play a pattern, stopping any pattern already playing */
+extern void PatternPlay(pattern_id pattern);
+
+/* Stop the pattern playing and turn off the outputs it turned on */
+extern void PatternStop(void);
+
+/* Return TRUE if a pattern is playing */
+extern bool PatternIsPlaying(void);
+
+#else /* ENABLE_PATTERNS */
+
+/* Define sequencer functions to expand to nothing as there is no output for
+ * it to drive
+ */
+
+#define PatternInitData()
+#define PatternPlay(pattern)
+#define PatternStop()
+#define PatternIsPlaying()                  (FALSE)
+
+#endif /* ENABLE_PATTERNS */
+
+#endif /* __PATTERN_H__ */
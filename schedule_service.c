@@ -0,0 +1,631 @@
+/******************************************************************************
+ *  FILE
+ *      schedule_service.c
+ *
+ *  DESCRIPTION
+ *      This file defines routines for using the Schedule Service. A gateway
+ *      sets the time, which is kept against the uptime clock of the virtual
+ *      timers, counted in seconds since chip reset, and a weekly schedule of
+ *      the windows in
+ *      which the device beacons, each with its own beacon period and TX
+ *      power. The schedule is evaluated on beacon timer wakes, so it costs
+ *      no wakes of its own. The time is lost at chip reset, as there is no
+ *      clock which keeps running through a reset to tell how long the device
+ *      was off. Until the time is set again a device with a schedule does not
+ *      beacon, rather than beacon outside its windows; the configuration
+ *      windows still open, so that a gateway can set the time.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *===========================================================================*/
+
+#include <gatt.h>           /* GATT application interface */
+#include <buf_utils.h>      /* Buffer functions */
+#include <time.h>           /* Chip time functions */
+#include <mem.h>            /* Memory routines */
+
+/*============================================================================*
+ *  Local Header Files
+ *===========================================================================*/
+
+#include "esurl_beacon.h"    /* Definitions used throughout the GATT server */
+#include "schedule_service.h" /* Interface to this file */
+#include "esurl_beacon_service.h" /* Beacon service interface */
+#include "app_gatt_db.h"    /* GATT database definitions */
+#include "nvm_access.h"     /* Non-volatile memory access */
+#include "vtimer.h"         /* Virtual timers */
+
+/*============================================================================*
+ *  Private Definitions
+ *===========================================================================*/
+
+/* Lengths of a day and a week, in seconds */
+#define SCHEDULE_DAY                        (86400UL)
+#define SCHEDULE_WEEK                       (7 * SCHEDULE_DAY)
+
+/* Day of the week of 1970-01-01, a Thursday, counting from Sunday */
+#define SCHEDULE_EPOCH_WEEKDAY              (4)
+
+/* Value of the current window outside every window, and when no schedule
+ * applies
+ */
+#define SCHEDULE_WINDOW_NONE                (0xFFFF)
+#define SCHEDULE_WINDOW_ALWAYS              (0xFFFE)
+
+/* Longest wait for the next window, in seconds, which keeps the timeout of
+ * the beacon timer within VTIMER_TIMEOUT_MAX while the schedule is off. It is
+ * also how often a schedule waiting for the time to be set is checked.
+ */
+#define SCHEDULE_WAIT_MAX                   (20 * 60UL)
+
+/*============================================================================*
+ *  Private Data Types
+ *===========================================================================*/
+
+/* Schedule Service data type */
+typedef struct _SCHEDULE_DATA_T
+{
+    /* Schedule, and the NVM record holding it */
+    SCHEDULE_NVM_T schedule;
+    NVM_RECORD_T nvm_record;
+
+    /* TRUE once the time has been set */
+    bool synced;
+
+    /* Time in seconds since the Unix epoch at an uptime of zero */
+    uint32 epoch_offset;
+
+    /* Local offset from UTC, in minutes */
+    int16 utc_offset;
+
+    /* Index of the current window, SCHEDULE_WINDOW_NONE outside every
+     * window or SCHEDULE_WINDOW_ALWAYS if no schedule applies
+     */
+    uint16 window;
+
+    /* Seconds from the last update to the next window, outside every
+     * window
+     */
+    uint32 next_wait;
+
+} SCHEDULE_DATA_T;
+
+/*============================================================================*
+ *  Private Data
+ *===========================================================================*/
+
+/* Schedule Service data instance */
+static SCHEDULE_DATA_T g_schedule_data;
+
+/* Buffer for reads of the windows characteristic */
+static uint8 g_schedule_buf[SCHEDULE_WINDOWS_MAX * SCHEDULE_WINDOW_SIZE];
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *===========================================================================*/
+
+/* Return the local time in seconds since the start of the week */
+static uint32 scheduleSecondOfWeek(void);
+
+/* Write the windows characteristic */
+static sys_status scheduleWriteWindows(uint8 *p_value, uint16 size);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *===========================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      scheduleSecondOfWeek
+ *
+ *  DESCRIPTION
+ *      This function returns the local time as the number of seconds since
+ *      midnight at the start of Sunday. The time must have been set.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Seconds since the start of the week, local time
+ *----------------------------------------------------------------------------*/
+static uint32 scheduleSecondOfWeek(void)
+{
+    uint32 local = VTimerGetUptime() + g_schedule_data.epoch_offset +
+                   (int32)g_schedule_data.utc_offset * 60;
+    uint32 days = local / SCHEDULE_DAY;
+
+    return ((days + SCHEDULE_EPOCH_WEEKDAY) % 7) * SCHEDULE_DAY +
+           (local - days * SCHEDULE_DAY);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      scheduleWriteWindows
+ *
+ *  DESCRIPTION
+ *      This function checks every window written to the windows
+ *      characteristic and, if they are all valid, replaces the schedule with
+ *      them. A window which opens on no day is invalid. An empty value
+ *      clears the schedule.
+ *
+ *  PARAMETERS
+ *      p_value [in]            Value written
+ *      size [in]               Length of the value, octets
+ *
+ *  RETURNS
+ *      Status of the write
+ *----------------------------------------------------------------------------*/
+static sys_status scheduleWriteWindows(uint8 *p_value, uint16 size)
+{
+    SCHEDULE_WINDOW_T windows[SCHEDULE_WINDOWS_MAX];
+    SCHEDULE_WINDOW_T *p_window;
+    uint16 num_windows = size / SCHEDULE_WINDOW_SIZE;
+    uint16 i;
+
+    if((size % SCHEDULE_WINDOW_SIZE) != 0 ||
+       num_windows > SCHEDULE_WINDOWS_MAX)
+    {
+        return gatt_status_invalid_length;
+    }
+
+    for(i = 0; i < num_windows; i++)
+    {
+        p_window = &windows[i];
+
+        p_window->days = BufReadUint8(&p_value);
+        p_window->start = BufReadUint16(&p_value);
+        p_window->end = BufReadUint16(&p_value);
+        p_window->period = BufReadUint16(&p_value);
+        p_window->tx_power_mode = BufReadUint8(&p_value);
+
+        if(p_window->days == 0 ||
+           (p_window->days & ~SCHEDULE_DAYS_ALL) != 0 ||
+           p_window->start >= SCHEDULE_MINUTES_PER_DAY ||
+           p_window->end > SCHEDULE_MINUTES_PER_DAY ||
+           p_window->end == p_window->start ||
+           (p_window->period != SCHEDULE_PERIOD_CONFIGURED &&
+            p_window->period < BEACON_PERIOD_MIN) ||
+           (p_window->tx_power_mode != SCHEDULE_TX_POWER_CONFIGURED &&
+            p_window->tx_power_mode > TX_POWER_MODE_HIGH))
+        {
+            return gatt_status_app_mask;
+        }
+    }
+
+    MemCopy(g_schedule_data.schedule.windows, windows,
+            num_windows * sizeof(SCHEDULE_WINDOW_T));
+    g_schedule_data.schedule.num_windows = num_windows;
+
+    Nvm_WriteRecordDeferred(&g_schedule_data.nvm_record);
+
+    return sys_status_success;
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *===========================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleInitChipReset
+ *
+ *  DESCRIPTION
+ *      This function is used to initialise the Schedule Service data
+ *      structure at chip reset. The time is not set and the schedule is
+ *      empty.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ScheduleInitChipReset(void)
+{
+    g_schedule_data.schedule.num_windows = 0;
+
+    g_schedule_data.synced = FALSE;
+    g_schedule_data.epoch_offset = 0;
+    g_schedule_data.utc_offset = 0;
+
+    g_schedule_data.window = SCHEDULE_WINDOW_ALWAYS;
+    g_schedule_data.next_wait = 0;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleReadDataFromNVM
+ *
+ *  DESCRIPTION
+ *      This function is used to read the schedule stored in NVM.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ScheduleReadDataFromNVM(void)
+{
+    Nvm_InitRecord(&g_schedule_data.nvm_record, nvm_partition_schedule,
+                   (uint16*)&g_schedule_data.schedule,
+                   sizeof(g_schedule_data.schedule));
+
+    if(!Nvm_ReadRecord(&g_schedule_data.nvm_record) ||
+       g_schedule_data.schedule.num_windows > SCHEDULE_WINDOWS_MAX)
+    {
+        /* No valid copy, restore and rewrite the empty schedule */
+        g_schedule_data.schedule.num_windows = 0;
+        Nvm_WriteRecord(&g_schedule_data.nvm_record);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleWriteDataToNVM
+ *
+ *  DESCRIPTION
+ *      This function is used to write the schedule to NVM.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ScheduleWriteDataToNVM(void)
+{
+    Nvm_InitRecord(&g_schedule_data.nvm_record, nvm_partition_schedule,
+                   (uint16*)&g_schedule_data.schedule,
+                   sizeof(g_schedule_data.schedule));
+
+    Nvm_WriteRecord(&g_schedule_data.nvm_record);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleHandleAccessRead
+ *
+ *  DESCRIPTION
+ *      This function handles read operations on Schedule Service attributes
+ *      maintained by the application and responds with the GATT_ACCESS_RSP
+ *      message.
+ *
+ *  PARAMETERS
+ *      p_ind [in]              Data received in GATT_ACCESS_IND message.
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ScheduleHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
+{
+    uint16 length = 0;                  /* Length of attribute data, octets */
+    uint8 *p_val = g_schedule_buf;      /* Pointer to attribute value */
+    const SCHEDULE_WINDOW_T *p_window;  /* Window being read */
+    uint32 time;                        /* Time read */
+    sys_status rc = sys_status_success; /* Function status */
+    uint16 i;
+
+    switch(p_ind->handle)
+    {
+        case HANDLE_SCHEDULE_TIME:
+            length = SCHEDULE_TIME_SIZE;
+            time = g_schedule_data.synced ?
+                   VTimerGetUptime() + g_schedule_data.epoch_offset : 0;
+            BufWriteUint32(&p_val, &time);
+            BufWriteUint16(&p_val, (uint16)g_schedule_data.utc_offset);
+        break;
+
+        case HANDLE_SCHEDULE_WINDOWS:
+            length = g_schedule_data.schedule.num_windows *
+                     SCHEDULE_WINDOW_SIZE;
+
+            for(i = 0; i < g_schedule_data.schedule.num_windows; i++)
+            {
+                p_window = &g_schedule_data.schedule.windows[i];
+
+                BufWriteUint8(&p_val, p_window->days);
+                BufWriteUint16(&p_val, p_window->start);
+                BufWriteUint16(&p_val, p_window->end);
+                BufWriteUint16(&p_val, p_window->period);
+                BufWriteUint8(&p_val, p_window->tx_power_mode);
+            }
+        break;
+
+        default:
+            rc = gatt_status_read_not_permitted;
+        break;
+    }
+
+    p_val = g_schedule_buf;
+
+    /* The windows may be longer than one ATT PDU, so honour the offset of a
+     * long read
+     */
+    if(rc == sys_status_success)
+    {
+        if(p_ind->offset > length)
+        {
+            rc = gatt_status_invalid_offset;
+            length = 0;
+        }
+        else
+        {
+            length -= p_ind->offset;
+            p_val += p_ind->offset;
+        }
+    }
+
+    /* Send ACCESS RESPONSE */
+    GattAccessRsp(p_ind->cid, p_ind->handle, rc, length, p_val);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleHandleAccessWrite
+ *
+ *  DESCRIPTION
+ *      This function handles write operations on Schedule Service attributes
+ *      maintained by the application and responds with the GATT_ACCESS_RSP
+ *      message. Writes are refused while the beacon is locked.
+ *
+ *  PARAMETERS
+ *      p_ind [in]              Data received in GATT_ACCESS_IND message.
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void ScheduleHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
+{
+    uint8 *p_value = p_ind->value;      /* New attribute value */
+    uint32 time;                        /* Time written */
+    int16 utc_offset;                   /* Offset from UTC written */
+    sys_status rc = sys_status_success; /* Function status */
+
+    if(EsurlBeaconIsLocked())
+    {
+        rc = gatt_status_insufficient_authorization;
+    }
+    else
+    {
+        switch(p_ind->handle)
+        {
+            case HANDLE_SCHEDULE_TIME:
+                if(p_ind->size_value != SCHEDULE_TIME_SIZE)
+                {
+                    rc = gatt_status_invalid_length;
+                    break;
+                }
+
+                time = BufReadUint32(&p_value);
+                utc_offset = (int16)BufReadUint16(&p_value);
+
+                if(utc_offset < SCHEDULE_UTC_OFFSET_MIN ||
+                   utc_offset > SCHEDULE_UTC_OFFSET_MAX)
+                {
+                    rc = gatt_status_app_mask;
+                }
+                else
+                {
+                    /* Hold the time as an offset from the uptime clock */
+                    g_schedule_data.epoch_offset = time - VTimerGetUptime();
+                    g_schedule_data.utc_offset = utc_offset;
+                    g_schedule_data.synced = TRUE;
+                }
+            break;
+
+            case HANDLE_SCHEDULE_WINDOWS:
+                rc = scheduleWriteWindows(p_value, p_ind->size_value);
+            break;
+
+            default:
+                rc = gatt_status_write_not_permitted;
+            break;
+        }
+    }
+
+    /* Send ACCESS RESPONSE */
+    GattAccessRsp(p_ind->cid, p_ind->handle, rc, 0, NULL);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleUpdate
+ *
+ *  DESCRIPTION
+ *      This function finds the window for the current time. The first
+ *      window open now is current, and outside every window it works out
+ *      how long it is until one opens. If the schedule is empty, no schedule
+ *      applies. If the time has not been set since chip reset, the device is
+ *      outside every window until it is.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if the current window changed
+ *----------------------------------------------------------------------------*/
+extern bool ScheduleUpdate(void)
+{
+    const SCHEDULE_WINDOW_T *p_window;
+    uint16 window = SCHEDULE_WINDOW_ALWAYS;
+    uint32 next_wait = SCHEDULE_WEEK;
+    uint32 now, start, length, offset;
+    uint16 i, day;
+
+    if(g_schedule_data.schedule.num_windows != 0)
+    {
+        window = SCHEDULE_WINDOW_NONE;
+    }
+
+    /* Without the time it is not known which window is open. Staying off
+     * saves the battery, where beaconing all the time would spend it.
+     */
+    if(window == SCHEDULE_WINDOW_NONE && g_schedule_data.synced)
+    {
+        now = scheduleSecondOfWeek();
+
+        for(i = 0; i < g_schedule_data.schedule.num_windows &&
+                   window == SCHEDULE_WINDOW_NONE; i++)
+        {
+            p_window = &g_schedule_data.schedule.windows[i];
+
+            length = (uint32)(p_window->end > p_window->start ?
+                    p_window->end - p_window->start :
+                    p_window->end + SCHEDULE_MINUTES_PER_DAY -
+                    p_window->start) * 60;
+
+            for(day = 0; day < 7; day++)
+            {
+                if((p_window->days & (1 << day)) == 0)
+                {
+                    continue;
+                }
+
+                /* Time since the window last opened on this day, modulo a
+                 * week
+                 */
+                start = day * SCHEDULE_DAY + (uint32)p_window->start * 60;
+                offset = (now >= start) ? now - start :
+                                          now + SCHEDULE_WEEK - start;
+
+                if(offset < length)
+                {
+                    window = i;
+                    break;
+                }
+
+                if(SCHEDULE_WEEK - offset < next_wait)
+                {
+                    next_wait = SCHEDULE_WEEK - offset;
+                }
+            }
+        }
+    }
+
+    g_schedule_data.next_wait = next_wait;
+
+    if(window == g_schedule_data.window)
+    {
+        return FALSE;
+    }
+
+    g_schedule_data.window = window;
+
+    return TRUE;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleIsBeaconOn
+ *
+ *  DESCRIPTION
+ *      This function returns whether the device may beacon, as of the last
+ *      call to ScheduleUpdate.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      TRUE if within a window or if no schedule applies, FALSE outside
+ *      every window or while the time of a schedule has not been set
+ *----------------------------------------------------------------------------*/
+extern bool ScheduleIsBeaconOn(void)
+{
+    return (g_schedule_data.window != SCHEDULE_WINDOW_NONE);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleBeaconPeriod
+ *
+ *  DESCRIPTION
+ *      This function returns the beacon period set by the current window,
+ *      or the configured period if the window does not set one.
+ *
+ *  PARAMETERS
+ *      period [in]             Configured beacon period, microseconds
+ *
+ *  RETURNS
+ *      Beacon period to use, microseconds
+ *----------------------------------------------------------------------------*/
+extern uint32 ScheduleBeaconPeriod(uint32 period)
+{
+    const SCHEDULE_WINDOW_T *p_window;
+
+    if(g_schedule_data.window < SCHEDULE_WINDOWS_MAX)
+    {
+        p_window = &g_schedule_data.schedule.windows[g_schedule_data.window];
+
+        if(p_window->period != SCHEDULE_PERIOD_CONFIGURED)
+        {
+            period = (uint32)p_window->period * MILLISECOND;
+        }
+    }
+
+    return period;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleTxPowerMode
+ *
+ *  DESCRIPTION
+ *      This function returns the TX power mode set by the current window,
+ *      or the configured mode if the window does not set one.
+ *
+ *  PARAMETERS
+ *      tx_power_mode [in]      Configured TX power mode
+ *
+ *  RETURNS
+ *      TX power mode to use
+ *----------------------------------------------------------------------------*/
+extern uint8 ScheduleTxPowerMode(uint8 tx_power_mode)
+{
+    const SCHEDULE_WINDOW_T *p_window;
+
+    if(g_schedule_data.window < SCHEDULE_WINDOWS_MAX)
+    {
+        p_window = &g_schedule_data.schedule.windows[g_schedule_data.window];
+
+        if(p_window->tx_power_mode != SCHEDULE_TX_POWER_CONFIGURED)
+        {
+            tx_power_mode = p_window->tx_power_mode;
+        }
+    }
+
+    return tx_power_mode;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      ScheduleTimeToNextWindow
+ *
+ *  DESCRIPTION
+ *      This function returns how long to wait, as of the last call to
+ *      ScheduleUpdate, before the next window opens. A wait longer than
+ *      SCHEDULE_WAIT_MAX is made in steps.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Time to wait, microseconds
+ *----------------------------------------------------------------------------*/
+extern uint32 ScheduleTimeToNextWindow(void)
+{
+    uint32 wait = g_schedule_data.next_wait;
+
+    if(wait > SCHEDULE_WAIT_MAX)
+    {
+        wait = SCHEDULE_WAIT_MAX;
+    }
+    else if(wait == 0)
+    {
+        wait = 1;
+    }
+
+    return wait * SECOND;
+}
@@ -0,0 +1,134 @@
+/******************************************************************************
+ *  FILE
+ *      schedule_service.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the Schedule Service, which holds the time set
+ *      by a gateway and a weekly schedule of the windows in which the device
+ *      beacons.
+ *
+ *****************************************************************************/
+
+#ifndef __SCHEDULE_SERVICE_H__
+#define __SCHEDULE_SERVICE_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <gatt.h>           /* GATT application interface */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* The time characteristic holds, in little endian order:
+ *  - the time in seconds since 1970-01-01 00:00 UTC (4 octets)
+ *  - the local offset from UTC in minutes, signed (2 octets)
+ * A read before the time has been set since the last reset returns a time
+ * of zero.
+ */
+#define SCHEDULE_TIME_SIZE                  (6)
+
+/* Range of the local offset from UTC, in minutes */
+#define SCHEDULE_UTC_OFFSET_MIN             (-720)
+#define SCHEDULE_UTC_OFFSET_MAX             (840)
+
+/* The windows characteristic holds up to SCHEDULE_WINDOWS_MAX windows. Each
+ * window holds, in little endian order:
+ *  - the days it opens on, bit 0 for Sunday to bit 6 for Saturday (1 octet)
+ *  - the minute of the day it opens, 0 to 1439 (2 octets)
+ *  - the minute of the day it closes, 0 to 1440, where a window closing
+ *    before it opens runs past midnight (2 octets)
+ *  - the beacon period in milliseconds, or SCHEDULE_PERIOD_CONFIGURED for
+ *    the configured period (2 octets)
+ *  - the TX power mode, or SCHEDULE_TX_POWER_CONFIGURED for the configured
+ *    mode (1 octet)
+ * Outside every window the device does not beacon. Where windows overlap
+ * the first one applies. With no windows the device beacons all the time.
+ * The time is lost at chip reset, and until it has been set again a device
+ * with windows does not beacon at all.
+ */
+#define SCHEDULE_WINDOW_SIZE                (8)
+#define SCHEDULE_WINDOWS_MAX                (8)
+
+#define SCHEDULE_DAYS_ALL                   (0x7F)
+#define SCHEDULE_MINUTES_PER_DAY            (1440)
+#define SCHEDULE_PERIOD_CONFIGURED          (0)
+#define SCHEDULE_TX_POWER_CONFIGURED        (0xFF)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Beaconing window */
+typedef struct _SCHEDULE_WINDOW_T
+{
+    /* Days on which the window opens, bit 0 for Sunday */
+    uint8 days;
+
+    /* Minute of the day at which the window opens */
+    uint16 start;
+
+    /* Minute of the day at which the window closes */
+    uint16 end;
+
+    /* Beacon period in milliseconds, or SCHEDULE_PERIOD_CONFIGURED */
+    uint16 period;
+
+    /* TX power mode, or SCHEDULE_TX_POWER_CONFIGURED */
+    uint8 tx_power_mode;
+
+} SCHEDULE_WINDOW_T;
+
+/* Schedule kept in NVM */
+typedef struct _SCHEDULE_NVM_T
+{
+    /* Number of windows in use */
+    uint16 num_windows;
+
+    /* Windows, in order of precedence */
+    SCHEDULE_WINDOW_T windows[SCHEDULE_WINDOWS_MAX];
+
+} SCHEDULE_NVM_T;
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Initialise the Schedule Service data structure at chip reset */
+extern void ScheduleInitChipReset(void);
+
+/* Read the Schedule Service specific data stored in NVM */
+extern void ScheduleReadDataFromNVM(void);
+
+/* Write the Schedule Service specific data to NVM */
+extern void ScheduleWriteDataToNVM(void);
+
+/* Handle read operations on Schedule Service attributes maintained by the
+ * application
+ */
+extern void ScheduleHandleAccessRead(GATT_ACCESS_IND_T *p_ind);
+
+/* Handle write operations on Schedule Service attributes maintained by the
+ * application
+ */
+extern void ScheduleHandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
+
+/* Find the window for the current time, returning TRUE if it changed */
+extern bool ScheduleUpdate(void);
+
+/* Return TRUE if the device may beacon in the current window */
+extern bool ScheduleIsBeaconOn(void);
+
+/* Return the beacon period to use in place of the configured period */
+extern uint32 ScheduleBeaconPeriod(uint32 period);
+
+/* Return the TX power mode to use in place of the configured mode */
+extern uint8 ScheduleTxPowerMode(uint8 tx_power_mode);
+
+/* Return the time to wait before the next window opens */
+extern uint32 ScheduleTimeToNextWindow(void);
+
+#endif /* __SCHEDULE_SERVICE_H__ */
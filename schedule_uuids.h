@@ -0,0 +1,29 @@
+/******************************************************************************
+ *  FILE
+ *      schedule_uuids.h
+ *
+ *  DESCRIPTION
+ *      UUID MACROs for the Betrack Schedule Service
+ *
+ *****************************************************************************/
+
+#ifndef __SCHEDULE_UUIDS_H__
+#define __SCHEDULE_UUIDS_H__
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Brackets should not be used around the values of these macros. This file is
+ * imported by the GATT Database Generator (gattdbgen) which does not understand
+ * brackets and will raise syntax errors.
+ */
+
+/* Schedule service UUID */
+#define UUID_SCHEDULE_SERVICE                   0xee0c20b0878640baab9699b91ac981d8
+
+/* Characteristics */
+#define UUID_SCHEDULE_TIME                      0xee0c20b1878640baab9699b91ac981d8
+#define UUID_SCHEDULE_WINDOWS                   0xee0c20b2878640baab9699b91ac981d8
+
+#endif /* __SCHEDULE_UUIDS_H__ */
@@ -0,0 +1,536 @@
+/******************************************************************************
+ *  FILE
+ *      telemetry_service.c
+ *
+ *  DESCRIPTION
+ *      This file defines routines for using the Telemetry Service. While the
+ *      client has notifications enabled, the battery level, temperature and
+ *      beacon packet counter are sampled every sample period and notified as
+ *      compact records, so that a commissioning client gets a live view
+ *      without an ATT read per value. When the sample period is shorter than
+ *      the connection interval, several records share one notification, and
+ *      the stream runs no faster than TELEMETRY_RECORDS_MAX records per
+ *      connection interval so that it never outruns the link.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *===========================================================================*/
+
+#include <gatt.h>           /* GATT application interface */
+#include <buf_utils.h>      /* Buffer functions */
+#include <time.h>           /* Chip time functions */
+
+/*============================================================================*
+ *  Local Header Files
+ *===========================================================================*/
+
+#include "esurl_beacon.h"    /* Definitions used throughout the GATT server */
+#include "telemetry_service.h" /* Interface to this file */
+#include "battery_service.h"/* Battery service interface */
+#include "temperature_service.h"/* Temperature service interface */
+#include "esurl_beacon_service.h" /* Beacon service interface */
+#include "conn_param_policy.h" /* Connection parameter policy */
+#include "app_gatt_db.h"    /* GATT database definitions */
+#include "vtimer.h"         /* Virtual timers */
+
+/*============================================================================*
+ *  Private Definitions
+ *===========================================================================*/
+
+/* Length of a connection interval unit, in microseconds */
+#define TELEMETRY_CONN_INTERVAL_UNIT        (1250)
+
+/* Fraction of the sample period by which a sample may be taken late, to
+ * share a wake with other work. Each record carries its own sample time,
+ * and the next sample is due a period after the last one was due rather
+ * than after it was taken, so lateness does not slow the stream.
+ */
+#define TELEMETRY_SAMPLE_SLACK_DIVISOR      (8)
+
+/*============================================================================*
+ *  Private Data Types
+ *===========================================================================*/
+
+/* Telemetry Service data type */
+typedef struct _TELEMETRY_DATA_T
+{
+    /* Client configuration descriptor for the stream characteristic. It is
+     * not kept in NVM, as a stream is only wanted for one session.
+     */
+    gatt_client_config stream_client_config;
+
+    /* Connection ID of the client receiving the stream */
+    uint16 ucid;
+
+    /* Sample period in milliseconds */
+    uint16 period;
+
+    /* Timer for taking the next sample, and the system time at which the
+     * sample is due
+     */
+    vtimer_id sample_tid;
+    uint32 sample_due;
+
+    /* Running sample time in milliseconds, and the system time up to which
+     * it has counted
+     */
+    uint16 time_ms;
+    uint32 time_last;
+
+    /* Records waiting to be notified */
+    uint8 records[TELEMETRY_RECORDS_MAX * TELEMETRY_RECORD_SIZE];
+
+    /* Number of records waiting to be notified */
+    uint16 num_records;
+
+} TELEMETRY_DATA_T;
+
+/*============================================================================*
+ *  Private Data
+ *===========================================================================*/
+
+/* Telemetry Service data instance */
+static TELEMETRY_DATA_T g_telemetry_data;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *===========================================================================*/
+
+/* Return the sample period in effect, which the link can carry */
+static uint32 telemetryEffectivePeriod(void);
+
+/* Return the number of records to send in each notification */
+static uint16 telemetryRecordsPerNotification(void);
+
+/* Append a record of the current telemetry to the records waiting */
+static void telemetryAddRecord(void);
+
+/* Start or stop the stream */
+static void telemetryStream(bool start);
+
+/* Start the timer for the next sample */
+static void telemetryStartSampleTimer(uint32 timeout);
+
+/* Handle the expiry of the sample timer */
+static void telemetrySampleTimerHandler(vtimer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *===========================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      telemetryEffectivePeriod
+ *
+ *  DESCRIPTION
+ *      This function returns the sample period in effect. It is the period
+ *      the client asked for, unless that would fill more than one
+ *      notification of TELEMETRY_RECORDS_MAX records each connection
+ *      interval, in which case it is stretched to what the link can carry.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Sample period, microseconds
+ *----------------------------------------------------------------------------*/
+static uint32 telemetryEffectivePeriod(void)
+{
+    uint32 interval = (uint32)ConnParamGetInterval() *
+                      TELEMETRY_CONN_INTERVAL_UNIT;
+    uint32 period = (uint32)g_telemetry_data.period * MILLISECOND;
+    uint32 period_min = (interval + TELEMETRY_RECORDS_MAX - 1) /
+                        TELEMETRY_RECORDS_MAX;
+
+    return (period < period_min) ? period_min : period;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      telemetryRecordsPerNotification
+ *
+ *  DESCRIPTION
+ *      This function returns the number of records to send in each
+ *      notification: enough that, on average, at most one notification is
+ *      sent each connection interval.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Number of records, from 1 to TELEMETRY_RECORDS_MAX
+ *----------------------------------------------------------------------------*/
+static uint16 telemetryRecordsPerNotification(void)
+{
+    uint32 interval = (uint32)ConnParamGetInterval() *
+                      TELEMETRY_CONN_INTERVAL_UNIT;
+    uint32 period = telemetryEffectivePeriod();
+    uint32 records = (interval + period - 1) / period;
+
+    if(records < 1)
+    {
+        records = 1;
+    }
+    else if(records > TELEMETRY_RECORDS_MAX)
+    {
+        records = TELEMETRY_RECORDS_MAX;
+    }
+
+    return (uint16)records;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      telemetryAddRecord
+ *
+ *  DESCRIPTION
+ *      This function samples the telemetry and appends a record of it to the
+ *      records waiting to be notified. If they are full, because the link
+ *      has not taken the last notification, the oldest record is dropped.
+ *      The sample time is counted up from the system time in whole
+ *      milliseconds, so that it runs on continuously modulo 2^16 across
+ *      wraps of the 32-bit system time.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void telemetryAddRecord(void)
+{
+    uint8 *p_record;
+    uint32 elapsed_ms = (TimeGet32() - g_telemetry_data.time_last) /
+                        MILLISECOND;
+    uint16 packet = (uint16)EsurlBeaconGetPacketCount();
+    uint16 i;
+
+    g_telemetry_data.time_ms += (uint16)elapsed_ms;
+    g_telemetry_data.time_last += elapsed_ms * MILLISECOND;
+
+    if(g_telemetry_data.num_records == TELEMETRY_RECORDS_MAX)
+    {
+        /* Drop the oldest record */
+        for(i = 0; i < (TELEMETRY_RECORDS_MAX - 1) * TELEMETRY_RECORD_SIZE;
+            i++)
+        {
+            g_telemetry_data.records[i] =
+                g_telemetry_data.records[i + TELEMETRY_RECORD_SIZE];
+        }
+
+        -- g_telemetry_data.num_records;
+    }
+
+    p_record = &g_telemetry_data.records[
+                        g_telemetry_data.num_records * TELEMETRY_RECORD_SIZE];
+
+    BufWriteUint16(&p_record, g_telemetry_data.time_ms);
+    BufWriteUint8(&p_record, readBatteryLevel());
+    BufWriteUint8(&p_record, (uint8)readTemperature());
+    BufWriteUint16(&p_record, packet);
+
+    ++ g_telemetry_data.num_records;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      telemetryStream
+ *
+ *  DESCRIPTION
+ *      This function starts or stops the stream. Records waiting to be
+ *      notified are discarded either way.
+ *
+ *  PARAMETERS
+ *      start [in]              TRUE to start the stream, FALSE to stop it
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void telemetryStream(bool start)
+{
+    if(g_telemetry_data.sample_tid != VTIMER_INVALID)
+    {
+        VTimerDelete(g_telemetry_data.sample_tid);
+        g_telemetry_data.sample_tid = VTIMER_INVALID;
+    }
+
+    g_telemetry_data.num_records = 0;
+
+    if(start)
+    {
+        /* The sample time carries on from where the last stream left it,
+         * as the system time may have wrapped since
+         */
+        g_telemetry_data.time_last = TimeGet32();
+
+        g_telemetry_data.sample_due = g_telemetry_data.time_last +
+                                      telemetryEffectivePeriod();
+        telemetryStartSampleTimer(telemetryEffectivePeriod());
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      telemetryStartSampleTimer
+ *
+ *  DESCRIPTION
+ *      This function starts the timer for the next sample.
+ *
+ *  PARAMETERS
+ *      timeout [in]            Time to the sample, microseconds
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void telemetryStartSampleTimer(uint32 timeout)
+{
+    g_telemetry_data.sample_tid = VTimerCreate(timeout,
+                            telemetryEffectivePeriod() /
+                            TELEMETRY_SAMPLE_SLACK_DIVISOR,
+                            telemetrySampleTimerHandler);
+
+    if(g_telemetry_data.sample_tid == VTIMER_INVALID)
+    {
+        ReportPanic(app_panic_timer_create);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      telemetrySampleTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function takes a sample when the sample timer expires, and
+ *      notifies the records waiting once there are enough of them. The next
+ *      sample is due a period after this one was due, however late the
+ *      timer expired. If the stream has fallen more than a period behind,
+ *      it starts again from now rather than catch up in a burst.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of timer that has expired
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void telemetrySampleTimerHandler(vtimer_id tid)
+{
+    uint32 now;
+    int32 wait;
+
+    if(tid == g_telemetry_data.sample_tid)
+    {
+        now = TimeGet32();
+
+        g_telemetry_data.sample_due += telemetryEffectivePeriod();
+        wait = (int32)(g_telemetry_data.sample_due - now);
+
+        if(wait <= 0)
+        {
+            g_telemetry_data.sample_due = now + telemetryEffectivePeriod();
+            wait = (int32)telemetryEffectivePeriod();
+        }
+
+        telemetryStartSampleTimer((uint32)wait);
+
+        telemetryAddRecord();
+
+        if(g_telemetry_data.num_records >= telemetryRecordsPerNotification() &&
+           GattCharValueNotification(g_telemetry_data.ucid,
+                                     HANDLE_TELEMETRY_STREAM,
+                                     g_telemetry_data.num_records *
+                                     TELEMETRY_RECORD_SIZE,
+                                     g_telemetry_data.records) ==
+                                                        sys_status_success)
+        {
+            /* Records which could not be sent are kept, and go with the
+             * next notification
+             */
+            g_telemetry_data.num_records = 0;
+
+            /* A running stream is client activity, so keep the connection
+             * in the fast phase of the connection parameter policy for as
+             * long as the stream lasts
+             */
+            ConnParamActivity();
+        }
+    }
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *===========================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TelemetryDataInit
+ *
+ *  DESCRIPTION
+ *      This function is used to initialise the Telemetry Service data
+ *      structure. It stops any stream.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TelemetryDataInit(void)
+{
+    telemetryStream(FALSE);
+
+    g_telemetry_data.stream_client_config = gatt_client_config_none;
+    g_telemetry_data.ucid = GATT_INVALID_UCID;
+    g_telemetry_data.period = TELEMETRY_PERIOD_DEFAULT;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TelemetryInitChipReset
+ *
+ *  DESCRIPTION
+ *      This function is used to initialise the Telemetry Service data
+ *      structure at chip reset.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TelemetryInitChipReset(void)
+{
+    g_telemetry_data.sample_tid = VTIMER_INVALID;
+    g_telemetry_data.time_ms = 0;
+
+    TelemetryDataInit();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TelemetryHandleAccessRead
+ *
+ *  DESCRIPTION
+ *      This function handles read operations on Telemetry Service attributes
+ *      maintained by the application and responds with the GATT_ACCESS_RSP
+ *      message.
+ *
+ *  PARAMETERS
+ *      p_ind [in]              Data received in GATT_ACCESS_IND message.
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TelemetryHandleAccessRead(GATT_ACCESS_IND_T *p_ind)
+{
+    uint16 length = 0;                  /* Length of attribute data, octets */
+    uint8  value[2];                    /* Attribute value */
+    uint8 *p_val = value;               /* Pointer to attribute value */
+    sys_status rc = sys_status_success; /* Function status */
+
+    switch(p_ind->handle)
+    {
+        case HANDLE_TELEMETRY_STREAM_C_CFG:
+            length = 2; /* Two Octets */
+            BufWriteUint16(&p_val, g_telemetry_data.stream_client_config);
+        break;
+
+        case HANDLE_TELEMETRY_PERIOD:
+            length = TELEMETRY_PERIOD_SIZE;
+            BufWriteUint16(&p_val, g_telemetry_data.period);
+        break;
+
+        default:
+            rc = gatt_status_read_not_permitted;
+        break;
+    }
+
+    /* Send ACCESS RESPONSE */
+    GattAccessRsp(p_ind->cid, p_ind->handle, rc, length, value);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      TelemetryHandleAccessWrite
+ *
+ *  DESCRIPTION
+ *      This function handles write operations on Telemetry Service attributes
+ *      maintained by the application and responds with the GATT_ACCESS_RSP
+ *      message.
+ *
+ *  PARAMETERS
+ *      p_ind [in]              Data received in GATT_ACCESS_IND message.
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void TelemetryHandleAccessWrite(GATT_ACCESS_IND_T *p_ind)
+{
+    uint8 *p_value = p_ind->value;      /* New attribute value */
+    uint16 client_config;               /* Client configuration descriptor */
+    uint16 period;                      /* Sample period */
+    sys_status rc = sys_status_success; /* Function status */
+
+    switch(p_ind->handle)
+    {
+        case HANDLE_TELEMETRY_STREAM_C_CFG:
+            /* A client configuration descriptor is two octets */
+            if(p_ind->size_value != 2)
+            {
+                rc = gatt_status_invalid_length;
+                break;
+            }
+
+            client_config = BufReadUint16(&p_value);
+
+            /* Only notifications are allowed for this client configuration
+             * descriptor.
+             */
+            if((client_config == gatt_client_config_notification) ||
+               (client_config == gatt_client_config_none))
+            {
+                g_telemetry_data.stream_client_config = client_config;
+                g_telemetry_data.ucid = p_ind->cid;
+
+                telemetryStream(client_config ==
+                                gatt_client_config_notification);
+            }
+            else
+            {
+                /* Return error as only notifications are supported */
+                rc = gatt_status_app_mask;
+            }
+        break;
+
+        case HANDLE_TELEMETRY_PERIOD:
+            if(p_ind->size_value != TELEMETRY_PERIOD_SIZE)
+            {
+                rc = gatt_status_invalid_length;
+            }
+            else
+            {
+                period = BufReadUint16(&p_value);
+                if(period < TELEMETRY_PERIOD_MIN)
+                {
+                    period = TELEMETRY_PERIOD_MIN;
+                }
+                g_telemetry_data.period = period;
+
+                /* Restart a running stream at the new rate */
+                if(g_telemetry_data.stream_client_config ==
+                   gatt_client_config_notification)
+                {
+                    telemetryStream(TRUE);
+                }
+            }
+        break;
+
+        default:
+            rc = gatt_status_write_not_permitted;
+        break;
+    }
+
+    /* Send ACCESS RESPONSE */
+    GattAccessRsp(p_ind->cid, p_ind->handle, rc, 0, NULL);
+}
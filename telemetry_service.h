@@ -0,0 +1,64 @@
+/******************************************************************************
+ *  FILE
+ *      telemetry_service.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the Telemetry Service, which streams live
+ *      telemetry records to a connected client.
+ *
+ *****************************************************************************/
+
+#ifndef __TELEMETRY_SERVICE_H__
+#define __TELEMETRY_SERVICE_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <gatt.h>           /* GATT application interface */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Each telemetry record holds, in little endian order:
+ *  - the sample time in milliseconds, modulo 2^16 (2 octets)
+ *  - the battery level in percent (1 octet)
+ *  - the temperature in degrees Celsius, signed (1 octet)
+ *  - the beacon packet counter, modulo 2^16 (2 octets)
+ */
+#define TELEMETRY_RECORD_SIZE               (6)
+
+/* Most records carried by one notification. A notification carries more
+ * than one record when the sample period is shorter than the connection
+ * interval.
+ */
+#define TELEMETRY_RECORDS_MAX               (3)
+
+/* Default, minimum and size of the sample period, in milliseconds */
+#define TELEMETRY_PERIOD_DEFAULT            (1000)
+#define TELEMETRY_PERIOD_MIN                (20)
+#define TELEMETRY_PERIOD_SIZE               (2)
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Initialise the Telemetry Service data structure */
+extern void TelemetryDataInit(void);
+
+/* Initialise the Telemetry Service data structure at chip reset */
+extern void TelemetryInitChipReset(void);
+
+/* Handle read operations on Telemetry Service attributes maintained by the
+ * application
+ */
+extern void TelemetryHandleAccessRead(GATT_ACCESS_IND_T *p_ind);
+
+/* Handle write operations on Telemetry Service attributes maintained by the
+ * application
+ */
+extern void TelemetryHandleAccessWrite(GATT_ACCESS_IND_T *p_ind);
+
+#endif /* __TELEMETRY_SERVICE_H__ */
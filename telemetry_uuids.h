@@ -0,0 +1,29 @@
+/******************************************************************************
+ *  FILE
+ *      telemetry_uuids.h
+ *
+ *  DESCRIPTION
+ *      UUID MACROs for the Betrack Telemetry Service
+ *
+ *****************************************************************************/
+
+#ifndef __TELEMETRY_UUIDS_H__
+#define __TELEMETRY_UUIDS_H__
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Brackets should not be used around the values of these macros. This file is
+ * imported by the GATT Database Generator (gattdbgen) which does not understand
+ * brackets and will raise syntax errors.
+ */
+
+/* Telemetry service UUID */
+#define UUID_TELEMETRY_SERVICE                  0xee0c20a0878640baab9699b91ac981d8
+
+/* Characteristics */
+#define UUID_TELEMETRY_STREAM                   0xee0c20a1878640baab9699b91ac981d8
+#define UUID_TELEMETRY_PERIOD                   0xee0c20a2878640baab9699b91ac981d8
+
+#endif /* __TELEMETRY_UUIDS_H__ */
@@ -38,8 +38,13 @@ typedef struct _TEMP_DATA_T
     /* Client configuration descriptor for Temperature Level characteristic */
     gatt_client_config temp_client_config;
 
-    /* NVM Offset at which Temperature data is stored */
-    uint16 nvm_offset;
+    /* Client configuration of each bonded host, indexed like the bonding
+     * table, so that a host does not see the configuration of another
+     */
+    gatt_client_config bonded_client_config[MAX_BONDED_HOSTS];
+
+    /* NVM record holding the client configurations of the bonded hosts */
+    NVM_RECORD_T nvm_record;
 
 } TEMP_DATA_T;
 
@@ -54,16 +59,6 @@ static TEMP_DATA_T g_temp_data;
  *  Private Definitions
  *===========================================================================*/
 
-/* Number of words of NVM memory used by Temperature Service */
-#define TEMPERATURE_SERVICE_NVM_MEMORY_WORDS              (1)
-
-/* The offset of data being stored in NVM for the Temperature Service. This offset
- * is added to the Temperature Service offset in the NVM region (see
- * g_temp_data.nvm_offset) to get the absolute offset at which this data is
- * stored in NVM.
- */
-#define TEMPERATURE_NVM_CLIENT_CONFIG_OFFSET        (0)
-
 /*============================================================================*
  *  Private Function Prototypes
  *===========================================================================*/
@@ -110,11 +105,18 @@ int16 readTemperature(void)
  *----------------------------------------------------------------------------*/
 extern void TemperatureDataInit(void)
 {
-    if(!IsDeviceBonded())
+    uint8 index = GetBondIndex();
+
+    /* Use the client configuration stored for the connected host if it is
+     * bonded, otherwise start with notifications disabled
+     */
+    if(index != APP_BOND_INDEX_INVALID)
+    {
+        g_temp_data.temp_client_config =
+                            g_temp_data.bonded_client_config[index];
+    }
+    else
     {
-        /* Initialise Temperature level client configuration characterisitic
-         * descriptor value only if device is not bonded
-         */
         g_temp_data.temp_client_config = gatt_client_config_none;
     }
 }
@@ -151,31 +153,31 @@ extern void TemperatureInitChipReset(void)
  *      NVM.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to Temperature Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void TemperatureReadDataFromNVM(uint16 *p_offset)
+extern void TemperatureReadDataFromNVM(void)
 {
+    uint8 i;
 
-    g_temp_data.nvm_offset = *p_offset;
+    Nvm_InitRecord(&g_temp_data.nvm_record, nvm_partition_temperature,
+                   (uint16*)g_temp_data.bonded_client_config,
+                   sizeof(g_temp_data.bonded_client_config));
 
-    /* Read NVM only if devices are bonded */
-    if(IsDeviceBonded())
+    /* Read the client configurations of the bonded hosts. If neither copy
+     * is valid, fall back to no notifications and rewrite the record.
+     */
+    if(!Nvm_ReadRecord(&g_temp_data.nvm_record))
     {
-        /* Read Temperature level client configuration descriptor */
-        Nvm_Read((uint16*)&g_temp_data.temp_client_config,
-                sizeof(g_temp_data.temp_client_config),
-                *p_offset + 
-                TEMPERATURE_NVM_CLIENT_CONFIG_OFFSET);
-    }
+        for(i = 0; i < MAX_BONDED_HOSTS; i++)
+        {
+            g_temp_data.bonded_client_config[i] = gatt_client_config_none;
+        }
 
-    /* Increment the offset by the number of words of NVM memory required 
-     * by the Temperature Service 
-     */
-    *p_offset += TEMPERATURE_SERVICE_NVM_MEMORY_WORDS;
+        Nvm_WriteRecord(&g_temp_data.nvm_record);
+    }
 
 }
 /*----------------------------------------------------------------------------*
@@ -187,21 +189,26 @@ extern void TemperatureReadDataFromNVM(uint16 *p_offset)
  *      NVM.
  *
  *  PARAMETERS
- *      p_offset [in]           Offset to Beacon Service data in NVM
- *               [out]          Offset to next entry in NVM
+ *      None
  *
  *  RETURNS
  *      Nothing
  *----------------------------------------------------------------------------*/
-extern void TemperatureWriteDataToNVM(uint16 *p_offset)
+extern void TemperatureWriteDataToNVM(void)
 {
+    uint8 i;
 
-    g_temp_data.nvm_offset = *p_offset;
-    
-    /* Increment the offset by the number of words of NVM memory required 
-     * by the Beacon Service 
-     */
-    *p_offset += TEMPERATURE_SERVICE_NVM_MEMORY_WORDS;
+    Nvm_InitRecord(&g_temp_data.nvm_record, nvm_partition_temperature,
+                   (uint16*)g_temp_data.bonded_client_config,
+                   sizeof(g_temp_data.bonded_client_config));
+
+    for(i = 0; i < MAX_BONDED_HOSTS; i++)
+    {
+        g_temp_data.bonded_client_config[i] = gatt_client_config_none;
+    }
+
+    /* Write the client configurations to NVM for the first time */
+    Nvm_WriteRecord(&g_temp_data.nvm_record);
 }
 
 /*----------------------------------------------------------------------------*
@@ -265,17 +272,18 @@ extern void TemperatureUpdate(uint16 ucid)
  *----------------------------------------------------------------------------*/
 extern void TemperatureBondingNotify(void)
 {
+    uint8 index = GetBondIndex();
 
     /* Write data to NVM if bond is established */
-    if(IsDeviceBonded())
+    if(index != APP_BOND_INDEX_INVALID)
     {
-        /* Write to NVM the client configuration value of Temperature level 
-         * that was configured prior to bonding 
+        /* Write to NVM the client configuration value of Temperature level
+         * that was configured prior to bonding, in place of that of any host
+         * the entry was taken from
          */
-        Nvm_Write((uint16*)&g_temp_data.temp_client_config, 
-                  sizeof(g_temp_data.temp_client_config), 
-                  g_temp_data.nvm_offset + 
-                  TEMPERATURE_NVM_CLIENT_CONFIG_OFFSET);
+        g_temp_data.bonded_client_config[index] =
+                            g_temp_data.temp_client_config;
+        Nvm_WriteRecord(&g_temp_data.nvm_record);
     }
 
 }
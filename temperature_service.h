@@ -31,10 +31,10 @@ extern void TemperatureDataInit(void);
 extern void TemperatureInitChipReset(void);
 
 /* Read the Temperature Service specific data stored in NVM */
-extern void TemperatureReadDataFromNVM(uint16 *p_offset);
+extern void TemperatureReadDataFromNVM(void);
 
 /* Write the Temperature Service specific data to NVM */
-extern void TemperatureWriteDataToNVM(uint16 *p_offset);
+extern void TemperatureWriteDataToNVM(void);
 
 /* Monitor the temperature and trigger notifications (if configured) to the
  * connected host
@@ -43,17 +43,60 @@
  *  Public Definitions
  *============================================================================*/
 
+/* The BUILD_PROFILE_xxx macros select the feature set of a build. The
+ * profile is set in the "defines" property of the project configuration:
+ * the Release configuration builds BUILD_PROFILE_PRODUCTION_MIN and the
+ * Debug configuration BUILD_PROFILE_FIELD_DEBUG. If no profile is set,
+ * BUILD_PROFILE_FIELD_DEBUG is used.
+ *
+ *  BUILD_PROFILE_PRODUCTION_MIN    No LED, buzzer or debug output, so the
+ *                                  tag carries no UART, PWM or debug code
+ *  BUILD_PROFILE_FIELD_DEBUG       LED heartbeat and debug output on the
+ *                                  UART, for installation and diagnosis
+ *  BUILD_PROFILE_LAB               As field debug, with the buzzer as well
+ *
+ * A subsystem left out of a profile compiles to no code and no RAM.
+ */
+#if !defined(BUILD_PROFILE_PRODUCTION_MIN) && \
+    !defined(BUILD_PROFILE_FIELD_DEBUG) && \
+    !defined(BUILD_PROFILE_LAB)
+#define BUILD_PROFILE_FIELD_DEBUG
+#endif
+
+#if (defined(BUILD_PROFILE_PRODUCTION_MIN) + \
+     defined(BUILD_PROFILE_FIELD_DEBUG) + \
+     defined(BUILD_PROFILE_LAB)) > 1
+#error "Only one BUILD_PROFILE_xxx may be defined"
+#endif
+
+
 /* The ENABLE_BUZZER macro controls whether buzzer control code is compiled.
  * This flag may be disabled to prevent use of the buzzer, for example to
  * provide more accurate current consumption measurements.
  */
-/*
+#if defined(BUILD_PROFILE_LAB)
 #define ENABLE_BUZZER
-*/
+#endif
 
 /* The ENABLE_LED macro controls whether LED control code is compiled. */
-
+#if defined(BUILD_PROFILE_FIELD_DEBUG) || defined(BUILD_PROFILE_LAB)
 #define ENABLE_LED
+#endif
+
+
+/* The LED_HEARTBEAT_PERIOD macro, when defined, makes a beaconing device
+ * flash its LED for LED_HEARTBEAT_ON_TIME at the first beacon wake after
+ * each heartbeat period, instead of keeping it glowing. The flash adds a few
+ * milliseconds to a wake that happens anyway, so it costs far less current
+ * than the glow. If the beacon period is longer, the LED flashes on every
+ * beacon wake. Production builds may leave ENABLE_LED undefined to remove
+ * the LED altogether.
+ */
+
+#ifdef ENABLE_LED
+#define LED_HEARTBEAT_PERIOD                (5 * SECOND)
+#define LED_HEARTBEAT_ON_TIME               (5 * MILLISECOND)
+#endif /* ENABLE_LED */
 
   
 /* The PAIRING_SUPPORT macro controls whether pairing and encryption code is
@@ -64,9 +107,60 @@
 #define PAIRING_SUPPORT
 */
 
-/* This macro when defined enables the debug output on UART */
+/* The ENABLE_DIRECTED_ADVERTS macro controls whether a bonded host, which
+ * is not using a resolvable random address, is first sent a 1.28 second
+ * burst of high duty cycle directed advertisements when the device becomes
+ * connectable. This cuts the reconnection time of a gateway from seconds
+ * to milliseconds, at the cost of the burst's extra current.
+ */
+
+#define ENABLE_DIRECTED_ADVERTS
 
+
+/* The CONFIG_WINDOW_PERIOD macro specifies how often a beaconing device opens
+ * a connectable configuration window without a button press, so that a
+ * gateway can reach a tag which is out of reach of a finger. The window lasts
+ * CONFIG_WINDOW_LENGTH. The period is counted in beacon periods, so a window
+ * opens at the first beacon period boundary after it has elapsed.
+ * If CONFIG_WINDOW_PERIOD is not defined no window is opened.
+ */
+
+#define CONFIG_WINDOW_PERIOD                (60 * MINUTE)
+#define CONFIG_WINDOW_LENGTH                (2 * SECOND)
+
+
+/* The CONFIG_WINDOW_WHITELIST_ONLY macro, when defined, restricts the
+ * configuration windows of a bonded device to its bonded hosts. A device
+ * which is not bonded is open to any host, so that it can be commissioned.
+ */
+/*
+#define CONFIG_WINDOW_WHITELIST_ONLY
+*/
+
+
+/* The ENABLE_BATTERY_POLICY macro controls whether a beaconing device steps
+ * down a degradation ladder as its battery runs down. At or below
+ * BATTERY_POLICY_LEVEL_REDUCED percent the TX power mode is capped at low,
+ * the beacon period doubled and the LED and buzzer turned off. At or below
+ * BATTERY_POLICY_LEVEL_LOW the TX power mode is capped at lowest and the
+ * period quadrupled. At or below BATTERY_POLICY_LEVEL_LAST_GASP only a short
+ * burst of beacons, carrying the battery level, is sent every
+ * LAST_GASP_PERIOD. The levels must be above BATTERY_LEVEL_CRITICAL, at which
+ * the device goes dormant.
+ */
+
+#define ENABLE_BATTERY_POLICY
+
+#define BATTERY_POLICY_LEVEL_REDUCED        (30)
+#define BATTERY_POLICY_LEVEL_LOW            (20)
+#define BATTERY_POLICY_LEVEL_LAST_GASP      (10)
+#define LAST_GASP_PERIOD                    (5 * MINUTE)
+
+
+/* This macro when defined enables the debug output on UART */
+#if defined(BUILD_PROFILE_FIELD_DEBUG) || defined(BUILD_PROFILE_LAB)
 #define DEBUG_OUTPUT_ENABLED
+#endif
 
 
 /* The CONNECTED_IDLE_TIMEOUT_VALUE macro specifies how long the application may
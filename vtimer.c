@@ -0,0 +1,355 @@
+/******************************************************************************
+ *  FILE
+ *      vtimer.c
+ *
+ *  DESCRIPTION
+ *      This file implements the virtual timers. Each virtual timer has a
+ *      deadline and a slack, and may expire at any time between the two. The
+ *      single chip timer is set for the earliest latest time of all the
+ *      running timers, and when it expires every timer whose deadline has
+ *      passed expires with it. Timers with overlapping windows therefore
+ *      share one wake of the CPU, and none expires outside its window.
+ *
+ *      The uptime clock is brought up to date each time the chip timer is
+ *      set. The chip timer is never set further ahead than
+ *      VTIMER_CLOCK_PERIOD, so the clock is updated within each wrap of the
+ *      32-bit system time even when no virtual timer is running.
+ *
+ *****************************************************************************/
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <timer.h>          /* Chip timer functions */
+#include <time.h>           /* Chip time functions */
+
+/*============================================================================*
+ *  Local Header Files
+ *============================================================================*/
+
+#include "vtimer.h"         /* Interface to this file */
+#include "esurl_beacon.h"    /* Definitions used throughout the GATT server */
+
+/*============================================================================*
+ *  Private Definitions
+ *============================================================================*/
+
+/* Longest time the chip timer is set for. The uptime clock must be brought
+ * up to date within each wrap of the 32-bit system time, about 71 minutes.
+ * Whenever a virtual timer is running more often than this, as while
+ * beaconing, it costs no wakes of its own.
+ */
+#define VTIMER_CLOCK_PERIOD                 (20 * MINUTE)
+
+/*============================================================================*
+ *  Private Data Types
+ *============================================================================*/
+
+/* Virtual timer */
+typedef struct _VTIMER_T
+{
+    /* Function to call on expiry, or NULL if the timer is not running */
+    vtimer_callback handler;
+
+    /* Earliest time of expiry */
+    uint32 deadline;
+
+    /* Latest time of expiry, relative to the deadline */
+    uint32 slack;
+
+} VTIMER_T;
+
+/*============================================================================*
+ *  Private Data
+ *============================================================================*/
+
+/* Virtual timers, indexed by vtimer_id */
+static VTIMER_T g_vtimers[VTIMER_MAX];
+
+/* Chip timer set for the next wake */
+static timer_id g_vtimer_tid;
+
+/* TRUE while expired timers are being called, so that timers created or
+ * deleted by their handlers do not reset the chip timer each time
+ */
+static bool g_vtimer_expiring;
+
+/* Seconds since chip reset */
+static uint32 g_vtimer_uptime;
+
+/* System time at which the uptime last went up by a whole second */
+static uint32 g_vtimer_clock_last;
+
+/*============================================================================*
+ *  Private Function Prototypes
+ *============================================================================*/
+
+/* Bring the uptime clock up to date */
+static void vtimerUpdateClock(void);
+
+/* Set the chip timer for the next wake */
+static void vtimerSchedule(void);
+
+/* Handle the expiry of the chip timer */
+static void vtimerTimerHandler(timer_id tid);
+
+/*============================================================================*
+ *  Private Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      vtimerUpdateClock
+ *
+ *  DESCRIPTION
+ *      This function adds the whole seconds elapsed since the last update to
+ *      the uptime clock. The system time is subtracted modulo 2^32, so a
+ *      wrap of the system time between updates is handled.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void vtimerUpdateClock(void)
+{
+    uint32 elapsed = TimeGet32() - g_vtimer_clock_last;
+
+    g_vtimer_uptime += elapsed / SECOND;
+    g_vtimer_clock_last += elapsed - (elapsed % SECOND);
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      vtimerSchedule
+ *
+ *  DESCRIPTION
+ *      This function sets the chip timer for the earliest latest time of the
+ *      running virtual timers, or for VTIMER_CLOCK_PERIOD if that is sooner,
+ *      and brings the uptime clock up to date.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void vtimerSchedule(void)
+{
+    uint32 now = TimeGet32();
+    int32 wait;
+    int32 next_wait = VTIMER_CLOCK_PERIOD;
+    uint16 i;
+
+    vtimerUpdateClock();
+
+    if(g_vtimer_tid != TIMER_INVALID)
+    {
+        TimerDelete(g_vtimer_tid);
+        g_vtimer_tid = TIMER_INVALID;
+    }
+
+    for(i = 0; i < VTIMER_MAX; i++)
+    {
+        if(g_vtimers[i].handler != NULL)
+        {
+            wait = (int32)(g_vtimers[i].deadline + g_vtimers[i].slack - now);
+
+            if(wait < next_wait)
+            {
+                next_wait = wait;
+            }
+        }
+    }
+
+    if(next_wait < 0)
+    {
+        next_wait = 0;
+    }
+
+    g_vtimer_tid = TimerCreate((uint32)next_wait, TRUE,
+                               vtimerTimerHandler);
+
+    /* Without the chip timer no virtual timer would ever expire again */
+    if(g_vtimer_tid == TIMER_INVALID)
+    {
+        ReportPanic(app_panic_timer_create);
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      vtimerTimerHandler
+ *
+ *  DESCRIPTION
+ *      This function expires every virtual timer whose deadline has passed
+ *      when the chip timer expires.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of timer that has expired
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+static void vtimerTimerHandler(timer_id tid)
+{
+    vtimer_callback handler;
+    uint32 now;
+    uint16 i;
+
+    if(tid == g_vtimer_tid)
+    {
+        g_vtimer_tid = TIMER_INVALID;
+        g_vtimer_expiring = TRUE;
+
+        now = TimeGet32();
+
+        for(i = 0; i < VTIMER_MAX; i++)
+        {
+            handler = g_vtimers[i].handler;
+
+            if(handler != NULL &&
+               (int32)(now - g_vtimers[i].deadline) >= 0)
+            {
+                /* The timer stops before its handler is called, so that the
+                 * handler may start it again
+                 */
+                g_vtimers[i].handler = NULL;
+
+                handler(i);
+            }
+        }
+
+        g_vtimer_expiring = FALSE;
+
+        vtimerSchedule();
+    }
+}
+
+/*============================================================================*
+ *  Public Function Implementations
+ *============================================================================*/
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      VTimerInit
+ *
+ *  DESCRIPTION
+ *      This function initialises the virtual timers at chip reset, and starts
+ *      the uptime clock at zero. It must be called after TimerInit().
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void VTimerInit(void)
+{
+    uint16 i;
+
+    for(i = 0; i < VTIMER_MAX; i++)
+    {
+        g_vtimers[i].handler = NULL;
+    }
+
+    g_vtimer_tid = TIMER_INVALID;
+    g_vtimer_expiring = FALSE;
+
+    g_vtimer_uptime = 0;
+    g_vtimer_clock_last = TimeGet32();
+
+    /* Keep the uptime clock running */
+    vtimerSchedule();
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      VTimerCreate
+ *
+ *  DESCRIPTION
+ *      This function starts a one-shot virtual timer. The timer expires no
+ *      earlier than 'timeout' and no later than 'timeout' plus 'slack', at a
+ *      time chosen to share a wake with other timers where possible.
+ *
+ *  PARAMETERS
+ *      timeout [in]            Time to the deadline, microseconds
+ *      slack [in]              Time the expiry may be delayed, microseconds
+ *      handler [in]            Function to call on expiry
+ *
+ *  RETURNS
+ *      ID of the timer, or VTIMER_INVALID if every virtual timer is running
+ *----------------------------------------------------------------------------*/
+extern vtimer_id VTimerCreate(uint32 timeout, uint32 slack,
+                              vtimer_callback handler)
+{
+    uint16 i;
+
+    for(i = 0; i < VTIMER_MAX; i++)
+    {
+        if(g_vtimers[i].handler == NULL)
+        {
+            g_vtimers[i].handler = handler;
+            g_vtimers[i].deadline = TimeGet32() + timeout;
+            g_vtimers[i].slack = slack;
+
+            if(!g_vtimer_expiring)
+            {
+                vtimerSchedule();
+            }
+
+            return i;
+        }
+    }
+
+    return VTIMER_INVALID;
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      VTimerDelete
+ *
+ *  DESCRIPTION
+ *      This function stops a virtual timer.
+ *
+ *  PARAMETERS
+ *      tid [in]                ID of the timer
+ *
+ *  RETURNS
+ *      Nothing
+ *----------------------------------------------------------------------------*/
+extern void VTimerDelete(vtimer_id tid)
+{
+    if(tid < VTIMER_MAX && g_vtimers[tid].handler != NULL)
+    {
+        g_vtimers[tid].handler = NULL;
+
+        if(!g_vtimer_expiring)
+        {
+            vtimerSchedule();
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------*
+ *  NAME
+ *      VTimerGetUptime
+ *
+ *  DESCRIPTION
+ *      This function returns the uptime clock, which counts the seconds
+ *      since chip reset.
+ *
+ *  PARAMETERS
+ *      None
+ *
+ *  RETURNS
+ *      Seconds since chip reset
+ *----------------------------------------------------------------------------*/
+extern uint32 VTimerGetUptime(void)
+{
+    vtimerUpdateClock();
+
+    return g_vtimer_uptime;
+}
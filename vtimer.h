@@ -0,0 +1,66 @@
+/******************************************************************************
+ *  FILE
+ *      vtimer.h
+ *
+ *  DESCRIPTION
+ *      Header definitions for the virtual timers. Any number of software
+ *      timers, up to VTIMER_MAX, run on a single chip timer, and timers whose
+ *      deadlines fall within each other's slack expire in a single wake. The
+ *      virtual timers also keep the uptime clock, which counts the seconds
+ *      since chip reset.
+ *
+ *****************************************************************************/
+
+#ifndef __VTIMER_H__
+#define __VTIMER_H__
+
+/*============================================================================*
+ *  SDK Header Files
+ *============================================================================*/
+
+#include <types.h>          /* Commonly used type definitions */
+#include <time.h>           /* Chip time functions */
+
+/*============================================================================*
+ *  Public Definitions
+ *============================================================================*/
+
+/* Number of virtual timers which can run at once */
+#define VTIMER_MAX                          (8)
+
+/* Value of a vtimer_id which does not refer to a running timer */
+#define VTIMER_INVALID                      (0xFFFF)
+
+/* Longest timeout plus slack of a virtual timer, which must be shorter than
+ * half the period of the 32-bit system time
+ */
+#define VTIMER_TIMEOUT_MAX                  (30 * MINUTE)
+
+/*============================================================================*
+ *  Public Data Types
+ *============================================================================*/
+
+/* Virtual timer identifier */
+typedef uint16 vtimer_id;
+
+/* Function called when a virtual timer expires */
+typedef void (*vtimer_callback)(vtimer_id tid);
+
+/*============================================================================*
+ *  Public Function Prototypes
+ *============================================================================*/
+
+/* Initialise the virtual timers at chip reset */
+extern void VTimerInit(void);
+
+/* Start a one-shot virtual timer which may expire up to 'slack' late */
+extern vtimer_id VTimerCreate(uint32 timeout, uint32 slack,
+                              vtimer_callback handler);
+
+/* Stop a virtual timer */
+extern void VTimerDelete(vtimer_id tid);
+
+/* Return the number of seconds since chip reset */
+extern uint32 VTimerGetUptime(void);
+
+#endif /* __VTIMER_H__ */